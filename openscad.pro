@@ -188,6 +188,11 @@ mdi {
   DEFINES += ENABLE_MDI
 }
 
+# Use CGAL's lazy exact kernel for 3D geometry
+lazykernel {
+  DEFINES += USE_LAZY_KERNEL
+}
+
 include(common.pri)
 
 # mingw has to come after other items so OBJECT_DIRS will work properly
@@ -218,6 +223,7 @@ FLEXSOURCES += src/lexer.l
 BISONSOURCES += src/parser.y
 
 HEADERS += src/AST.h \
+           src/ASTOptimizer.h \
            src/ModuleInstantiation.h \
            src/Package.h \
            src/Assignment.h \
@@ -227,6 +233,7 @@ HEADERS += src/AST.h \
            src/UserModule.h \
 
 SOURCES += src/AST.cc \
+           src/ASTOptimizer.cc \
            src/ModuleInstantiation.cc \
            src/expr.cc \
            src/function.cc \
@@ -299,11 +306,16 @@ HEADERS += src/version_check.h \
            src/Polygon2d.h \
            src/clipper-utils.h \
            src/GeometryUtils.h \
+           src/VertexWelder.h \
+           src/MeshSlicer.h \
            src/polyset-utils.h \
            src/polyset.h \
+           src/VertexBufferCache.h \
            src/printutils.h \
+           src/parallel.h \
            src/fileutils.h \
            src/value.h \
+           src/ValueIndex.h \
            src/progress.h \
            src/editor.h \
            src/NodeVisitor.h \
@@ -311,8 +323,13 @@ HEADERS += src/version_check.h \
            src/nodecache.h \
            src/nodedumper.h \
            src/ModuleCache.h \
+           src/ASTCache.h \
+           src/SourceBuffer.h \
            src/GeometryCache.h \
+           src/ImportCache.h \
            src/GeometryEvaluator.h \
+           src/ShardedRenderer.h \
+           src/SoftwareRasterizer.h \
            src/Tree.h \
            src/DrawingCallback.h \
            src/FreetypeRenderer.h \
@@ -378,6 +395,7 @@ SOURCES += \
            src/Camera.cc \
            src/handle_dep.cc \
            src/value.cc \
+           src/ValueIndex.cc \
            src/stackcheck.cc \
            src/func.cc \
            src/localscope.cc \
@@ -394,8 +412,11 @@ SOURCES += \
            src/clipper-utils.cc \
            src/polyset-utils.cc \
            src/GeometryUtils.cc \
+           src/VertexWelder.cc \
+           src/MeshSlicer.cc \
            src/polyset.cc \
            src/polyset-gl.cc \
+           src/VertexBufferCache.cc \
            src/csgops.cc \
            src/transform.cc \
            src/color.cc \
@@ -412,6 +433,7 @@ SOURCES += \
            src/linearextrude.cc \
            src/rotateextrude.cc \
            src/printutils.cc \
+           src/parallel.cc \
            src/fileutils.cc \
            src/progress.cc \
            src/parsersettings.cc \
@@ -422,8 +444,12 @@ SOURCES += \
            src/nodedumper.cc \
            src/NodeVisitor.cc \
            src/GeometryEvaluator.cc \
+           src/ShardedRenderer.cc \
            src/ModuleCache.cc \
+           src/ASTCache.cc \
+           src/SourceBuffer.cc \
            src/GeometryCache.cc \
+           src/ImportCache.cc \
            src/Tree.cc \
 	       src/DrawingCallback.cc \
 	       src/FreetypeRenderer.cc \
@@ -454,6 +480,7 @@ SOURCES += \
            src/export_svg.cc \
            src/export_nef.cc \
            src/export_png.cc \
+           src/SoftwareRasterizer.cc \
            src/import.cc \
            src/import_stl.cc \
            src/import_off.cc \
@@ -546,6 +573,7 @@ HEADERS += src/cgal.h \
            src/cgalutils.h \
            src/Reindexer.h \
            src/CGALCache.h \
+           src/GmpAllocator.h \
            src/CGALRenderer.h \
            src/CGAL_Nef_polyhedron.h \
            src/CGAL_Nef3_workaround.h \
@@ -559,6 +587,7 @@ SOURCES += src/cgalutils.cc \
            src/cgalutils-tess.cc \
            src/cgalutils-polyhedron.cc \
            src/CGALCache.cc \
+           src/GmpAllocator.cc \
            src/CGALRenderer.cc \
            src/CGAL_Nef_polyhedron.cc \
            src/cgalworker.cc \
@@ -0,0 +1,57 @@
+#!/bin/sh
+#
+# Compares CGAL rendering with two OpenSCAD binaries, typically one built
+# with the default Gmpq kernel and one built with -DLAZY_KERNEL=ON.
+#
+# Renders each file to STL with both binaries and prints the render times.
+# It also reports which STL files differ. The lazy kernel converts
+# coordinates to double from an interval, so its output can differ from the
+# Gmpq kernel's in the last bit; differing files need to be compared by
+# geometry, e.g. with tests/export_import_pngtest.py, not treated as errors.
+#
+# Usage: benchmark-kernel.sh <openscad-a> <openscad-b> [file.scad ...]
+#
+
+if [ $# -lt 2 ]; then
+  echo "Usage: $0 <openscad-a> <openscad-b> [file.scad ...]"
+  exit 1
+fi
+
+cmd_a="$1"
+cmd_b="$2"
+shift 2
+[ $# -eq 0 ] && set -- testdata/scad/3D/features/*-tests.scad examples/*/*.scad
+
+out=`mktemp -d`
+trap 'rm -rf "$out"' EXIT
+
+# Prints the seconds it takes to run the given command
+timed() {
+  start=`date +%s.%N`
+  "$@" > /dev/null 2>&1
+  end=`date +%s.%N`
+  echo "$start $end" | awk '{ printf "%.2f", $2 - $1 }'
+}
+
+total_a=0
+total_b=0
+differences=0
+printf "%-50s %10s %10s  %s\n" "file" "a [s]" "b [s]" "result"
+for f in "$@"; do
+  name=`basename "$f" .scad`
+  time_a=`timed "$cmd_a" -o "$out/a.stl" "$f"`
+  time_b=`timed "$cmd_b" -o "$out/b.stl" "$f"`
+  if [ ! -f "$out/a.stl" ] && [ ! -f "$out/b.stl" ]; then
+    result="no 3D output"
+  elif cmp -s "$out/a.stl" "$out/b.stl"; then
+    result="identical"
+  else
+    result="different"
+    differences=`expr $differences + 1`
+  fi
+  rm -f "$out/a.stl" "$out/b.stl"
+  total_a=`echo "$total_a $time_a" | awk '{ printf "%.2f", $1 + $2 }'`
+  total_b=`echo "$total_b $time_b" | awk '{ printf "%.2f", $1 + $2 }'`
+  printf "%-50s %10s %10s  %s\n" "$name" "$time_a" "$time_b" "$result"
+done
+printf "%-50s %10s %10s  %s\n" "total" "$total_a" "$total_b" "$differences different"
@@ -0,0 +1,665 @@
+#include "ASTCache.h"
+#include "FileModule.h"
+#include "UserModule.h"
+#include "ModuleInstantiation.h"
+#include "expression.h"
+#include "function.h"
+#include "ASTOptimizer.h"
+#include "StatCache.h"
+#include "handle_dep.h"
+#include "printutils.h"
+#include "openscad.h"
+#include "parsersettings.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <boost/format.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+extern std::vector<std::string> librarypath;
+
+#define QUOTE(x__) # x__
+#define QUOTED(x__) QUOTE(x__)
+
+/*
+	File layout, all numbers in native byte order:
+
+	header:  magic, format version, OpenSCAD version, library filename,
+	         mtime and size, command line assignments, library path,
+	         resolutions of include<> and use<> paths, included files
+	         with their mtime and size, used files
+	body:    the top level LocalScope of the library
+
+	Expressions are stored as a type tag followed by their members. The
+	optimizations of ASTOptimizer are not stored; the pass runs again after
+	loading. Annotations are not stored either, since they are only used by
+	the customizer for the main file.
+*/
+namespace {
+	const char magic[] = "OpenSCAD AST\n";
+	const uint32_t format_version = 2;
+
+	enum class Tag : uint8_t {
+		None,
+		UnaryOp,
+		BinaryOp,
+		TernaryOp,
+		ArrayLookup,
+		Literal,
+		Range,
+		Vector,
+		Lookup,
+		MemberLookup,
+		FunctionCall,
+		Assert,
+		Echo,
+		Let,
+		LcIf,
+		LcFor,
+		LcForC,
+		LcEach,
+		LcLet,
+		ModuleInstantiation,
+		IfElseModuleInstantiation
+	};
+
+	std::string directory;
+
+	class ASTWriter
+	{
+	public:
+		template <typename T> void put(const T &val) {
+			this->buffer.append(reinterpret_cast<const char *>(&val), sizeof(T));
+		}
+		void putString(const std::string &str) {
+			put<uint32_t>(str.size());
+			this->buffer.append(str);
+		}
+		void putLocation(const Location &loc) {
+			put<int32_t>(loc.firstLine());
+			put<int32_t>(loc.firstColumn());
+			put<int32_t>(loc.lastLine());
+			put<int32_t>(loc.lastColumn());
+		}
+		void putValue(const Value &value);
+		void putArguments(const AssignmentList &args);
+		void putExpression(const Expression *expr);
+		void putInstantiation(const ModuleInstantiation &inst);
+		void putScope(const LocalScope &scope);
+
+		std::string buffer;
+	};
+
+	void ASTWriter::putValue(const Value &value)
+	{
+		auto type = value.type();
+		put<uint8_t>(static_cast<uint8_t>(type));
+		switch (type) {
+		case Value::ValueType::UNDEFINED:
+			break;
+		case Value::ValueType::BOOL:
+			put<uint8_t>(value.toBool());
+			break;
+		case Value::ValueType::NUMBER:
+			put<double>(value.toDouble());
+			break;
+		case Value::ValueType::STRING:
+			putString(value.toString());
+			break;
+		case Value::ValueType::VECTOR: {
+			const auto &vec = value.toVector();
+			put<uint32_t>(vec.size());
+			for (const auto &v : vec) putValue(*v);
+			break;
+		}
+		default:
+			throw std::runtime_error("unsupported literal");
+		}
+	}
+
+	void ASTWriter::putArguments(const AssignmentList &args)
+	{
+		put<uint32_t>(args.size());
+		for (const auto &arg : args) {
+			putString(arg.name);
+			putLocation(arg.location());
+			putExpression(arg.expr.get());
+		}
+	}
+
+	void ASTWriter::putExpression(const Expression *expr)
+	{
+		// Store the expressions as parsed, ASTOptimizer recreates its nodes
+		if (auto e = dynamic_cast<const FoldedExpression *>(expr)) return putExpression(e->getOriginal().get());
+		if (auto e = dynamic_cast<const HoistedExpression *>(expr)) return putExpression(e->getExpr().get());
+
+		if (!expr) {
+			put(Tag::None);
+			return;
+		}
+		if (auto e = dynamic_cast<const UnaryOp *>(expr)) {
+			put(Tag::UnaryOp);
+			put(e->getOp());
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const BinaryOp *>(expr)) {
+			put(Tag::BinaryOp);
+			put(e->getOp());
+			putExpression(e->getLeft().get());
+			putExpression(e->getRight().get());
+		} else if (auto e = dynamic_cast<const TernaryOp *>(expr)) {
+			put(Tag::TernaryOp);
+			putExpression(e->cond.get());
+			putExpression(e->ifexpr.get());
+			putExpression(e->elseexpr.get());
+		} else if (auto e = dynamic_cast<const ArrayLookup *>(expr)) {
+			put(Tag::ArrayLookup);
+			putExpression(e->getArray().get());
+			putExpression(e->getIndex().get());
+		} else if (auto e = dynamic_cast<const Literal *>(expr)) {
+			put(Tag::Literal);
+			putValue(*e->getValue());
+		} else if (auto e = dynamic_cast<const Range *>(expr)) {
+			put(Tag::Range);
+			putExpression(e->getBegin().get());
+			putExpression(e->getStep().get());
+			putExpression(e->getEnd().get());
+		} else if (auto e = dynamic_cast<const Vector *>(expr)) {
+			put(Tag::Vector);
+			put<uint32_t>(e->getChildren().size());
+			for (const auto &child : e->getChildren()) putExpression(child.get());
+		} else if (auto e = dynamic_cast<const Lookup *>(expr)) {
+			put(Tag::Lookup);
+			putString(e->getName());
+		} else if (auto e = dynamic_cast<const MemberLookup *>(expr)) {
+			put(Tag::MemberLookup);
+			putExpression(e->getExpr().get());
+			putString(e->getMember());
+		} else if (auto e = dynamic_cast<const FunctionCall *>(expr)) {
+			put(Tag::FunctionCall);
+			putString(e->name);
+			putArguments(e->arguments);
+		} else if (auto e = dynamic_cast<const Assert *>(expr)) {
+			put(Tag::Assert);
+			putArguments(e->getArguments());
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const Echo *>(expr)) {
+			put(Tag::Echo);
+			putArguments(e->getArguments());
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const Let *>(expr)) {
+			put(Tag::Let);
+			putArguments(e->getArguments());
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const LcIf *>(expr)) {
+			put(Tag::LcIf);
+			putExpression(e->getCond().get());
+			putExpression(e->getIfExpr().get());
+			putExpression(e->getElseExpr().get());
+		} else if (auto e = dynamic_cast<const LcFor *>(expr)) {
+			put(Tag::LcFor);
+			putArguments(e->getArguments());
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const LcForC *>(expr)) {
+			put(Tag::LcForC);
+			putArguments(e->getArguments());
+			putArguments(e->getIncrArguments());
+			putExpression(e->getCond().get());
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const LcEach *>(expr)) {
+			put(Tag::LcEach);
+			putExpression(e->getExpr().get());
+		} else if (auto e = dynamic_cast<const LcLet *>(expr)) {
+			put(Tag::LcLet);
+			putArguments(e->getArguments());
+			putExpression(e->getExpr().get());
+		} else {
+			throw std::runtime_error("unsupported expression");
+		}
+		putLocation(expr->location());
+	}
+
+	void ASTWriter::putInstantiation(const ModuleInstantiation &inst)
+	{
+		auto ifelse = dynamic_cast<const IfElseModuleInstantiation *>(&inst);
+		if (ifelse) {
+			put(Tag::IfElseModuleInstantiation);
+			putExpression(inst.arguments[0].expr.get());
+		}
+		else {
+			put(Tag::ModuleInstantiation);
+			putString(inst.name());
+			putArguments(inst.arguments);
+		}
+		putString(inst.path());
+		putLocation(inst.location());
+		put<uint8_t>(inst.tag_root);
+		put<uint8_t>(inst.tag_highlight);
+		put<uint8_t>(inst.tag_background);
+		putScope(inst.scope);
+		if (ifelse) putScope(ifelse->else_scope);
+	}
+
+	void ASTWriter::putScope(const LocalScope &scope)
+	{
+		put<uint32_t>(scope.astFunctions.size());
+		for (const auto &f : scope.astFunctions) {
+			auto func = dynamic_cast<const UserFunction *>(f.second);
+			if (!func) throw std::runtime_error("unsupported function");
+			putString(func->name);
+			putLocation(func->location());
+			putArguments(func->definition_arguments);
+			putExpression(func->expr.get());
+		}
+		put<uint32_t>(scope.astModules.size());
+		for (const auto &m : scope.astModules) {
+			auto module = dynamic_cast<const UserModule *>(m.second);
+			if (!module) throw std::runtime_error("unsupported module");
+			putString(m.first);
+			putLocation(module->location());
+			putArguments(module->definition_arguments);
+			putScope(module->scope);
+		}
+		putArguments(scope.assignments);
+		put<uint32_t>(scope.children.size());
+		for (const auto &inst : scope.children) putInstantiation(*inst);
+	}
+
+	class ASTReader
+	{
+	public:
+		ASTReader(const char *data, size_t size) : pos(data), end(data + size) {}
+
+		template <typename T> T get() {
+			T val;
+			std::memcpy(&val, take(sizeof(T)), sizeof(T));
+			return val;
+		}
+		std::string getString() {
+			auto size = get<uint32_t>();
+			return std::string(take(size), size);
+		}
+		Location getLocation() {
+			auto firstLine = get<int32_t>();
+			auto firstCol = get<int32_t>();
+			auto lastLine = get<int32_t>();
+			auto lastCol = get<int32_t>();
+			return Location(firstLine, firstCol, lastLine, lastCol);
+		}
+		ValuePtr getValue();
+		AssignmentList getArguments();
+		Expression *getExpression();
+		ModuleInstantiation *getInstantiation();
+		void getScope(LocalScope &scope);
+		bool atEnd() const { return this->pos == this->end; }
+
+	private:
+		const char *take(size_t size) {
+			if (size > size_t(this->end - this->pos)) throw std::runtime_error("truncated file");
+			const char *p = this->pos;
+			this->pos += size;
+			return p;
+		}
+
+		const char *pos;
+		const char *end;
+	};
+
+	ValuePtr ASTReader::getValue()
+	{
+		switch (static_cast<Value::ValueType>(get<uint8_t>())) {
+		case Value::ValueType::UNDEFINED:
+			return ValuePtr::undefined;
+		case Value::ValueType::BOOL:
+			return ValuePtr(get<uint8_t>() != 0);
+		case Value::ValueType::NUMBER:
+			return ValuePtr(get<double>());
+		case Value::ValueType::STRING:
+			return ValuePtr(getString());
+		case Value::ValueType::VECTOR: {
+			Value::VectorType vec;
+			auto size = get<uint32_t>();
+			for (uint32_t i = 0; i < size; i++) vec.push_back(getValue());
+			return ValuePtr(vec);
+		}
+		default:
+			throw std::runtime_error("invalid literal");
+		}
+	}
+
+	AssignmentList ASTReader::getArguments()
+	{
+		AssignmentList args;
+		auto size = get<uint32_t>();
+		for (uint32_t i = 0; i < size; i++) {
+			auto name = getString();
+			auto loc = getLocation();
+			shared_ptr<Expression> expr(getExpression());
+			args.emplace_back(name, expr, loc);
+		}
+		return args;
+	}
+
+	Expression *ASTReader::getExpression()
+	{
+		// Members are read into unique_ptrs first, so nothing leaks if the
+		// file turns out to be truncated
+		typedef std::unique_ptr<Expression> ExprPtr;
+		std::unique_ptr<Expression> expr;
+		auto tag = get<Tag>();
+		switch (tag) {
+		case Tag::None:
+			return nullptr;
+		case Tag::UnaryOp: {
+			auto op = get<UnaryOp::Op>();
+			ExprPtr e(getExpression());
+			expr.reset(new UnaryOp(op, e.release(), Location::NONE));
+			break;
+		}
+		case Tag::BinaryOp: {
+			auto op = get<BinaryOp::Op>();
+			ExprPtr left(getExpression());
+			ExprPtr right(getExpression());
+			expr.reset(new BinaryOp(left.release(), op, right.release(), Location::NONE));
+			break;
+		}
+		case Tag::TernaryOp:
+		case Tag::LcIf: {
+			ExprPtr cond(getExpression());
+			ExprPtr ifexpr(getExpression());
+			ExprPtr elseexpr(getExpression());
+			if (tag == Tag::TernaryOp) expr.reset(new TernaryOp(cond.release(), ifexpr.release(), elseexpr.release(), Location::NONE));
+			else expr.reset(new LcIf(cond.release(), ifexpr.release(), elseexpr.release(), Location::NONE));
+			break;
+		}
+		case Tag::ArrayLookup: {
+			ExprPtr array(getExpression());
+			ExprPtr index(getExpression());
+			expr.reset(new ArrayLookup(array.release(), index.release(), Location::NONE));
+			break;
+		}
+		case Tag::Literal:
+			expr.reset(new Literal(getValue()));
+			break;
+		case Tag::Range: {
+			ExprPtr begin(getExpression());
+			ExprPtr step(getExpression());
+			ExprPtr end(getExpression());
+			expr.reset(new Range(begin.release(), step.release(), end.release(), Location::NONE));
+			break;
+		}
+		case Tag::Vector: {
+			auto vec = new Vector(Location::NONE);
+			expr.reset(vec);
+			auto size = get<uint32_t>();
+			for (uint32_t i = 0; i < size; i++) vec->push_back(getExpression());
+			break;
+		}
+		case Tag::Lookup:
+			expr.reset(new Lookup(getString(), Location::NONE));
+			break;
+		case Tag::MemberLookup: {
+			ExprPtr e(getExpression());
+			auto member = getString();
+			expr.reset(new MemberLookup(e.release(), member, Location::NONE));
+			break;
+		}
+		case Tag::FunctionCall: {
+			auto name = getString();
+			expr.reset(new FunctionCall(name, getArguments(), Location::NONE));
+			break;
+		}
+		case Tag::Assert:
+		case Tag::Echo:
+		case Tag::Let:
+		case Tag::LcFor:
+		case Tag::LcLet: {
+			auto args = getArguments();
+			ExprPtr e(getExpression());
+			if (tag == Tag::Assert) expr.reset(new Assert(args, e.release(), Location::NONE));
+			else if (tag == Tag::Echo) expr.reset(new Echo(args, e.release(), Location::NONE));
+			else if (tag == Tag::Let) expr.reset(new Let(args, e.release(), Location::NONE));
+			else if (tag == Tag::LcFor) expr.reset(new LcFor(args, e.release(), Location::NONE));
+			else expr.reset(new LcLet(args, e.release(), Location::NONE));
+			break;
+		}
+		case Tag::LcForC: {
+			auto args = getArguments();
+			auto incrargs = getArguments();
+			ExprPtr cond(getExpression());
+			ExprPtr e(getExpression());
+			expr.reset(new LcForC(args, incrargs, cond.release(), e.release(), Location::NONE));
+			break;
+		}
+		case Tag::LcEach: {
+			ExprPtr e(getExpression());
+			expr.reset(new LcEach(e.release(), Location::NONE));
+			break;
+		}
+		default:
+			throw std::runtime_error("invalid expression");
+		}
+		expr->setLocation(getLocation());
+		return expr.release();
+	}
+
+	ModuleInstantiation *ASTReader::getInstantiation()
+	{
+		std::unique_ptr<ModuleInstantiation> inst;
+		IfElseModuleInstantiation *ifelse = nullptr;
+		auto tag = get<Tag>();
+		if (tag == Tag::IfElseModuleInstantiation) {
+			shared_ptr<Expression> cond(getExpression());
+			auto path = getString();
+			inst.reset(ifelse = new IfElseModuleInstantiation(cond, path, getLocation()));
+		}
+		else if (tag == Tag::ModuleInstantiation) {
+			auto name = getString();
+			auto args = getArguments();
+			auto path = getString();
+			inst.reset(new ModuleInstantiation(name, args, path, getLocation()));
+		}
+		else {
+			throw std::runtime_error("invalid module instantiation");
+		}
+		inst->tag_root = get<uint8_t>();
+		inst->tag_highlight = get<uint8_t>();
+		inst->tag_background = get<uint8_t>();
+		getScope(inst->scope);
+		if (ifelse) getScope(ifelse->else_scope);
+		return inst.release();
+	}
+
+	void ASTReader::getScope(LocalScope &scope)
+	{
+		auto numFunctions = get<uint32_t>();
+		for (uint32_t i = 0; i < numFunctions; i++) {
+			auto name = getString();
+			auto loc = getLocation();
+			auto args = getArguments();
+			shared_ptr<Expression> expr(getExpression());
+			scope.addFunction(UserFunction::create(name.c_str(), args, expr, loc));
+		}
+		auto numModules = get<uint32_t>();
+		for (uint32_t i = 0; i < numModules; i++) {
+			auto name = getString();
+			auto module = new UserModule(getLocation());
+			scope.addModule(name, module);
+			module->definition_arguments = getArguments();
+			getScope(module->scope);
+		}
+		scope.assignments = getArguments();
+		auto numChildren = get<uint32_t>();
+		for (uint32_t i = 0; i < numChildren; i++) scope.addChild(getInstantiation());
+	}
+
+	fs::path cache_file(const std::string &filename)
+	{
+		// FNV-1a, which unlike std::hash is stable between builds
+		uint64_t hash = 14695981039346656037ULL;
+		for (unsigned char c : filename) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+		return fs::path(directory) / str(boost::format("%016x.ast") % hash);
+	}
+
+	void put_stat(ASTWriter &writer, const struct stat &st)
+	{
+		writer.put<int64_t>(st.st_mtime);
+		writer.put<int64_t>(st.st_size);
+	}
+
+	bool stat_matches(ASTReader &reader, const struct stat &st)
+	{
+		auto mtime = reader.get<int64_t>();
+		auto size = reader.get<int64_t>();
+		return mtime == int64_t(st.st_mtime) && size == int64_t(st.st_size);
+	}
+}
+
+void ASTCache::setDirectory(const std::string &dir)
+{
+	directory = dir;
+}
+
+bool ASTCache::enabled()
+{
+	return !directory.empty();
+}
+
+FileModule *ASTCache::load(const std::string &filename, const struct stat &st)
+{
+	auto path = cache_file(filename);
+	if (!fs::exists(path)) return nullptr;
+
+	try {
+		bip::file_mapping mapping(path.string().c_str(), bip::read_only);
+		bip::mapped_region region(mapping, bip::read_only);
+		ASTReader reader(static_cast<const char *>(region.get_address()), region.get_size());
+
+		if (reader.getString() != magic ||
+				reader.get<uint32_t>() != format_version ||
+				reader.getString() != QUOTED(OPENSCAD_VERSION) ||
+				reader.getString() != filename ||
+				!stat_matches(reader, st) ||
+				reader.getString() != commandline_commands) {
+			return nullptr;
+		}
+		auto numLibraryPaths = reader.get<uint32_t>();
+		if (numLibraryPaths != librarypath.size()) return nullptr;
+		for (const auto &dir : librarypath) {
+			if (reader.getString() != dir) return nullptr;
+		}
+		// A file added to the library path or next to the library can shadow
+		// the file an include<> or use<> resolved to
+		auto numResolutions = reader.get<uint32_t>();
+		for (uint32_t i = 0; i < numResolutions; i++) {
+			auto sourcepath = reader.getString();
+			auto localpath = reader.getString();
+			auto fullpath = reader.getString();
+			if (find_valid_path(sourcepath, localpath).generic_string() != fullpath) return nullptr;
+		}
+
+		std::unique_ptr<FileModule> module(new FileModule());
+		module->setModulePath(fs::path(filename).parent_path().generic_string());
+
+		std::vector<std::string> deps;
+		auto numIncludes = reader.get<uint32_t>();
+		for (uint32_t i = 0; i < numIncludes; i++) {
+			auto localpath = reader.getString();
+			auto fullpath = reader.getString();
+			struct stat incst;
+			if (StatCache::stat(fullpath.c_str(), &incst) != 0 || !stat_matches(reader, incst)) return nullptr;
+			module->registerInclude(localpath, fullpath);
+			deps.push_back(fullpath);
+		}
+		std::vector<std::string> uses;
+		auto numUses = reader.get<uint32_t>();
+		for (uint32_t i = 0; i < numUses; i++) uses.push_back(reader.getString());
+
+		reader.getScope(module->scope);
+		if (!reader.atEnd()) return nullptr;
+
+		// Replay what the lexer does for include<> and use<>
+		for (const auto &dep : deps) handle_dep(dep);
+		for (const auto &use : uses) {
+			if (fs::path(use).is_absolute()) handle_dep(use);
+			module->registerUse(use);
+		}
+
+		ASTOptimizer::optimize(*module);
+		PRINTDB("Loaded cached library '%s' from %s", filename % path.string());
+		return module.release();
+	}
+	catch (const std::exception &e) {
+		PRINTB("WARNING: Ignoring invalid AST cache file '%s': %s", path.string() % e.what());
+		return nullptr;
+	}
+}
+
+void ASTCache::store(const std::string &filename, const struct stat &st, const FileModule &module)
+{
+	auto path = cache_file(filename);
+	try {
+		ASTWriter writer;
+		writer.putString(magic);
+		writer.put(format_version);
+		writer.putString(QUOTED(OPENSCAD_VERSION));
+		writer.putString(filename);
+		put_stat(writer, st);
+		writer.putString(commandline_commands);
+		writer.put<uint32_t>(librarypath.size());
+		for (const auto &dir : librarypath) writer.putString(dir);
+		writer.put<uint32_t>(module.resolutions.size());
+		for (const auto &res : module.resolutions) {
+			writer.putString(res.sourcepath);
+			writer.putString(res.localpath);
+			writer.putString(res.fullpath);
+		}
+
+		const auto &includes = module.includedFiles();
+		writer.put<uint32_t>(includes.size());
+		for (const auto &inc : includes) {
+			// Missing include files are reported while parsing, so don't cache
+			// the module until they are found
+			struct stat incst;
+			if (StatCache::stat(inc.second.filename.c_str(), &incst) != 0) return;
+			writer.putString(inc.first);
+			writer.putString(inc.second.filename);
+			put_stat(writer, incst);
+		}
+		writer.put<uint32_t>(module.usedlibs.size() + module.usedfonts.size());
+		for (const auto &use : module.usedlibs) {
+			// Same for missing libraries
+			if (!fs::path(use).is_absolute()) return;
+			writer.putString(use);
+		}
+		for (const auto &font : module.usedfonts) writer.putString(font);
+
+		writer.putScope(module.scope);
+
+		// Write to a temporary file first, so concurrent processes never see
+		// a partially written cache file
+		fs::create_directories(directory);
+		auto tmppath = fs::path(directory) / fs::unique_path("%%%%-%%%%-%%%%.tmp");
+		std::ofstream out(tmppath.string().c_str(), std::ios::binary);
+		out.write(writer.buffer.data(), writer.buffer.size());
+		out.close();
+		boost::system::error_code ec;
+		if (out) fs::rename(tmppath, path, ec);
+		if (!out || ec) {
+			fs::remove(tmppath, ec);
+			throw std::runtime_error("write failed");
+		}
+	}
+	catch (const std::exception &e) {
+		PRINTB("WARNING: Can't write AST cache file '%s': %s", path.string() % e.what());
+	}
+}
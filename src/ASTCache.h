@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+#include <sys/stat.h>
+
+class FileModule;
+
+/*!
+	On-disk cache of parsed library files.
+
+	Libraries referenced by use<> are stored in a compact binary form after
+	they have been parsed, and later processes load them back by mapping the
+	cache file into memory instead of running the lexer and parser again.
+
+	A cache file is only used if the format and OpenSCAD version match, and if
+	the library, all files it includes, the library search path and the
+	command line assignments (-D) are the same as when the file was written.
+	Each include<> and use<> path must also still resolve to the same file,
+	so a file added earlier in the search path invalidates the cache.
+
+	The cache is disabled unless a directory is set, see --ast-cache.
+*/
+namespace ASTCache
+{
+	void setDirectory(const std::string &dir);
+	bool enabled();
+
+	// Returns nullptr if there is no valid cache file for filename
+	FileModule *load(const std::string &filename, const struct stat &st);
+	// Writes the freshly parsed module to the cache
+	void store(const std::string &filename, const struct stat &st, const FileModule &module);
+}
@@ -0,0 +1,398 @@
+#include "ASTOptimizer.h"
+#include "FileModule.h"
+#include "UserModule.h"
+#include "ModuleInstantiation.h"
+#include "expression.h"
+#include "function.h"
+#include "context.h"
+
+#include <algorithm>
+#include <functional>
+
+namespace {
+	typedef std::function<void (shared_ptr<Expression> &)> ChildFunc;
+
+	void for_each_argument(AssignmentList &args, const ChildFunc &f) {
+		for (auto &arg : args) {
+			if (arg.expr) f(arg.expr);
+		}
+	}
+
+	bool is_constant(const shared_ptr<Expression> &expr) {
+		return dynamic_cast<const Literal *>(expr.get()) || dynamic_cast<const FoldedExpression *>(expr.get());
+	}
+
+	bool is_config_variable(const std::string &name) {
+		return name[0] == '$';
+	}
+}
+
+// Calls f for every direct subexpression of expr
+void ASTOptimizer::forEachChild(Expression &expr, const ChildFunc &f)
+{
+	if (auto e = dynamic_cast<UnaryOp *>(&expr)) {
+		f(e->expr);
+	} else if (auto e = dynamic_cast<BinaryOp *>(&expr)) {
+		f(e->left);
+		f(e->right);
+	} else if (auto e = dynamic_cast<TernaryOp *>(&expr)) {
+		f(e->cond);
+		f(e->ifexpr);
+		f(e->elseexpr);
+	} else if (auto e = dynamic_cast<ArrayLookup *>(&expr)) {
+		f(e->array);
+		f(e->index);
+	} else if (auto e = dynamic_cast<Range *>(&expr)) {
+		f(e->begin);
+		if (e->step) f(e->step);
+		f(e->end);
+	} else if (auto e = dynamic_cast<Vector *>(&expr)) {
+		for (auto &child : e->children) f(child);
+	} else if (auto e = dynamic_cast<MemberLookup *>(&expr)) {
+		f(e->expr);
+	} else if (auto e = dynamic_cast<FunctionCall *>(&expr)) {
+		for_each_argument(e->arguments, f);
+	} else if (auto e = dynamic_cast<Assert *>(&expr)) {
+		for_each_argument(e->arguments, f);
+		if (e->expr) f(e->expr);
+	} else if (auto e = dynamic_cast<Echo *>(&expr)) {
+		for_each_argument(e->arguments, f);
+		if (e->expr) f(e->expr);
+	} else if (auto e = dynamic_cast<Let *>(&expr)) {
+		for_each_argument(e->arguments, f);
+		f(e->expr);
+	} else if (auto e = dynamic_cast<LcIf *>(&expr)) {
+		f(e->cond);
+		f(e->ifexpr);
+		if (e->elseexpr) f(e->elseexpr);
+	} else if (auto e = dynamic_cast<LcFor *>(&expr)) {
+		for_each_argument(e->arguments, f);
+		f(e->expr);
+	} else if (auto e = dynamic_cast<LcForC *>(&expr)) {
+		for_each_argument(e->arguments, f);
+		for_each_argument(e->incr_arguments, f);
+		f(e->cond);
+		f(e->expr);
+	} else if (auto e = dynamic_cast<LcEach *>(&expr)) {
+		f(e->expr);
+	} else if (auto e = dynamic_cast<LcLet *>(&expr)) {
+		for_each_argument(e->arguments, f);
+		f(e->expr);
+	}
+}
+
+/*!
+	Returns true if the value of expr depends only on the variables it
+	references, and adds those to names. This excludes function calls and
+	special variables, which can be rebound by callers.
+	cost is increased by the number of operations in expr.
+*/
+bool ASTOptimizer::isPure(const shared_ptr<Expression> &expr, std::vector<std::string> &names, unsigned int &cost)
+{
+	if (is_constant(expr)) return true;
+	if (auto lookup = dynamic_cast<const Lookup *>(expr.get())) {
+		if (is_config_variable(lookup->name)) return false;
+		if (std::find(names.begin(), names.end(), lookup->name) == names.end()) names.push_back(lookup->name);
+		return true;
+	}
+	if (auto vec = dynamic_cast<const Vector *>(expr.get())) {
+		for (const auto &child : vec->children) {
+			if (dynamic_cast<const ListComprehension *>(child.get())) return false;
+		}
+		cost++; // Allocation of the result
+	}
+	else if (!dynamic_cast<const UnaryOp *>(expr.get()) &&
+					 !dynamic_cast<const BinaryOp *>(expr.get()) &&
+					 !dynamic_cast<const TernaryOp *>(expr.get()) &&
+					 !dynamic_cast<const ArrayLookup *>(expr.get()) &&
+					 !dynamic_cast<const MemberLookup *>(expr.get()) &&
+					 !dynamic_cast<const Range *>(expr.get())) {
+		return false;
+	}
+	cost++;
+	bool pure = true;
+	forEachChild(*expr, [&](shared_ptr<Expression> &child) {
+			if (pure) pure = isPure(child, names, cost);
+		});
+	return pure;
+}
+
+bool ASTOptimizer::isPure(const shared_ptr<Expression> &expr, std::vector<std::string> &names)
+{
+	unsigned int cost = 0;
+	return isPure(expr, names, cost);
+}
+
+bool ASTOptimizer::isFoldable(const shared_ptr<Expression> &expr)
+{
+	if (is_constant(expr)) return false;
+	if (auto ternary = dynamic_cast<const TernaryOp *>(expr.get())) {
+		return is_constant(ternary->cond) &&
+			is_constant(ternary->cond->evaluate(nullptr)->toBool() ? ternary->ifexpr : ternary->elseexpr);
+	}
+	std::vector<std::string> names;
+	if (!isPure(expr, names) || !names.empty()) return false;
+	bool constant = true;
+	forEachChild(*expr, [&](shared_ptr<Expression> &child) {
+			if (!is_constant(child)) constant = false;
+		});
+	return constant;
+}
+
+// Adds the names of the variables which are bound anywhere inside expr
+void ASTOptimizer::collectBoundNames(Expression &expr, std::unordered_set<std::string> &names)
+{
+	auto add = [&names](const AssignmentList &args) {
+		for (const auto &arg : args) names.insert(arg.name);
+	};
+	if (auto e = dynamic_cast<Let *>(&expr)) add(e->arguments);
+	else if (auto e = dynamic_cast<LcLet *>(&expr)) add(e->arguments);
+	else if (auto e = dynamic_cast<LcFor *>(&expr)) add(e->arguments);
+	else if (auto e = dynamic_cast<LcForC *>(&expr)) {
+		add(e->arguments);
+		add(e->incr_arguments);
+	}
+	forEachChild(expr, [&names](shared_ptr<Expression> &child) {
+			collectBoundNames(*child, names);
+		});
+}
+
+void ASTOptimizer::collectBoundNames(ModuleInstantiation &inst, std::unordered_set<std::string> &names)
+{
+	// Named arguments bind variables in the bodies of let(), for() etc.
+	for (auto &arg : inst.arguments) {
+		if (!arg.name.empty()) names.insert(arg.name);
+		if (arg.expr) collectBoundNames(*arg.expr, names);
+	}
+	collectBoundNames(inst.scope, names);
+	if (auto ifelse = dynamic_cast<IfElseModuleInstantiation *>(&inst)) {
+		collectBoundNames(ifelse->else_scope, names);
+	}
+}
+
+void ASTOptimizer::collectBoundNames(LocalScope &scope, std::unordered_set<std::string> &names)
+{
+	for (auto &ass : scope.assignments) {
+		names.insert(ass.name);
+		if (ass.expr) collectBoundNames(*ass.expr, names);
+	}
+	for (auto &child : scope.children) collectBoundNames(*child, names);
+}
+
+/*!
+	Replaces the largest subexpressions of expr which don't depend on any of
+	the bound names by HoistedExpression nodes, and adds those to invariants.
+*/
+void ASTOptimizer::extractInvariants(shared_ptr<Expression> &expr, const std::unordered_set<std::string> &bound,
+																					 std::vector<shared_ptr<HoistedExpression>> &invariants)
+{
+	std::vector<std::string> names;
+	unsigned int cost = 0;
+	if (isPure(expr, names, cost)) {
+		bool invariant = std::none_of(names.begin(), names.end(), [&bound](const std::string &name) {
+				return bound.find(name) != bound.end();
+			});
+		// Looking up the hidden variable is about as expensive as one operation
+		if (invariant && cost >= 2) {
+			auto hoisted = make_shared<HoistedExpression>(expr, names);
+			invariants.push_back(hoisted);
+			expr = hoisted;
+		}
+		if (invariant) return;
+	}
+	forEachChild(*expr, [&](shared_ptr<Expression> &child) {
+			extractInvariants(child, bound, invariants);
+		});
+}
+
+void ASTOptimizer::extractInvariants(ModuleInstantiation &inst, const std::unordered_set<std::string> &bound,
+																					 std::vector<shared_ptr<HoistedExpression>> &invariants)
+{
+	for (auto &arg : inst.arguments) {
+		if (arg.expr) extractInvariants(arg.expr, bound, invariants);
+	}
+	extractInvariants(inst.scope, bound, invariants);
+	if (auto ifelse = dynamic_cast<IfElseModuleInstantiation *>(&inst)) {
+		extractInvariants(ifelse->else_scope, bound, invariants);
+	}
+}
+
+void ASTOptimizer::extractInvariants(LocalScope &scope, const std::unordered_set<std::string> &bound,
+																					 std::vector<shared_ptr<HoistedExpression>> &invariants)
+{
+	for (auto &ass : scope.assignments) {
+		if (ass.expr) extractInvariants(ass.expr, bound, invariants);
+	}
+	for (auto &child : scope.children) extractInvariants(*child, bound, invariants);
+}
+
+void ASTOptimizer::optimize(FileModule &module)
+{
+	ASTOptimizer optimizer(module.scope);
+	optimizer.foldScope(module.scope);
+	optimizer.hoistScope(module.scope);
+}
+
+void ASTOptimizer::foldScope(LocalScope &scope)
+{
+	bool local = &scope != &this->toplevel;
+	if (local) {
+		this->localFunctions.emplace_back();
+		for (const auto &f : scope.functions) this->localFunctions.back().insert(f.first);
+	}
+
+	for (auto &f : scope.astFunctions) {
+		if (auto func = dynamic_cast<UserFunction *>(f.second)) {
+			for_each_argument(func->definition_arguments, [this](shared_ptr<Expression> &expr) { fold(expr); });
+			if (func->expr) fold(func->expr);
+		}
+	}
+	for (auto &m : scope.astModules) {
+		if (auto module = dynamic_cast<UserModule *>(m.second)) {
+			for_each_argument(module->definition_arguments, [this](shared_ptr<Expression> &expr) { fold(expr); });
+			foldScope(module->scope);
+		}
+	}
+	for (auto &ass : scope.assignments) {
+		if (ass.expr) fold(ass.expr);
+	}
+	for (auto &child : scope.children) foldInstantiation(*child);
+
+	if (local) this->localFunctions.pop_back();
+}
+
+void ASTOptimizer::foldInstantiation(ModuleInstantiation &inst)
+{
+	for_each_argument(inst.arguments, [this](shared_ptr<Expression> &expr) { fold(expr); });
+	foldScope(inst.scope);
+	if (auto ifelse = dynamic_cast<IfElseModuleInstantiation *>(&inst)) foldScope(ifelse->else_scope);
+}
+
+void ASTOptimizer::fold(shared_ptr<Expression> &expr)
+{
+	forEachChild(*expr, [this](shared_ptr<Expression> &child) { fold(child); });
+
+	if (isFoldable(expr)) {
+		// Constant expressions don't look up anything, so any context will do
+		Context ctx;
+		expr = make_shared<FoldedExpression>(expr, expr->evaluate(&ctx));
+	}
+	else inlineCall(expr);
+}
+
+/*!
+	Returns the top-level function name refers to at the current position, if
+	its body is a single expression depending only on its parameters and it has
+	no non-constant default arguments.
+*/
+const UserFunction *ASTOptimizer::inlinableFunction(const std::string &name)
+{
+	for (const auto &names : this->localFunctions) {
+		if (names.find(name) != names.end()) return nullptr;
+	}
+	auto it = this->toplevel.functions.find(name);
+	if (it == this->toplevel.functions.end()) return nullptr;
+	auto func = dynamic_cast<const UserFunction *>(it->second);
+	if (!func || !func->expr) return nullptr;
+
+	auto cached = this->inlinable.find(func);
+	if (cached != this->inlinable.end()) return cached->second ? func : nullptr;
+
+	bool result = true;
+	std::vector<std::string> params;
+	for (const auto &arg : func->definition_arguments) {
+		std::vector<std::string> names;
+		if (is_config_variable(arg.name) || (arg.expr && (!isPure(arg.expr, names) || !names.empty()))) {
+			result = false;
+		}
+		params.push_back(arg.name);
+	}
+	std::vector<std::string> names;
+	if (result && isPure(func->expr, names)) {
+		for (const auto &name : names) {
+			if (std::find(params.begin(), params.end(), name) == params.end()) result = false;
+		}
+	}
+	else result = false;
+
+	this->inlinable[func] = result;
+	return result ? func : nullptr;
+}
+
+/*!
+	Replaces a call with constant arguments to an inlinable function by its
+	value. Arguments are matched to parameters like in EvalContext::resolveArguments().
+*/
+bool ASTOptimizer::inlineCall(shared_ptr<Expression> &expr)
+{
+	auto call = dynamic_cast<FunctionCall *>(expr.get());
+	if (!call) return false;
+	for (const auto &arg : call->arguments) {
+		if (!arg.expr || !is_constant(arg.expr)) return false;
+	}
+	const UserFunction *func = inlinableFunction(call->name);
+	if (!func) return false;
+
+	Context ctx;
+	for (const auto &arg : func->definition_arguments) {
+		ctx.set_variable(arg.name, arg.expr ? arg.expr->evaluate(&ctx) : ValuePtr::undefined);
+	}
+	std::unordered_map<std::string, const Expression *> resolved;
+	size_t posarg = 0;
+	for (const auto &arg : call->arguments) {
+		if (!arg.name.empty()) resolved[arg.name] = arg.expr.get();
+		else if (posarg < func->definition_arguments.size()) {
+			resolved[func->definition_arguments[posarg++].name] = arg.expr.get();
+		}
+	}
+	for (const auto &arg : resolved) ctx.set_variable(arg.first, arg.second->evaluate(&ctx));
+
+	expr = make_shared<FoldedExpression>(expr, func->expr->evaluate(&ctx));
+	return true;
+}
+
+void ASTOptimizer::hoistScope(LocalScope &scope)
+{
+	for (auto &f : scope.astFunctions) {
+		if (auto func = dynamic_cast<UserFunction *>(f.second)) {
+			for_each_argument(func->definition_arguments, [this](shared_ptr<Expression> &expr) { hoist(expr); });
+			if (func->expr) hoist(func->expr);
+		}
+	}
+	for (auto &m : scope.astModules) {
+		if (auto module = dynamic_cast<UserModule *>(m.second)) {
+			for_each_argument(module->definition_arguments, [this](shared_ptr<Expression> &expr) { hoist(expr); });
+			hoistScope(module->scope);
+		}
+	}
+	for (auto &ass : scope.assignments) {
+		if (ass.expr) hoist(ass.expr);
+	}
+	for (auto &child : scope.children) hoistInstantiation(*child);
+}
+
+void ASTOptimizer::hoistInstantiation(ModuleInstantiation &inst)
+{
+	if (inst.name() == "for" || inst.name() == "intersection_for") {
+		std::unordered_set<std::string> bound;
+		for (const auto &arg : inst.arguments) bound.insert(arg.name);
+		collectBoundNames(inst.scope, bound);
+		extractInvariants(inst.scope, bound, inst.invariants);
+	}
+
+	for_each_argument(inst.arguments, [this](shared_ptr<Expression> &expr) { hoist(expr); });
+	hoistScope(inst.scope);
+	if (auto ifelse = dynamic_cast<IfElseModuleInstantiation *>(&inst)) hoistScope(ifelse->else_scope);
+}
+
+void ASTOptimizer::hoist(shared_ptr<Expression> &expr)
+{
+	if (auto lcfor = dynamic_cast<LcFor *>(expr.get())) {
+		std::unordered_set<std::string> bound;
+		for (const auto &arg : lcfor->arguments) bound.insert(arg.name);
+		collectBoundNames(*lcfor->expr, bound);
+		extractInvariants(lcfor->expr, bound, lcfor->invariants);
+	}
+
+	forEachChild(*expr, [this](shared_ptr<Expression> &child) { hoist(child); });
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <functional>
+#include "memory.h"
+
+/*!
+	Optimization pass over a parsed FileModule, run once after parsing.
+
+	- Constant subexpressions (arithmetic on literals, vector and range literals)
+	  are folded into FoldedExpression nodes.
+	- Calls to top-level functions whose body is a single pure expression of
+	  their parameters are evaluated if all arguments are constant.
+	- Loop invariant subexpressions of LcFor and for()/intersection_for() bodies
+	  are replaced by HoistedExpression nodes, which are evaluated at most once
+	  per loop evaluation, on first use.
+
+	All replacement nodes print as the original source, so AST dumps are not
+	affected by the pass.
+*/
+class ASTOptimizer
+{
+public:
+	static void optimize(class FileModule &module);
+
+private:
+	ASTOptimizer(const class LocalScope &toplevel) : toplevel(toplevel) {}
+
+	void foldScope(LocalScope &scope);
+	void foldInstantiation(class ModuleInstantiation &inst);
+	void fold(shared_ptr<class Expression> &expr);
+	bool inlineCall(shared_ptr<Expression> &expr);
+	const class UserFunction *inlinableFunction(const std::string &name);
+
+	void hoistScope(LocalScope &scope);
+	void hoistInstantiation(ModuleInstantiation &inst);
+	void hoist(shared_ptr<Expression> &expr);
+
+	typedef std::function<void (shared_ptr<Expression> &)> ChildFunc;
+	static void forEachChild(Expression &expr, const ChildFunc &f);
+	static bool isPure(const shared_ptr<Expression> &expr, std::vector<std::string> &names, unsigned int &cost);
+	static bool isPure(const shared_ptr<Expression> &expr, std::vector<std::string> &names);
+	static bool isFoldable(const shared_ptr<Expression> &expr);
+	static void collectBoundNames(Expression &expr, std::unordered_set<std::string> &names);
+	static void collectBoundNames(ModuleInstantiation &inst, std::unordered_set<std::string> &names);
+	static void collectBoundNames(LocalScope &scope, std::unordered_set<std::string> &names);
+	static void extractInvariants(shared_ptr<Expression> &expr, const std::unordered_set<std::string> &bound,
+																std::vector<shared_ptr<class HoistedExpression>> &invariants);
+	static void extractInvariants(ModuleInstantiation &inst, const std::unordered_set<std::string> &bound,
+																std::vector<shared_ptr<HoistedExpression>> &invariants);
+	static void extractInvariants(LocalScope &scope, const std::unordered_set<std::string> &bound,
+																std::vector<shared_ptr<HoistedExpression>> &invariants);
+
+	const LocalScope &toplevel;
+	// Names of functions defined in the local scopes enclosing the current node
+	std::vector<std::unordered_set<std::string>> localFunctions;
+	std::unordered_map<const UserFunction *, bool> inlinable;
+};
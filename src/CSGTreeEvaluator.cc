@@ -10,6 +10,8 @@
 #include "cgaladvnode.h"
 #include "printutils.h"
 #include "GeometryEvaluator.h"
+#include "GeometryCache.h"
+#include "Tree.h"
 #include "polyset.h"
 #include "polyset-utils.h"
 
@@ -157,6 +159,30 @@ Response CSGTreeEvaluator::visit(State &state, const AbstractIntersectionNode &n
 	return Response::ContinueTraversal;
 }
 
+/*!
+	Returns geom tessellated for rendering, or nullptr if it can be rendered as is
+*/
+static const Geometry *tessellateForRendering(const shared_ptr<const Geometry> &geom)
+{
+	// We cannot render Polygon2d directly, so we preprocess (tessellate) it here
+	auto p2d = dynamic_pointer_cast<const Polygon2d>(geom);
+	if (p2d) return p2d->tessellate();
+
+	// We cannot render concave polygons, so tessellate any 3D PolySets
+	auto ps = dynamic_pointer_cast<const PolySet>(geom);
+	// Since is_convex() doesn't handle non-planar faces, we need to tessellate
+	// also in the indeterminate state so we cannot just use a boolean comparison. See #1061
+	bool convex = ps->convexValue();
+	if (ps && !convex) {
+		assert(ps->getDimension() == 3);
+		auto ps_tri = new PolySet(3, ps->convexValue());
+		ps_tri->setConvexity(ps->getConvexity());
+		PolysetUtils::tessellate_faces(*ps, *ps_tri);
+		return ps_tri;
+	}
+	return nullptr;
+}
+
 shared_ptr<CSGNode> CSGTreeEvaluator::evaluateCSGNodeFromGeometry(
 	State &state, const shared_ptr<const Geometry> &geom,
 	const ModuleInstantiation *modinst, const AbstractNode &node)
@@ -164,26 +190,18 @@ shared_ptr<CSGNode> CSGTreeEvaluator::evaluateCSGNodeFromGeometry(
 	std::stringstream stream;
 	stream << node.name() << node.index();
 
-	// We cannot render Polygon2d directly, so we preprocess (tessellate) it here
 	auto g = geom;
 	if (!g->isEmpty()) {
-		auto p2d = dynamic_pointer_cast<const Polygon2d>(geom);
-		if (p2d) {
-			g.reset(p2d->tessellate());
+		// Tessellations are cached along with the geometry, so that unchanged nodes
+		// have the same geometry in each compile, which CSGTreeNormalizer relies on
+		// to reuse their products
+		const std::string key = "tessellated " + this->tree.getIdString(node);
+		if (GeometryCache::instance()->contains(key)) {
+			g = GeometryCache::instance()->get(key);
 		}
-		else {
-			// We cannot render concave polygons, so tessellate any 3D PolySets
-			auto ps = dynamic_pointer_cast<const PolySet>(geom);
-			// Since is_convex() doesn't handle non-planar faces, we need to tessellate
-			// also in the indeterminate state so we cannot just use a boolean comparison. See #1061
-			bool convex = ps->convexValue();
-			if (ps && !convex) {
-				assert(ps->getDimension() == 3);
-				auto ps_tri = new PolySet(3, ps->convexValue());
-				ps_tri->setConvexity(ps->getConvexity());
-				PolysetUtils::tessellate_faces(*ps, *ps_tri);
-				g.reset(ps_tri);
-			}
+		else if (auto tessellated = tessellateForRendering(geom)) {
+			g.reset(tessellated);
+			GeometryCache::instance()->insert(key, g);
 		}
 	}
 
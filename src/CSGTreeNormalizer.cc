@@ -1,233 +1,301 @@
 #include "CSGTreeNormalizer.h"
 #include "csgnode.h"
+#include "Geometry.h"
 #include "printutils.h"
+#include <boost/functional/hash.hpp>
+#include <algorithm>
 
-// Helper function to debug normalization bugs
-#if 0
-static bool validate_tree(const shared_ptr<CSGNode> &node)
+namespace {
+
+bool disjoint(const BoundingBox &a, const BoundingBox &b)
 {
-	if (node->getType() == OpenSCADOperator::PRIMITIVE) return true;
-    if (!node->left() || !node->right()) return false;
-    if (!validate_tree(node->left())) return false;
-    if (!validate_tree(node->right())) return false;
-    return true;
+	return a.intersection(b).isEmpty();
 }
-#endif
+
+} // namespace
 
 /*!
 	NB! for e.g. empty intersections, this can normalize a tree to nothing and return nullptr.
+
+	This implements the CSG normalization described in
+	Goldfeather, J., Molnar, S., Turk, G., and Fuchs, H. Near
+	Realtime CSG Rendering Using Tree Normalization and Geometric
+	Pruning. IEEE Computer Graphics and Applications, 9(3):20-28,
+	1989.
+	http://www.cc.gatech.edu/~turk/my_papers/pxpl_csg.pdf
+
+	If the result grows past the limit, the tree is returned unnormalized.
 */
 shared_ptr<CSGNode> CSGTreeNormalizer::normalize(const shared_ptr<CSGNode> &root)
 {
+	if (!root) return root;
+	if (this->products.size() > this->limit || this->memsize > this->memorylimit) clear();
 	this->aborted = false;
-	shared_ptr<CSGNode> temp = root;
-	while (1) {
-		this->rootnode = temp;
-		this->nodecount = 0;
-		shared_ptr<CSGNode> n = normalizePass(temp);
-		if (!n) return n; // If normalized to nothing
-		if (temp == n) break;
-		temp = n;
-
-		if (this->nodecount > this->limit) {
-			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
-      // Clean up any partially evaluated nodes
-			shared_ptr<CSGNode> newroot = root, tmproot;
-			while (newroot && newroot != tmproot) {
-				tmproot = newroot;
-				newroot = collapse_null_terms(tmproot);
-			}
-			newroot = cleanup_term(newroot);
-			return newroot;
-		}
+	const Sum &sum = normalizeNode(root, CSGNode::FLAG_NONE);
+	this->nodeTerms.clear();
+	if (this->aborted) {
+		PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
+		return root;
 	}
-	this->rootnode.reset();
-	return temp;
+	return unionNode(sum.products, 0, sum.products.size());
+}
+
+void CSGTreeNormalizer::clear()
+{
+	this->leaves.clear();
+	this->geometries.clear();
+	this->memsize = 0;
+	this->leafIndex.clear();
+	this->products.clear();
+	this->productNodes.clear();
+	this->productIndex.clear();
+	this->terms.clear();
+	this->sums.clear();
+	this->combinations.clear();
+	this->nodes.clear();
 }
 
 /*!
-	After aborting, a subtree might have become invalidated (nullptr child node)
-	since terms can be instantiated multiple times.
-	This will search for nullptr children an recursively repair the corresponding
-	subtree.
- */
-shared_ptr<CSGNode> CSGTreeNormalizer::cleanup_term(shared_ptr<CSGNode> &t)
+	Returns the id of the term node represents. Nodes with the same id have
+	the same structure, leaves and flags.
+*/
+size_t CSGTreeNormalizer::termId(const shared_ptr<CSGNode> &node)
 {
-	if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(t)) {
-		if (op->left()) op->left() = cleanup_term(op->left());
-		if (op->right()) op->right() = cleanup_term(op->right());
-		return collapse_null_terms(op);
+	auto it = this->nodeTerms.find(node.get());
+	if (it != this->nodeTerms.end()) return it->second;
+
+	std::tuple<int, size_t, size_t, unsigned int> key;
+	if (auto leaf = dynamic_pointer_cast<CSGLeaf>(node)) {
+		key = std::make_tuple(-1, leafId(leaf, leaf->getFlags()), 0, 0);
 	}
-	return t;
+	else {
+		auto op = static_pointer_cast<CSGOperation>(node);
+		key = std::make_tuple(int(op->getType()), termId(op->left()), termId(op->right()), op->getFlags());
+	}
+	auto id = this->terms.emplace(key, this->terms.size()).first->second;
+	return this->nodeTerms[node.get()] = id;
 }
 
-static bool isUnion(shared_ptr<CSGNode> node) {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	return op && op->getType() == OpenSCADOperator::UNION;
+/*!
+	Returns the products of node, with flags accumulated from its ancestors
+*/
+const CSGTreeNormalizer::Sum &CSGTreeNormalizer::normalizeNode(const shared_ptr<CSGNode> &node, unsigned int flags)
+{
+	static const Sum empty;
+	flags |= node->getFlags();
+	auto key = std::make_pair(termId(node), flags);
+	auto it = this->sums.find(key);
+	if (it != this->sums.end()) return it->second;
+
+	Sum sum;
+	if (auto leaf = dynamic_pointer_cast<CSGLeaf>(node)) {
+		Product product;
+		if (addIntersection(product, leafId(leaf, flags))) add(sum, productId(product));
+	}
+	else if (auto op = dynamic_pointer_cast<CSGOperation>(node)) {
+		const Sum &left = normalizeNode(op->left(), flags);
+		if (this->aborted) return empty;
+		const Sum &right = normalizeNode(op->right(), flags);
+		if (this->aborted) return empty;
+
+		switch (op->getType()) {
+		case OpenSCADOperator::UNION:
+			sum = left;
+			for (auto b : right.products) add(sum, b);
+			break;
+		case OpenSCADOperator::INTERSECTION:
+			// (a + b) * (c + d) -> a * c + a * d + b * c + b * d
+			for (auto a : left.products) {
+				for (auto b : right.products) {
+					for (auto p : combine(OpenSCADOperator::INTERSECTION, a, b).products) add(sum, p);
+					if (this->aborted) return empty;
+				}
+			}
+			break;
+		case OpenSCADOperator::DIFFERENCE:
+			// x - (a + b) -> (x - a) - b
+			sum = left;
+			for (auto b : right.products) {
+				Sum next;
+				for (auto a : sum.products) {
+					for (auto p : combine(OpenSCADOperator::DIFFERENCE, a, b).products) add(next, p);
+					if (this->aborted) return empty;
+				}
+				std::swap(sum, next);
+			}
+			break;
+		default:
+			assert(false);
+		}
+	}
+
+	if (this->aborted) return empty;
+	return this->sums[key] = std::move(sum);
 }
 
-static bool hasRightNonLeaf(shared_ptr<CSGNode> node) {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	return op->right() && (dynamic_pointer_cast<CSGLeaf>(op->right()) == nullptr);
+/*!
+	Returns a * b or a - b for two products
+*/
+const CSGTreeNormalizer::Sum &CSGTreeNormalizer::combine(OpenSCADOperator type, size_t a, size_t b)
+{
+	auto key = std::make_tuple(type, a, b);
+	auto it = this->combinations.find(key);
+	if (it != this->combinations.end()) return it->second;
+
+	Sum sum;
+	// Copies, as interning new products may reallocate the vector
+	const Product pa = this->products[a], pb = this->products[b];
+	if (type == OpenSCADOperator::INTERSECTION) {
+		Product product = pa;
+		bool nonempty = true;
+		for (auto leaf : pb.intersections) nonempty = nonempty && addIntersection(product, leaf);
+		for (auto leaf : pb.subtractions) nonempty = nonempty && addSubtraction(product, leaf);
+		if (nonempty) add(sum, productId(product));
+	}
+	else if (this->prune && disjoint(pa.bbox, pb.bbox)) {
+		add(sum, a);
+	}
+	else {
+		// x - (y * z - w) -> (x - y) + (x - z) + (x * w)
+		for (auto leaf : pb.intersections) {
+			Product product = pa;
+			if (addSubtraction(product, leaf)) add(sum, productId(product));
+		}
+		for (auto leaf : pb.subtractions) {
+			Product product = pa;
+			if (addIntersection(product, leaf)) add(sum, productId(product));
+		}
+	}
+	return this->combinations[key] = std::move(sum);
 }
 
-static bool hasLeftUnion(shared_ptr<CSGNode> node) {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	return op && isUnion(op->left());
+void CSGTreeNormalizer::add(Sum &sum, size_t product)
+{
+	if (!sum.members.insert(product).second) return;
+	sum.products.push_back(product);
+	const Product &p = this->products[product];
+	sum.elements += p.intersections.size() + p.subtractions.size();
+	if (sum.elements > this->limit) this->aborted = true;
 }
 
-shared_ptr<CSGNode> CSGTreeNormalizer::normalizePass(shared_ptr<CSGNode> node)
+/*!
+	Returns the id of a leaf equal to the given one. Leaves are equal if
+	they have the same geometry, transformation, color, flags and label, so
+	that leaves kept from a previous compile show the current node labels.
+*/
+size_t CSGTreeNormalizer::leafId(const shared_ptr<CSGLeaf> &leaf, unsigned int flags)
 {
-	// This function implements the CSG normalization
-  // Reference:
-	// Goldfeather, J., Molnar, S., Turk, G., and Fuchs, H. Near
-	// Realtime CSG Rendering Using Tree Normalization and Geometric
-	// Pruning. IEEE Computer Graphics and Applications, 9(3):20-28,
-	// 1989.
-  // http://www.cc.gatech.edu/~turk/my_papers/pxpl_csg.pdf
-
-	if (dynamic_pointer_cast<CSGLeaf>(node)) return node;
-	do {
-		while (node && match_and_replace(node)) {	}
-		this->nodecount++;
-		if (nodecount > this->limit) {
-			PRINTB("WARNING: Normalized tree is growing past %d elements. Aborting normalization.\n", this->limit);
-			this->aborted = true;
-			return shared_ptr<CSGNode>();
-		}
-		if (!node || dynamic_pointer_cast<CSGLeaf>(node)) return node;
-		if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node)) {
-			op->left() = normalizePass(op->left());
+	size_t hash = 0;
+	boost::hash_combine(hash, leaf->geom.get());
+	boost::hash_combine(hash, flags);
+	boost::hash_range(hash, leaf->matrix.data(), leaf->matrix.data() + 16);
+	boost::hash_range(hash, leaf->color.data(), leaf->color.data() + 4);
+	boost::hash_combine(hash, leaf->label);
+
+	auto &ids = this->leafIndex[hash];
+	for (auto id : ids) {
+		const auto &other = this->leaves[id];
+		if (other->geom == leaf->geom && other->getFlags() == flags &&
+				other->matrix.matrix() == leaf->matrix.matrix() && other->color == leaf->color &&
+				other->label == leaf->label) {
+			return id;
 		}
-	} while (!this->aborted && !isUnion(node) && (hasRightNonLeaf(node) || hasLeftUnion(node)));
+	}
 
-	if (!this->aborted) {
-		shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-		assert(op);
-		op->right() = normalizePass(op->right());
+	// The output tree carries accumulated flags on the leaves
+	shared_ptr<CSGLeaf> canonical = leaf;
+	if (leaf->getFlags() != flags) {
+		canonical.reset(new CSGLeaf(leaf->geom, leaf->matrix, leaf->color, leaf->label));
+		canonical->setHighlight(flags & CSGNode::FLAG_HIGHLIGHT);
+		canonical->setBackground(flags & CSGNode::FLAG_BACKGROUND);
 	}
+	if (leaf->geom && this->geometries.insert(leaf->geom.get()).second) {
+		this->memsize += leaf->geom->memsize();
+	}
+	ids.push_back(this->leaves.size());
+	this->leaves.push_back(canonical);
+	return ids.back();
+}
 
-	// FIXME: Do we need to take into account any transformation of item here?
-	shared_ptr<CSGNode> t = collapse_null_terms(node);
+size_t CSGTreeNormalizer::productId(const Product &product)
+{
+	auto result = this->productIndex.emplace(std::make_pair(product.intersections, product.subtractions),
+																						this->products.size());
+	if (result.second) this->products.push_back(product);
+	return result.first->second;
+}
 
-	if (this->aborted) {
-		if (t) t = cleanup_term(t);
-	}
+/*!
+	Intersects product with leaf, returns false if the product becomes empty
+*/
+bool CSGTreeNormalizer::addIntersection(Product &product, size_t leaf) const
+{
+	auto &ints = product.intersections, &subs = product.subtractions;
+	if (std::find(subs.begin(), subs.end(), leaf) != subs.end()) return false;
+	if (std::find(ints.begin(), ints.end(), leaf) != ints.end()) return true;
 
-	return t;
+	const BoundingBox &leafbox = this->leaves[leaf]->getBoundingBox();
+	product.bbox = ints.empty() ? leafbox : product.bbox.intersection(leafbox);
+	ints.push_back(leaf);
+	if (!this->prune) return true;
+	if (product.bbox.isEmpty()) return false;
+
+	// Subtractions outside the smaller product don't matter any more
+	subs.erase(std::remove_if(subs.begin(), subs.end(), [&](size_t s) {
+				return disjoint(product.bbox, this->leaves[s]->getBoundingBox());
+			}), subs.end());
+	return true;
 }
 
-shared_ptr<CSGNode> CSGTreeNormalizer::collapse_null_terms(const shared_ptr<CSGNode> &node)
+/*!
+	Subtracts leaf from product, returns false if the product becomes empty
+*/
+bool CSGTreeNormalizer::addSubtraction(Product &product, size_t leaf) const
 {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	if (op) {
-		if (!op->right()) {
-			if (op->getType() == OpenSCADOperator::UNION || op->getType() == OpenSCADOperator::DIFFERENCE) return op->left();
-			else return op->right();
-		}
-		if (!op->left()) {
-			if (op->getType() == OpenSCADOperator::UNION) return op->right();
-			else return op->left();
-		}
-	}
-	return node;
+	auto &ints = product.intersections, &subs = product.subtractions;
+	if (std::find(ints.begin(), ints.end(), leaf) != ints.end()) return false;
+	if (std::find(subs.begin(), subs.end(), leaf) != subs.end()) return true;
+	if (!this->prune || !disjoint(product.bbox, this->leaves[leaf]->getBoundingBox())) subs.push_back(leaf);
+	return true;
 }
 
-bool CSGTreeNormalizer::match_and_replace(shared_ptr<CSGNode> &node)
+/*!
+	Creates an operation, sharing nodes with the same operands
+*/
+shared_ptr<CSGNode> CSGTreeNormalizer::createNode(OpenSCADOperator type, const shared_ptr<CSGNode> &left,
+																							 const shared_ptr<CSGNode> &right)
 {
-	shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node);
-	if (!op) return false;
-	if (op->getType() == OpenSCADOperator::UNION) return false;
-
-	// Part A: The 'x . (y . z)' expressions
-
-	shared_ptr<CSGOperation> rightop = dynamic_pointer_cast<CSGOperation>(op->right());
-	if (rightop) {
-		shared_ptr<CSGNode> x = op->left();
-		shared_ptr<CSGNode> y = rightop->left();
-		shared_ptr<CSGNode> z = rightop->right();
-
-		// 1.  x - (y + z) -> (x - y) - z
-		if (op->getType() == OpenSCADOperator::DIFFERENCE && rightop->getType() == OpenSCADOperator::UNION) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, 
-																				 CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, x, y),
-																				 z);
-			return true;
-		}
-		// 2.  x * (y + z) -> (x * y) + (x * z)
-		else if (op->getType() == OpenSCADOperator::INTERSECTION && rightop->getType() == OpenSCADOperator::UNION) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::UNION, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, y), 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, z));
-			return true;
-		}
-		// 3.  x - (y * z) -> (x - y) + (x - z)
-		else if (op->getType() == OpenSCADOperator::DIFFERENCE && rightop->getType() == OpenSCADOperator::INTERSECTION) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::UNION, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, x, y), 
-																		CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, x, z));
-			return true;
-		}
-		// 4.  x * (y * z) -> (x * y) * z
-		else if (op->getType() == OpenSCADOperator::INTERSECTION && rightop->getType() == OpenSCADOperator::INTERSECTION) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, y),
-																		z);
-			return true;
-		}
-		// 5.  x - (y - z) -> (x - y) + (x * z)
-		else if (op->getType() == OpenSCADOperator::DIFFERENCE && rightop->getType() == OpenSCADOperator::DIFFERENCE) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::UNION, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, x, y), 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, z));
-			return true;
-		}
-		// 6.  x * (y - z) -> (x * y) - z
-		else if (op->getType() == OpenSCADOperator::INTERSECTION && rightop->getType() == OpenSCADOperator::DIFFERENCE) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, y),
-																		z);
-			return true;
-		}
-	}
+	auto key = std::make_tuple(type, static_cast<const CSGNode *>(left.get()), static_cast<const CSGNode *>(right.get()));
+	auto it = this->nodes.find(key);
+	if (it != this->nodes.end()) return it->second;
+	return this->nodes[key] = CSGOperation::createCSGNode(type, left, right);
+}
 
-	shared_ptr<CSGOperation> leftop = dynamic_pointer_cast<CSGOperation>(op->left());
-	if (leftop) {
-		// Part B: The '(x . y) . z' expressions
-		shared_ptr<CSGNode> x  = leftop->left();
-		shared_ptr<CSGNode> y = leftop->right();
-		shared_ptr<CSGNode> z = op->right();
-		
-		// 7. (x - y) * z  -> (x * z) - y
-		if (leftop->getType() == OpenSCADOperator::DIFFERENCE && op->getType() == OpenSCADOperator::INTERSECTION) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, z), 
-																		y);
-			return true;
-		}
-		// 8. (x + y) - z  -> (x - z) + (y - z)
-		else if (leftop->getType() == OpenSCADOperator::UNION && op->getType() == OpenSCADOperator::DIFFERENCE) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::UNION, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, x, z), 
-																		CSGOperation::createCSGNode(OpenSCADOperator::DIFFERENCE, y, z));
-			return true;
+shared_ptr<CSGNode> CSGTreeNormalizer::productNode(size_t product)
+{
+	if (this->productNodes.size() <= product) this->productNodes.resize(this->products.size());
+	auto &node = this->productNodes[product];
+	if (!node) {
+		const Product &p = this->products[product];
+		node = this->leaves[p.intersections.front()];
+		for (size_t i = 1; i < p.intersections.size(); i++) {
+			node = createNode(OpenSCADOperator::INTERSECTION, node, this->leaves[p.intersections[i]]);
 		}
-		// 9. (x + y) * z  -> (x * z) + (y * z)
-		else if (leftop->getType() == OpenSCADOperator::UNION && op->getType() == OpenSCADOperator::INTERSECTION) {
-			node = CSGOperation::createCSGNode(OpenSCADOperator::UNION, 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, x, z), 
-																		CSGOperation::createCSGNode(OpenSCADOperator::INTERSECTION, y, z));
-			return true;
+		for (auto leaf : p.subtractions) {
+			node = createNode(OpenSCADOperator::DIFFERENCE, node, this->leaves[leaf]);
 		}
 	}
-	return false;
+	return node;
 }
 
-// Counts all non-leaf nodes
-unsigned int CSGTreeNormalizer::count(const shared_ptr<CSGNode> &node) const
+/*!
+	Builds a balanced union, to keep recursion shallow when importing large
+	numbers of products
+*/
+shared_ptr<CSGNode> CSGTreeNormalizer::unionNode(const std::vector<size_t> &products, size_t begin, size_t end)
 {
-	if (shared_ptr<CSGOperation> op = dynamic_pointer_cast<CSGOperation>(node)) {
-		return 1 + count(op->left()) + count(op->right());
-	}
-	return 0;
+	if (begin == end) return shared_ptr<CSGNode>();
+	if (end - begin == 1) return productNode(products[begin]);
+	size_t mid = begin + (end - begin) / 2;
+	return createNode(OpenSCADOperator::UNION, unionNode(products, begin, mid), unionNode(products, mid, end));
 }
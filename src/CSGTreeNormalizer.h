@@ -1,24 +1,103 @@
 #pragma once
 
 #include "memory.h"
+#include "linalg.h"
+#include "enums.h"
+#include <map>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
+class CSGNode;
+class CSGLeaf;
+
+/*!
+	Normalizes CSG trees into a union of products, as needed by the OpenCSG
+	and ThrownTogether renderers.
+
+	Instead of repeatedly rewriting the tree, each subtree is normalized once
+	into a list of products, which are then combined bottom-up. Leaves,
+	terms and products are interned, so identical subtrees are normalized
+	once and combinations of the same products are only computed once.
+
+	Results are memoized per term and accumulated flags for the lifetime of
+	the normalizer. Terms are identified by their structure and leaf labels
+	rather than by node, so a normalizer kept across compiles reuses the
+	results of subtrees whose node indices, geometry, transformation and
+	color didn't change, as well as normalizing highlight and background
+	subtrees after the root. Leaf geometry is only the same across compiles
+	when it comes from the geometry cache, which is why CSGTreeEvaluator
+	caches tessellated geometry there as well.
+	The caches are dropped once they hold more products than the limit, or
+	once the geometry their leaves keep alive is larger than the memory
+	limit.
+
+	Products which are empty, either because they intersect and subtract the
+	same object or because their bounding boxes are disjoint, are pruned
+	while combining, as are subtractions which can't touch the product and
+	duplicate products in a union.
+
+	Pruning by bounding box can be turned off for the ThrownTogether
+	renderer, which shows the subtracted objects as well. Its products are
+	then only pruned by CSGOperation::createCSGNode() when building the
+	output tree, and may hit the limit sooner.
+*/
 class CSGTreeNormalizer
 {
 public:
-	CSGTreeNormalizer(size_t limit) : limit(limit) {}
+	CSGTreeNormalizer(size_t limit, size_t memorylimit = 100*1024*1024, bool prune = true)
+		: limit(limit), memorylimit(memorylimit), prune(prune), memsize(0), aborted(false) {}
 	~CSGTreeNormalizer() {}
 
-	shared_ptr<class CSGNode> normalize(const shared_ptr<CSGNode> &term);
+	shared_ptr<CSGNode> normalize(const shared_ptr<CSGNode> &term);
+	void setLimit(size_t limit) { this->limit = limit; }
+	void setMemoryLimit(size_t limit) { this->memorylimit = limit; }
+	void clear();
 
 private:
-	shared_ptr<CSGNode> normalizePass(shared_ptr<CSGNode> term) ;
-	bool match_and_replace(shared_ptr<class CSGNode> &term);
-	shared_ptr<CSGNode> collapse_null_terms(const shared_ptr<CSGNode> &term);
-	shared_ptr<CSGNode> cleanup_term(shared_ptr<CSGNode> &t);
-	unsigned int count(const shared_ptr<CSGNode> &term) const;
+	struct Product {
+		std::vector<size_t> intersections; // leaf ids
+		std::vector<size_t> subtractions;
+		BoundingBox bbox;
+	};
+	struct Sum {
+		std::vector<size_t> products; // product ids
+		std::unordered_set<size_t> members;
+		size_t elements = 0;
+	};
+
+	size_t termId(const shared_ptr<CSGNode> &node);
+	const Sum &normalizeNode(const shared_ptr<CSGNode> &node, unsigned int flags);
+	const Sum &combine(OpenSCADOperator type, size_t a, size_t b);
+	void add(Sum &sum, size_t product);
+
+	size_t leafId(const shared_ptr<CSGLeaf> &leaf, unsigned int flags);
+	size_t productId(const Product &product);
+	bool addIntersection(Product &product, size_t leaf) const;
+	bool addSubtraction(Product &product, size_t leaf) const;
+
+	shared_ptr<CSGNode> createNode(OpenSCADOperator type, const shared_ptr<CSGNode> &left, const shared_ptr<CSGNode> &right);
+	shared_ptr<CSGNode> productNode(size_t product);
+	shared_ptr<CSGNode> unionNode(const std::vector<size_t> &products, size_t begin, size_t end);
 
-	bool aborted;
 	size_t limit;
-	size_t nodecount;
-	shared_ptr<class CSGNode> rootnode;
+	size_t memorylimit;
+	bool prune; // by bounding box
+	size_t memsize; // of the geometries in leaves
+	bool aborted;
+
+	std::vector<shared_ptr<CSGLeaf>> leaves;
+	std::unordered_set<const class Geometry *> geometries;
+	std::unordered_map<size_t, std::vector<size_t>> leafIndex; // hash -> leaf ids
+	std::vector<Product> products;
+	std::vector<shared_ptr<CSGNode>> productNodes;
+	std::map<std::pair<std::vector<size_t>, std::vector<size_t>>, size_t> productIndex;
+
+	// Terms are leaves (-1, leaf id, 0, 0) or operations (type, left, right, flags)
+	std::map<std::tuple<int, size_t, size_t, unsigned int>, size_t> terms;
+	std::unordered_map<const CSGNode *, size_t> nodeTerms; // only valid during normalize()
+	std::map<std::pair<size_t, unsigned int>, Sum> sums;
+	std::map<std::tuple<OpenSCADOperator, size_t, size_t>, Sum> combinations;
+	std::map<std::tuple<OpenSCADOperator, const CSGNode *, const CSGNode *>, shared_ptr<CSGNode>> nodes;
 };
@@ -3,6 +3,7 @@
 #include "csgnode.h"
 #include "Tree.h"
 #include "GeometryEvaluator.h"
+#include "GeometryCache.h"
 #include "CSGTreeEvaluator.h"
 #include "CSGTreeNormalizer.h"
 #include "rendersettings.h"
@@ -19,7 +20,8 @@ public:
 	shared_ptr<CSGProducts> highlights_products;
 	shared_ptr<CSGProducts> background_products;
 
-	bool compile_products(const Tree &tree) {
+	// ThrownTogether shows subtracted objects, so its products aren't pruned while normalizing
+	bool compile_products(const Tree &tree, bool prune = true) {
 		const AbstractNode *root_node = tree.root();
 		GeometryEvaluator geomevaluator(tree);
 		CSGTreeEvaluator evaluator(tree, &geomevaluator);
@@ -28,7 +30,12 @@ public:
 		std::vector<shared_ptr<CSGNode> > backgroundNodes = evaluator.getBackgroundNodes();
 
 		PRINT("Compiling design (CSG Products normalization)...");
-		CSGTreeNormalizer normalizer(RenderSettings::inst()->openCSGTermLimit);
+		// Shared between compiles, e.g. of animation frames
+		static CSGTreeNormalizer pruningNormalizer(RenderSettings::inst()->openCSGTermLimit);
+		static CSGTreeNormalizer plainNormalizer(RenderSettings::inst()->openCSGTermLimit, GeometryCache::instance()->maxSize(), false);
+		CSGTreeNormalizer &normalizer = prune ? pruningNormalizer : plainNormalizer;
+		normalizer.setLimit(RenderSettings::inst()->openCSGTermLimit);
+		normalizer.setMemoryLimit(GeometryCache::instance()->maxSize());
 		if (csgRoot) {
 			shared_ptr<CSGNode> normalizedRoot = normalizer.normalize(csgRoot);
 			if (normalizedRoot) {
@@ -47,7 +54,7 @@ public:
 			this->highlights_products.reset(new CSGProducts());
 			for (unsigned int i = 0; i < highlightNodes.size(); i++) {
 				highlightNodes[i] = normalizer.normalize(highlightNodes[i]);
-				this->highlights_products->import(highlightNodes[i]);
+				if (highlightNodes[i]) this->highlights_products->import(highlightNodes[i]);
 			}
 		}
 
@@ -56,7 +63,7 @@ public:
 			this->background_products.reset(new CSGProducts());
 			for (unsigned int i = 0; i < backgroundNodes.size(); i++) {
 				backgroundNodes[i] = normalizer.normalize(backgroundNodes[i]);
-				this->background_products->import(backgroundNodes[i]);
+				if (backgroundNodes[i]) this->background_products->import(backgroundNodes[i]);
 			}
 		}
 		return true;
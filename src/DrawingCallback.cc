@@ -119,3 +119,15 @@ void DrawingCallback::curve_to(const Vector2d &c1, const Vector2d &c2, const Vec
 	}
 	pen = to;
 }
+
+// Adds an already flattened outline, e.g. of a cached glyph
+void DrawingCallback::add_outline(const Outline2d &outline)
+{
+	if (this->outline.vertices.size() > 0) {
+		this->polygon->addOutline(this->outline);
+		this->outline.vertices.clear();
+	}
+	for (const auto &v : outline.vertices) {
+		add_vertex(v);
+	}
+}
@@ -38,6 +38,7 @@
 namespace fs = boost::filesystem;
 #include "FontCache.h"
 #include <sys/stat.h>
+#include <mutex>
 
 FileModule::~FileModule()
 {
@@ -54,7 +55,11 @@ void FileModule::registerUse(const std::string path)
 	auto ext = boost::algorithm::to_lower_copy(extraw);
 	
 	if ((ext == ".otf") || (ext == ".ttf")) {
+		usedfonts.insert(path);
 		if (fs::is_regular(path)) {
+			// Libraries may be parsed concurrently, see ModuleCache::prefetch()
+			static std::mutex fontcache_mutex;
+			std::lock_guard<std::mutex> lock(fontcache_mutex);
 			FontCache::instance()->register_font_file(path);
 		} else {
 			PRINTB("ERROR: Can't read font with path '%s'", path);
@@ -101,6 +106,17 @@ time_t FileModule::handleDependencies()
 
 	std::vector<std::pair<std::string,std::string>> updates;
 
+	// Parse all libraries in the dependency graph concurrently first
+	std::vector<std::string> libs;
+	for (const auto &filename : this->usedlibs) {
+		if (fs::path(filename).is_absolute()) libs.push_back(filename);
+		else {
+			auto fullpath = find_valid_path(this->path, filename);
+			if (!fullpath.empty()) libs.push_back(fullpath.generic_string());
+		}
+	}
+	ModuleCache::instance()->prefetch(libs);
+
 	// If a lib in usedlibs was previously missing, we need to relocate it
 	// by searching the applicable paths. We can identify a previously missing module
 	// as it will have a relative path.
@@ -32,14 +32,26 @@ public:
 	LocalScope scope;
 	typedef std::unordered_set<std::string> ModuleContainer;
 	ModuleContainer usedlibs;
-private:
+	ModuleContainer usedfonts;
+
 	struct IncludeFile {
 		std::string filename;
 	};
+	typedef std::unordered_map<std::string, struct IncludeFile> IncludeContainer;
+	const IncludeContainer &includedFiles() const { return this->includes; }
+
+	// How an include<> or use<> path was resolved while parsing. Files added
+	// to the search path later can change the result, see ASTCache.
+	struct PathResolution {
+		std::string sourcepath; // folder of the file containing the statement
+		std::string localpath;
+		std::string fullpath;   // empty if the file wasn't found
+	};
+	std::vector<PathResolution> resolutions;
 
+private:
 	time_t include_modified(const IncludeFile &inc) const;
 
-	typedef std::unordered_map<std::string, struct IncludeFile> IncludeContainer;
 	IncludeContainer includes;
 	bool is_handling_dependencies;
 	std::string path;
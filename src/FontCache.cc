@@ -25,6 +25,8 @@
  */
 
 #include <iostream>
+#include <fstream>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
 #include <boost/algorithm/string.hpp>
@@ -92,6 +94,17 @@ void FontCache::defaultInitHandler(FontCacheInitializer *initializer, void *)
 FontCache::FontCache()
 {
 	this->init_ok = false;
+	this->max_entries = MAX_NR_OF_CACHE_ENTRIES;
+	this->counter = 0;
+	this->fontconfig_loaded = false;
+	this->config = nullptr;
+	this->index_ok = false;
+
+	const char *env_cache_size = getenv("OPENSCAD_FONT_CACHE_SIZE");
+	if (env_cache_size != nullptr) {
+		int size = atoi(env_cache_size);
+		if (size > 0) this->max_entries = size;
+	}
 
 	// If we've got a bundled fonts.conf, initialize fontconfig with our own config
 	// by overriding the built-in fontconfig path.
@@ -101,26 +114,18 @@ FontCache::FontCache()
 		PlatformUtils::setenv("FONTCONFIG_PATH", (fs::absolute(fontdir).generic_string()).c_str(), 0);
 	}
 
-	// Just load the configs. We'll build the fonts once all configs are loaded
-	this->config = FcInitLoadConfig();
-	if (!this->config) {
-		PRINT("WARNING: Can't initialize fontconfig library, text() objects will not be rendered");
-		return;
-	}
-
-	// Add the built-in fonts & config
+	// Collect the built-in fonts
 	fs::path builtinfontpath(PlatformUtils::resourcePath("fonts"));
 	if (fs::is_directory(builtinfontpath)) {
-		FcConfigParseAndLoad(this->config, reinterpret_cast<const FcChar8 *>(builtinfontpath.generic_string().c_str()), false);
-		add_font_dir(boosty::canonical(builtinfontpath).generic_string());
+		this->app_dirs.push_back(boosty::canonical(builtinfontpath).generic_string());
 	}
 
 	const char *home = getenv("HOME");
 
 	// Add Linux font folders, the system folders are expected to be
 	// configured by the system configuration for fontconfig.
-	if (home) {
-		add_font_dir(std::string(home) + "/.fonts");
+	if (home && fs::is_directory(std::string(home) + "/.fonts")) {
+		this->app_dirs.push_back(std::string(home) + "/.fonts");
 	}
 
 	const char *env_font_path = getenv("OPENSCAD_FONT_PATH");
@@ -132,28 +137,71 @@ FontCache::FontCache()
 			const fs::path p(boost::copy_range<std::string>(*it));
 			if (fs::exists(p) && fs::is_directory(p)) {
 				std::string path = fs::absolute(p).string();
-				add_font_dir(path);
+				this->app_dirs.push_back(path);
 			}
 		}
 	}
 
+	const FT_Error error = FT_Init_FreeType(&this->library);
+	if (error) {
+		PRINT("WARNING: Can't initialize freetype library, text() objects will not be rendered");
+		return;
+	}
+
+	// Loading the fontconfig configuration and building its font list can
+	// take seconds when the system font cache is cold. If our own index is
+	// up to date, this is deferred until a font is needed which isn't in
+	// the index.
+	if (!load_index()) {
+		if (!init_fontconfig()) {
+			return;
+		}
+		reset_index();
+	}
+
+	this->init_ok = true;
+}
+
+/**
+ * Loads the fontconfig configuration, adds our font folders and builds the
+ * font list. Returns false if fontconfig can't be used.
+ */
+bool FontCache::init_fontconfig()
+{
+	if (this->fontconfig_loaded) {
+		return this->config != nullptr;
+	}
+	this->fontconfig_loaded = true;
+	PRINTD("Loading fontconfig configuration");
+
+	// Just load the configs. We'll build the fonts once all configs are loaded
+	this->config = FcInitLoadConfig();
+	if (!this->config) {
+		PRINT("WARNING: Can't initialize fontconfig library, text() objects will not be rendered");
+		return false;
+	}
+
+	// Add the built-in fonts & config
+	fs::path builtinfontpath(PlatformUtils::resourcePath("fonts"));
+	if (fs::is_directory(builtinfontpath)) {
+		FcConfigParseAndLoad(this->config, reinterpret_cast<const FcChar8 *>(builtinfontpath.generic_string().c_str()), false);
+	}
+	for (const auto &dir : this->app_dirs) {
+		add_font_dir(dir);
+	}
+
 	FontCacheInitializer initializer(this->config);
 	cb_handler(&initializer, cb_userdata);
 
 	// For use by LibraryInfo
+	fontpath.clear();
 	FcStrList *dirs = FcConfigGetFontDirs(this->config);
 	while (FcChar8 *dir = FcStrListNext(dirs)) {
 		fontpath.push_back(std::string((const char *)dir));
 	}
 	FcStrListDone(dirs);
 
-	const FT_Error error = FT_Init_FreeType(&this->library);
-	if (error) {
-		PRINT("WARNING: Can't initialize freetype library, text() objects will not be rendered");
-		return;
-	}
-
-	this->init_ok = true;
+	return true;
 }
 
 FontCache::~FontCache()
@@ -176,6 +224,11 @@ void FontCache::registerProgressHandler(InitHandlerFunc *handler, void *userdata
 
 void FontCache::register_font_file(const std::string &path)
 {
+	if (!init_fontconfig()) {
+		return;
+	}
+	// The index only knows how lookups resolve without registered fonts
+	this->index_ok = false;
 	if (!FcConfigAppFontAddFile(this->config, reinterpret_cast<const FcChar8 *> (path.c_str()))) {
 		PRINTB("Can't register font '%s'", path);
 	}
@@ -191,8 +244,13 @@ void FontCache::add_font_dir(const std::string &path)
 	}
 }
 
-FontInfoList *FontCache::list_fonts() const
+FontInfoList *FontCache::list_fonts()
 {
+	FontInfoList *list = new FontInfoList();
+	if (!init_fontconfig()) {
+		return list;
+	}
+
 	FcObjectSet *object_set = FcObjectSetBuild(FC_FAMILY, FC_STYLE, FC_FILE, (char *) 0);
 	FcPattern *pattern = FcPatternCreate();
 	init_pattern(pattern);
@@ -200,7 +258,6 @@ FontInfoList *FontCache::list_fonts() const
 	FcObjectSetDestroy(object_set);
 	FcPatternDestroy(pattern);
 
-	FontInfoList *list = new FontInfoList();
 	for (int a = 0; a < font_set->nfont; a++) {
 		FcValue file_value;
 		FcPatternGet(font_set->fonts[a], FC_FILE, 0, &file_value);
@@ -236,56 +293,87 @@ void FontCache::dump_cache(const std::string &info)
 {
 	std::cout << info << ":";
 	for (cache_t::iterator it = this->cache.begin(); it != this->cache.end(); it++) {
-		std::cout << " " << (*it).first << " (" << (*it).second.second << ")";
+		std::cout << " " << (*it).first << " (" << (*it).second.last_use << ")";
 	}
 	std::cout << std::endl;
 }
 
-void FontCache::check_cleanup()
+/**
+ * Closes the least recently used faces until at most max_size are left.
+ */
+void FontCache::check_cleanup(unsigned int max_size)
 {
-	if (this->cache.size() < MAX_NR_OF_CACHE_ENTRIES) {
-		return;
-	}
-
-	cache_t::iterator pos = this->cache.begin()++;
-	for (cache_t::iterator it = this->cache.begin(); it != this->cache.end(); it++) {
-		if ((*pos).second.second > (*it).second.second) {
-			pos = it;
+	while (this->cache.size() > max_size) {
+		cache_t::iterator pos = this->cache.begin();
+		for (cache_t::iterator it = this->cache.begin(); it != this->cache.end(); it++) {
+			if ((*pos).second.last_use > (*it).second.last_use) {
+				pos = it;
+			}
 		}
+		FT_Done_Face((*pos).second.face);
+		this->cache.erase(pos);
 	}
-	FT_Done_Face((*pos).second.first);
-	this->cache.erase(pos);
 }
 
 FT_Face FontCache::get_font(const std::string &font)
 {
-	FT_Face face;
 	cache_t::iterator it = this->cache.find(font);
 	if (it == this->cache.end()) {
-		face = find_face(font);
+		FT_Face face = find_face(font);
 		if (!face) {
 			return nullptr;
 		}
-		check_cleanup();
-	} else {
-		face = (*it).second.first;
+		check_cleanup(this->max_entries - 1);
+		it = this->cache.insert(cache_t::value_type(font, cache_entry_t{face, ++this->counter, 0})).first;
 	}
-	this->cache[font] = cache_entry_t(face, time(nullptr));
-	return face;
+	(*it).second.last_use = ++this->counter;
+	return (*it).second.face;
+}
+
+/**
+ * Returns an id which identifies the face for as long as it stays in the
+ * cache. Faces which are closed and loaded again get a new id, so the id
+ * can be used to key data derived from the face.
+ */
+unsigned long FontCache::get_face_id(const FT_Face &face) const
+{
+	for (cache_t::const_iterator it = this->cache.begin(); it != this->cache.end(); it++) {
+		if ((*it).second.face == face) {
+			return (*it).second.id;
+		}
+	}
+	return 0;
 }
 
-FT_Face FontCache::find_face(const std::string &font) const
+FT_Face FontCache::find_face(const std::string &font)
 {
 	std::string trimmed(font);
 	boost::algorithm::trim(trimmed);
 
 	const std::string lookup = trimmed.empty() ? DEFAULT_FONT : trimmed;
 	PRINTDB("font = \"%s\", lookup = \"%s\"", font % lookup);
-	FT_Face face = find_face_fontconfig(lookup);
-	PRINTDB("result = \"%s\", style = \"%s\"", face->family_name % face->style_name);
+	FT_Face face = find_face_index(lookup);
+	if (!face) {
+		face = find_face_fontconfig(lookup);
+	}
+	if (face) {
+		PRINTDB("result = \"%s\", style = \"%s\"", face->family_name % face->style_name);
+	}
 	return face;
 }
 
+FT_Face FontCache::find_face_index(const std::string &font) const
+{
+	if (!this->index_ok) {
+		return nullptr;
+	}
+	index_t::const_iterator it = this->index.find(font);
+	if (it == this->index.end()) {
+		return nullptr;
+	}
+	return open_face((*it).second.file, (*it).second.index);
+}
+
 void FontCache::init_pattern(FcPattern *pattern) const
 {
 	FcValue true_value;
@@ -296,8 +384,12 @@ void FontCache::init_pattern(FcPattern *pattern) const
 	FcPatternAdd(pattern, FC_SCALABLE, true_value, true);
 }
 
-FT_Face FontCache::find_face_fontconfig(const std::string &font) const
+FT_Face FontCache::find_face_fontconfig(const std::string &font)
 {
+	if (!init_fontconfig()) {
+		return nullptr;
+	}
+
 	FcResult result;
 
 	FcPattern *pattern = FcNameParse((unsigned char *)font.c_str());
@@ -307,23 +399,40 @@ FT_Face FontCache::find_face_fontconfig(const std::string &font) const
 	FcDefaultSubstitute(pattern);
 
 	FcPattern *match = FcFontMatch(this->config, pattern, &result);
-
-	FcValue file_value;
-	if (FcPatternGet(match, FC_FILE, 0, &file_value) != FcResultMatch) {
+	FcPatternDestroy(pattern);
+	if (!match) {
 		return nullptr;
 	}
 
+	FcValue file_value;
 	FcValue font_index;
-	if (FcPatternGet(match, FC_INDEX, 0, &font_index)) {
+	if (FcPatternGet(match, FC_FILE, 0, &file_value) != FcResultMatch ||
+			FcPatternGet(match, FC_INDEX, 0, &font_index) != FcResultMatch) {
+		FcPatternDestroy(match);
 		return nullptr;
 	}
-	
-	FT_Face face;
-	FT_Error error = FT_New_Face(this->library, (const char *) file_value.u.s, font_index.u.i, &face);
 
-	FcPatternDestroy(pattern);
+	const std::string file((const char *) file_value.u.s);
+	const int index = font_index.u.i;
 	FcPatternDestroy(match);
 
+	FT_Face face = open_face(file, index);
+	if (face && this->index_ok && font.find_first_of("\t\n") == std::string::npos
+			&& file.find_first_of("\t\n") == std::string::npos) {
+		this->index[font] = index_entry_t{file, index};
+		append_index(font);
+	}
+	return face;
+}
+
+FT_Face FontCache::open_face(const std::string &file, int index) const
+{
+	FT_Face face;
+	FT_Error error = FT_New_Face(this->library, file.c_str(), index, &face);
+	if (error) {
+		return nullptr;
+	}
+
 	for (int a = 0; a < face->num_charmaps; a++) {
 		FT_CharMap charmap = face->charmaps[a];
 		PRINTDB("charmap = %d: platform = %d, encoding = %d", a % charmap->platform_id % charmap->encoding_id);
@@ -351,7 +460,232 @@ FT_Face FontCache::find_face_fontconfig(const std::string &font) const
 			PRINTB("Warning: Could not select a char map for font %s/%s", face->family_name % face->style_name);
 	}
 	
-	return error ? nullptr : face;
+	return face;
+}
+
+/**
+ * The font index remembers which font file each lookup resolved to, so
+ * text() doesn't need fontconfig at all on later runs. It's only valid for
+ * the same font folders and fontconfig environment, and as long as the
+ * modification times of all font folders and fontconfig configuration
+ * files it was built from are unchanged.
+ *
+ * The index is stored in the user cache folder, or in the file given by
+ * OPENSCAD_FONT_INDEX. It's rewritten when it's outdated, and resolved
+ * fonts are appended to it. The format is one entry per line with tab
+ * separated fields:
+ *   T <token>                  random token, new for each rewrite
+ *   S <source>                 font folder or fontconfig/locale environment variable
+ *   D <mtime> <path>           font folder known to fontconfig
+ *   C <mtime> <path>           configuration file or other font folder
+ *   F <index> <file> <lookup>  resolved font
+ */
+static const char *FONT_INDEX_HEADER = "OpenSCAD font index 2";
+
+static time_t modification_time(const std::string &path)
+{
+	boost::system::error_code ec;
+	time_t time = fs::last_write_time(path, ec);
+	return ec ? -1 : time;
+}
+
+std::vector<std::string> FontCache::index_sources() const
+{
+	std::vector<std::string> sources(this->app_dirs);
+	// The locale decides e.g. which font a generic family resolves to
+	for (const char *name : {"FONTCONFIG_FILE", "FONTCONFIG_PATH", "FONTCONFIG_SYSROOT",
+				"FC_LANG", "LC_ALL", "LC_CTYPE", "LANG"}) {
+		const char *value = getenv(name);
+		sources.push_back(std::string(name) + "=" + (value ? value : ""));
+	}
+	return sources;
+}
+
+std::string FontCache::index_path() const
+{
+	const char *env_font_index = getenv("OPENSCAD_FONT_INDEX");
+	if (env_font_index != nullptr) {
+		return env_font_index;
+	}
+	const std::string cache_path = PlatformUtils::userCachePath();
+	if (cache_path.empty()) {
+		return "";
+	}
+	return (fs::path(cache_path) / "fontindex").generic_string();
+}
+
+/**
+ * Loads the font index and sets up fontpath from it. Returns false if
+ * there is no index, or if it's outdated.
+ */
+bool FontCache::load_index()
+{
+	const std::string path = index_path();
+	if (path.empty()) {
+		return false;
+	}
+	std::ifstream stream(path.c_str());
+	std::string line, token;
+	if (!std::getline(stream, line) || line != FONT_INDEX_HEADER ||
+			!std::getline(stream, line) || line.compare(0, 2, "T\t") != 0) {
+		return false;
+	}
+	token = line.substr(2);
+
+	std::vector<std::string> sources;
+	std::vector<std::string> dirs;
+	index_t index;
+	stamps_t stamps;
+	try {
+		while (std::getline(stream, line)) {
+			std::vector<std::string> fields;
+			boost::split(fields, line, boost::is_any_of("\t"));
+			if (fields[0] == "S" && fields.size() == 2) {
+				sources.push_back(fields[1]);
+			} else if ((fields[0] == "D" || fields[0] == "C") && fields.size() == 3) {
+				stamps[fields[2]] = std::stoll(fields[1]);
+				if (fields[0] == "D") dirs.push_back(fields[2]);
+			} else if (fields[0] == "F" && fields.size() == 4) {
+				index[fields[3]] = index_entry_t{fields[2], std::stoi(fields[1])};
+			} else {
+				return false;
+			}
+		}
+	} catch (const std::exception &) {
+		return false;
+	}
+
+	if (sources != index_sources()) {
+		return false;
+	}
+	for (const auto &stamp : stamps) {
+		if (modification_time(stamp.first) != stamp.second) {
+			PRINTDB("Font index outdated by '%s'", stamp.first);
+			return false;
+		}
+	}
+
+	PRINTDB("Using font index '%s'", path);
+	fontpath = dirs;
+	this->index_token = token;
+	this->index.swap(index);
+	this->index_stamps.swap(stamps);
+	this->index_ok = true;
+	return true;
+}
+
+/**
+ * Starts a new index from the fontconfig configuration.
+ */
+void FontCache::reset_index()
+{
+	this->index.clear();
+	this->index_stamps.clear();
+	for (const auto &dir : fontpath) {
+		this->index_stamps[dir] = modification_time(dir);
+	}
+	std::vector<std::string> configs;
+	FcStrList *files = FcConfigGetConfigFiles(this->config);
+	while (FcChar8 *file = FcStrListNext(files)) {
+		configs.push_back(std::string((const char *)file));
+	}
+	FcStrListDone(files);
+	for (const auto &file : configs) {
+		this->index_stamps[file] = modification_time(file);
+		// Also catch configuration files being added to or removed from a folder
+		if (!fs::is_directory(file)) {
+			const std::string parent = fs::path(file).parent_path().generic_string();
+			this->index_stamps[parent] = modification_time(parent);
+		}
+	}
+	// Fontconfig doesn't list the folders added by us
+	for (const auto &dir : this->app_dirs) {
+		this->index_stamps[dir] = modification_time(dir);
+		boost::system::error_code ec;
+		for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+			if (fs::is_directory(it->path())) {
+				const std::string path = it->path().generic_string();
+				this->index_stamps[path] = modification_time(path);
+			}
+		}
+	}
+	this->index_ok = true;
+	save_index();
+}
+
+void FontCache::save_index()
+{
+	const std::string path = index_path();
+	if (path.empty()) {
+		return;
+	}
+
+	// The cache folder is only created when something is cached
+	boost::system::error_code ec;
+	const fs::path dir = fs::path(path).parent_path();
+	if (!dir.empty()) {
+		fs::create_directories(dir, ec);
+	}
+
+	// Write to a temporary file first, so concurrent runs never read a
+	// partial index, nor write to the same temporary file
+	const std::string tmppath = fs::unique_path(path + ".%%%%-%%%%-%%%%.tmp", ec).generic_string();
+	if (ec) {
+		PRINTDB("Can't write font index '%s'", path);
+		return;
+	}
+	this->index_token = fs::unique_path("%%%%%%%%%%%%%%%%", ec).generic_string();
+	{
+		std::ofstream stream(tmppath.c_str());
+		stream << FONT_INDEX_HEADER << "\n";
+		stream << "T\t" << this->index_token << "\n";
+		for (const auto &source : index_sources()) {
+			stream << "S\t" << source << "\n";
+		}
+		for (const auto &stamp : this->index_stamps) {
+			const bool dir = std::find(fontpath.begin(), fontpath.end(), stamp.first) != fontpath.end();
+			stream << (dir ? "D\t" : "C\t") << stamp.second << "\t" << stamp.first << "\n";
+		}
+		for (const auto &entry : this->index) {
+			stream << "F\t" << entry.second.index << "\t" << entry.second.file << "\t" << entry.first << "\n";
+		}
+		if (!stream) {
+			PRINTDB("Can't write font index '%s'", tmppath);
+			fs::remove(tmppath, ec);
+			return;
+		}
+	}
+	fs::rename(tmppath, path, ec);
+	if (ec) {
+		PRINTDB("Can't write font index '%s'", path);
+		fs::remove(tmppath, ec);
+	}
+}
+
+/**
+ * Adds a resolved font to the index file. Only the index this process
+ * loaded or wrote is added to, as another process may have replaced it
+ * with one for a different configuration.
+ */
+void FontCache::append_index(const std::string &font) const
+{
+	const std::string path = index_path();
+	if (path.empty()) {
+		return;
+	}
+	std::fstream stream(path.c_str(), std::ios::in | std::ios::out | std::ios::app);
+	std::string line;
+	if (!std::getline(stream, line) || line != FONT_INDEX_HEADER ||
+			!std::getline(stream, line) || line != "T\t" + this->index_token) {
+		return;
+	}
+	const index_entry_t &entry = this->index.at(font);
+	stream.clear();
+	stream << "F\t" << entry.index << "\t" << entry.file << "\t" << font << "\n";
+	stream.flush();
+	if (!stream) {
+		PRINTDB("Can't write font index '%s'", path);
+	}
 }
 
 bool FontCache::try_charmap(FT_Face face, int platform_id, int encoding_id) const
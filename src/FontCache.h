@@ -75,17 +75,18 @@ private:
 class FontCache {
 public:
     const static std::string DEFAULT_FONT;
-    const static unsigned int MAX_NR_OF_CACHE_ENTRIES = 3;
+    const static unsigned int MAX_NR_OF_CACHE_ENTRIES = 16;
     
     FontCache();
     virtual ~FontCache();
 
     bool is_init_ok() const;
     FT_Face get_font(const std::string &font);
+    unsigned long get_face_id(const FT_Face &face) const;
     bool is_windows_symbol_font(const FT_Face &face) const;
     void register_font_file(const std::string &path);
     void clear();
-    FontInfoList *list_fonts() const;
+    FontInfoList *list_fonts();
     
     static FontCache *instance();
 
@@ -93,9 +94,20 @@ public:
     static void registerProgressHandler(InitHandlerFunc *handler, void *userdata = nullptr);
 
 private:
-    typedef std::pair<FT_Face, time_t> cache_entry_t;
+    struct cache_entry_t {
+        FT_Face face;
+        unsigned long id;       // unique for each loaded face
+        unsigned long last_use;
+    };
     typedef std::map<std::string, cache_entry_t> cache_t;
 
+    struct index_entry_t {
+        std::string file;
+        int index;
+    };
+    typedef std::map<std::string, index_entry_t> index_t;  // lookup -> face
+    typedef std::map<std::string, time_t> stamps_t;       // path -> mtime
+
     static FontCache *self;
     static InitHandlerFunc *cb_handler;
     static void *cb_userdata;
@@ -104,17 +116,36 @@ private:
 
     bool init_ok;
     cache_t cache;
+    unsigned int max_entries;
+    unsigned long counter;
+    bool fontconfig_loaded;
     FcConfig *config;
     FT_Library library;
 
-    void check_cleanup();
+    std::vector<std::string> app_dirs;
+    bool index_ok;
+    index_t index;
+    stamps_t index_stamps;
+    std::string index_token;
+
+    void check_cleanup(unsigned int max_size);
     void dump_cache(const std::string &info);
     
+    bool init_fontconfig();
     void add_font_dir(const std::string &path);
     void init_pattern(FcPattern *pattern) const;
+
+    std::vector<std::string> index_sources() const;
+    std::string index_path() const;
+    bool load_index();
+    void reset_index();
+    void save_index();
+    void append_index(const std::string &font) const;
     
-    FT_Face find_face(const std::string &font) const;
-    FT_Face find_face_fontconfig(const std::string &font) const;
+    FT_Face find_face(const std::string &font);
+    FT_Face find_face_index(const std::string &font) const;
+    FT_Face find_face_fontconfig(const std::string &font);
+    FT_Face open_face(const std::string &file, int index) const;
     bool try_charmap(FT_Face face, int platform_id, int encoding_id) const;
 };
 
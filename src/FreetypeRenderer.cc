@@ -27,6 +27,7 @@
 #include <stdio.h>
 
 #include <iostream>
+#include <sstream>
 
 #include <glib.h>
 
@@ -37,6 +38,7 @@
 #include "FontCache.h"
 #include "DrawingCallback.h"
 #include "FreetypeRenderer.h"
+#include "cache.h"
 
 #include FT_OUTLINE_H
 
@@ -193,28 +195,8 @@ void FreetypeRenderer::detect_properties(FreetypeRenderer::Params &params) const
 	params.set_direction(hb_direction_to_string(direction));
 }
 
-std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::Params &params) const
+shared_ptr<const FreetypeRenderer::ShapedText> FreetypeRenderer::shape(FT_Face face, const FreetypeRenderer::Params &params) const
 {
-	FT_Face face;
-	FT_Error error;
-	DrawingCallback callback(params.segments);
-	
-	FontCache *cache = FontCache::instance();
-	if (!cache->is_init_ok()) {
-		return std::vector<const Geometry *>();
-	}
-
-	face = cache->get_font(params.font);
-	if (face == nullptr) {
-		return std::vector<const Geometry *>();
-	}
-	
-	error = FT_Set_Char_Size(face, 0, params.size * scale, 100, 100);
-	if (error) {
-		PRINTB("Can't set font size for font %s", params.font);
-		return std::vector<const Geometry *>();
-	}
-	
 	hb_font_t *hb_ft_font = hb_ft_font_create(face, nullptr);
 
 	hb_buffer_t *hb_buf = hb_buffer_create();
@@ -253,64 +235,155 @@ std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::P
         hb_glyph_info_t *glyph_info = hb_buffer_get_glyph_infos(hb_buf, &glyph_count);
         hb_glyph_position_t *glyph_pos = hb_buffer_get_glyph_positions(hb_buf, &glyph_count);
 
-	GlyphArray glyph_array;
+	auto shaped = make_shared<ShapedText>();
+	shaped->direction = hb_buffer_get_direction(hb_buf);
 	for (unsigned int idx = 0;idx < glyph_count;idx++) {
-		FT_UInt glyph_index = glyph_info[idx].codepoint;
-		error = FT_Load_Glyph(face, glyph_index, FT_LOAD_DEFAULT);
-		if (error) {
-			PRINTB("Could not load glyph %u for char at index %u in text '%s'", glyph_index % idx % params.text);
-			continue;
+		shaped->glyphs.push_back(ShapedGlyph{glyph_info[idx].codepoint,
+				glyph_pos[idx].x_offset, glyph_pos[idx].y_offset, glyph_pos[idx].x_advance, glyph_pos[idx].y_advance});
+	}
+
+	hb_buffer_destroy(hb_buf);
+        hb_font_destroy(hb_ft_font);
+	return shaped;
+}
+
+shared_ptr<const FreetypeRenderer::GlyphOutline> FreetypeRenderer::load_glyph(FT_Face face, FT_UInt index, unsigned long fn) const
+{
+	FT_Error error = FT_Load_Glyph(face, index, FT_LOAD_DEFAULT);
+	if (error) return shared_ptr<const GlyphOutline>();
+
+	FT_Glyph glyph;
+	error = FT_Get_Glyph(face->glyph, &glyph);
+	if (error) return shared_ptr<const GlyphOutline>();
+
+	auto outline = make_shared<GlyphOutline>();
+	FT_Glyph_Get_CBox(glyph, FT_GLYPH_BBOX_GRIDFIT, &outline->cbox);
+
+	// Decompose without offsets, they are added when the glyph is placed
+	DrawingCallback callback(fn);
+	callback.start_glyph();
+	FT_Outline ft_outline = reinterpret_cast<FT_OutlineGlyph>(glyph)->outline;
+	FT_Outline_Decompose(&ft_outline, &funcs, &callback);
+	callback.finish_glyph();
+	for (const Geometry *geom : callback.get_result()) {
+		outline->outlines = static_cast<const Polygon2d *>(geom)->outlines();
+		delete geom;
+	}
+
+	FT_Done_Glyph(glyph);
+	return outline;
+}
+
+std::vector<const Geometry *> FreetypeRenderer::render(const FreetypeRenderer::Params &params) const
+{
+	FT_Face face;
+	FT_Error error;
+	DrawingCallback callback(params.segments);
+	
+	FontCache *cache = FontCache::instance();
+	if (!cache->is_init_ok()) {
+		return std::vector<const Geometry *>();
+	}
+
+	face = cache->get_font(params.font);
+	if (face == nullptr) {
+		return std::vector<const Geometry *>();
+	}
+
+	// Shaping results and flattened glyph outlines are cached, keyed by the
+	// face and size, as designs often repeat the same texts in a few fonts.
+	// The costs are the number of glyphs and of outline vertices.
+	static Cache<std::string, shared_ptr<const ShapedText>> shaping_cache(256 * 1024);
+	static Cache<std::string, shared_ptr<const GlyphOutline>> glyph_cache(4 * 1024 * 1024);
+
+	std::ostringstream facekey;
+	facekey.precision(17);
+	facekey << cache->get_face_id(face) << ":" << params.size << ":";
+
+	// Setting the size is only needed when something isn't cached
+	bool size_ok = false;
+	auto set_size = [&]() {
+		if (!size_ok) {
+			error = FT_Set_Char_Size(face, 0, params.size * scale, 100, 100);
+			if (error) {
+				PRINTB("Can't set font size for font %s", params.font);
+				return false;
+			}
+			size_ok = true;
 		}
+		return true;
+	};
 
-		FT_Glyph glyph;
-		error = FT_Get_Glyph(face->glyph, &glyph);
-		if (error) {
-			PRINTB("Could not get glyph %u for char at index %u in text '%s'", glyph_index % idx % params.text);
-			continue;
+	std::string shapekey = facekey.str() + params.direction + ":" + params.script + ":" + params.language + ":" + params.text;
+	shared_ptr<const ShapedText> shaped;
+	if (auto cached = shaping_cache[shapekey]) {
+		shaped = *cached;
+	}
+	else {
+		if (!set_size()) return std::vector<const Geometry *>();
+		shaped = shape(face, params);
+		shaping_cache.insert(shapekey, new shared_ptr<const ShapedText>(shaped), shaped->glyphs.size() + 1);
+	}
+
+	struct PlacedGlyph {
+		shared_ptr<const GlyphOutline> outline;
+		const ShapedGlyph *glyph;
+	};
+	std::vector<PlacedGlyph> glyph_array;
+	const unsigned long fn = params.segments;
+	for (unsigned int idx = 0;idx < shaped->glyphs.size();idx++) {
+		const ShapedGlyph &glyph = shaped->glyphs[idx];
+		std::string glyphkey = facekey.str() + std::to_string(fn) + ":" + std::to_string(glyph.index);
+		shared_ptr<const GlyphOutline> outline;
+		if (auto cached = glyph_cache[glyphkey]) {
+			outline = *cached;
+		}
+		else {
+			if (!set_size()) return std::vector<const Geometry *>();
+			outline = load_glyph(face, glyph.index, fn);
+			if (!outline) {
+				PRINTB("Could not load glyph %u for char at index %u in text '%s'", glyph.index % idx % params.text);
+				continue;
+			}
+			size_t vertices = 1;
+			for (const auto &o : outline->outlines) vertices += o.vertices.size();
+			glyph_cache.insert(glyphkey, new shared_ptr<const GlyphOutline>(outline), vertices);
 		}
-		const GlyphData *glyph_data = new GlyphData(glyph, idx, &glyph_pos[idx]);
-		glyph_array.push_back(glyph_data);
+		glyph_array.push_back(PlacedGlyph{outline, &glyph});
 	}
 
 	double width = 0, ascend = 0, descend = 0;
-	for (GlyphArray::iterator it = glyph_array.begin();it != glyph_array.end();it++) {
-		const GlyphData *glyph = (*it);
-		
-		FT_BBox bbox;
-		FT_Glyph_Get_CBox(glyph->get_glyph(), FT_GLYPH_BBOX_GRIDFIT, &bbox);
+	for (const auto &placed : glyph_array) {
+		const FT_BBox &bbox = placed.outline->cbox;
 		
-		if (HB_DIRECTION_IS_HORIZONTAL(hb_buffer_get_direction(hb_buf))) {
+		if (HB_DIRECTION_IS_HORIZONTAL(shaped->direction)) {
 			double asc = std::max(0.0, bbox.yMax / 64.0 / 16.0);
 			double desc = std::max(0.0, -bbox.yMin / 64.0 / 16.0);
-			width += glyph->get_x_advance() * params.spacing;
+			width += placed.glyph->x_advance / 64.0 / 16.0 * params.spacing;
 			ascend = std::max(ascend, asc);
 			descend = std::max(descend, desc);
 		} else {
 			double w_bbox = (bbox.xMax - bbox.xMin) / 64.0 / 16.0;
 			width = std::max(width, w_bbox);
-			ascend += glyph->get_y_advance() * params.spacing;
+			ascend += placed.glyph->y_advance / 64.0 / 16.0 * params.spacing;
 		}
 	}
 	
 	double x_offset = calc_x_offset(params.halign, width);
 	double y_offset = calc_y_offset(params.valign, ascend, descend);
 
-	for (GlyphArray::iterator it = glyph_array.begin();it != glyph_array.end();it++) {
-		const GlyphData *glyph = (*it);
-		
+	for (const auto &placed : glyph_array) {
 		callback.start_glyph();
-		callback.set_glyph_offset(x_offset + glyph->get_x_offset(), y_offset + glyph->get_y_offset());
-		FT_Outline outline = reinterpret_cast<FT_OutlineGlyph>(glyph->get_glyph())->outline;
-		FT_Outline_Decompose(&outline, &funcs, &callback);
+		callback.set_glyph_offset(x_offset + placed.glyph->x_offset / 64.0 / 16.0, y_offset + placed.glyph->y_offset / 64.0 / 16.0);
+		for (const auto &outline : placed.outline->outlines) {
+			callback.add_outline(outline);
+		}
 
-		double adv_x  = glyph->get_x_advance() * params.spacing;
-		double adv_y  = glyph->get_y_advance() * params.spacing;
+		double adv_x  = placed.glyph->x_advance / 64.0 / 16.0 * params.spacing;
+		double adv_y  = placed.glyph->y_advance / 64.0 / 16.0 * params.spacing;
 		callback.add_glyph_advance(adv_x, adv_y);
 		callback.finish_glyph();
 	}
 
-	hb_buffer_destroy(hb_buf);
-        hb_font_destroy(hb_ft_font);
-	
 	return callback.get_result();
 }
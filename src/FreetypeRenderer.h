@@ -29,6 +29,9 @@
 #include <vector>
 #include <ostream>
 
+#include "memory.h"
+#include "Polygon2d.h"
+
 #include <hb.h>
 #include <ft2build.h>
 #include FT_FREETYPE_H
@@ -108,35 +111,27 @@ private:
 	  const static double scale;
     FT_Outline_Funcs funcs;
     
-    class GlyphData {
-    public:
-        GlyphData(FT_Glyph glyph, unsigned int idx, hb_glyph_position_t *glyph_pos) : glyph(glyph), idx(idx), glyph_pos(glyph_pos) {}
-        unsigned int get_idx() const { return idx; };
-        FT_Glyph get_glyph() const { return glyph; };
-        double get_x_offset() const { return glyph_pos->x_offset / 64.0 / 16.0; };
-        double get_y_offset() const { return glyph_pos->y_offset / 64.0 / 16.0; };
-        double get_x_advance() const { return glyph_pos->x_advance / 64.0 / 16.0; };
-        double get_y_advance() const { return glyph_pos->y_advance / 64.0 / 16.0; };
-    private:
-        FT_Glyph glyph;
-        unsigned int idx;
-        hb_glyph_position_t *glyph_pos;
+    // A glyph outline flattened with a given number of segments per curve,
+    // in glyph coordinates, and its grid fitted control box
+    struct GlyphOutline {
+        std::vector<Outline2d> outlines;
+        FT_BBox cbox;
     };
 
-    struct done_glyph : public std::unary_function<const GlyphData *, void> {
-        void operator() (const GlyphData *glyph_data) {
-            FT_Done_Glyph(glyph_data->get_glyph());
-            delete glyph_data;
-        }
+    // The glyphs of a shaped text, positions are in HarfBuzz units
+    struct ShapedGlyph {
+        FT_UInt index;
+        hb_position_t x_offset, y_offset, x_advance, y_advance;
     };
-
-    class GlyphArray : public std::vector<const GlyphData *> {
-    public:
-        virtual ~GlyphArray() {
-            std::for_each(begin(), end(), done_glyph());
-        }
+    struct ShapedText {
+        std::vector<ShapedGlyph> glyphs;
+        hb_direction_t direction;
     };
 
+    // Both expect the size of the face to be set
+    shared_ptr<const ShapedText> shape(FT_Face face, const FreetypeRenderer::Params &params) const;
+    shared_ptr<const GlyphOutline> load_glyph(FT_Face face, FT_UInt index, unsigned long fn) const;
+
     bool is_ignored_script(const hb_script_t script) const;
     hb_script_t get_script(const FreetypeRenderer::Params &params, hb_glyph_info_t *glyph_info, unsigned int glyph_count) const;
     hb_direction_t get_direction(const FreetypeRenderer::Params &params, const hb_script_t script) const;
@@ -24,6 +24,7 @@ Some actions (showCrossHairs) only work properly on Gimbal Camera.
 #include <iostream>
 #include "Camera.h"
 #include "colormap.h"
+#include "VertexBufferCache.h"
 
 class GLView
 {
@@ -60,6 +61,7 @@ public:
 	bool showedges;
 	bool showcrosshairs;
 	bool showscale;
+	VertexBufferCache vbocache;
 
 #ifdef ENABLE_OPENCSG
 	GLint shaderinfo[11];
@@ -21,6 +21,7 @@
 #include "clipper-utils.h"
 #include "polyset-utils.h"
 #include "polyset.h"
+#include "MeshSlicer.h"
 #include "calc.h"
 #include "printutils.h"
 #include "svg.h"
@@ -265,6 +266,12 @@ shared_ptr<const Geometry> GeometryEvaluator::smartCacheGet(const AbstractNode &
 	bool hascgal = CGALCache::instance()->contains(key);
 	if (hascgal && (preferNef || !hasgeom)) geom = CGALCache::instance()->get(key);
 	else if (hasgeom) geom = GeometryCache::instance()->get(key);
+
+	auto messages = this->deferredmessages.find(key);
+	if (messages != this->deferredmessages.end()) {
+		print_deferred_messages(messages->second);
+		this->deferredmessages.erase(messages);
+	}
 	return geom;
 }
 
@@ -481,16 +488,13 @@ Response GeometryEvaluator::visit(State &state, const LeafNode &node)
 	if (state.isPrefix()) {
 		shared_ptr<const Geometry> geom;
 		if (!isSmartCached(node)) {
-			const Geometry *geometry = node.createGeometry();
-            assert(geometry);
-			if (const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geometry)) {
+			geom = node.getGeometry();
+			assert(geom);
+			if (const Polygon2d *polygon = dynamic_cast<const Polygon2d*>(geom.get())) {
 				if (!polygon->isSanitized()) {
-					Polygon2d *p = ClipperUtils::sanitize(*polygon);
-					delete geometry;
-					geometry = p;
+					geom.reset(ClipperUtils::sanitize(*polygon));
 				}
 			}
-            geom.reset(geometry);
 		}
 		else geom = smartCacheGet(node, state.preferNef());
 		addToParent(state, node, geom);
@@ -1032,17 +1036,26 @@ Response GeometryEvaluator::visit(State &state, const ProjectionNode &node)
 			else {
 				shared_ptr<const Geometry> newgeom = applyToChildren3D(node, OpenSCADOperator::UNION).constptr();
 				if (newgeom) {
-					shared_ptr<const CGAL_Nef_polyhedron> Nptr = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(newgeom);
-					if (!Nptr) {
-						Nptr.reset(CGALUtils::createNefPolyhedronFromGeometry(*newgeom));
-					}
-					if (!Nptr->isEmpty()) {
-						Polygon2d *poly = CGALUtils::project(*Nptr, node.cut_mode);
-						if (poly) {
-							poly->setConvexity(node.convexity);
-							geom.reset(poly);
+					// Cut the mesh directly instead of intersecting a Nef polyhedron with a plane
+					shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(newgeom);
+					if (!ps) {
+						shared_ptr<const CGAL_Nef_polyhedron> Nptr = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(newgeom);
+						if (Nptr && !Nptr->isEmpty()) {
+							PolySet *nefps = new PolySet(3);
+							bool err = CGALUtils::createPolySetFromNefPolyhedron3(*Nptr->p3, *nefps);
+							if (err) {
+								PRINT("ERROR: Nef->PolySet failed");
+								delete nefps;
+							}
+							else ps.reset(nefps);
 						}
 					}
+					if (ps && !ps->isEmpty()) {
+						MeshSlicer slicer(*ps);
+						Polygon2d *poly = slicer.slice(0);
+						poly->setConvexity(node.convexity);
+						geom.reset(poly);
+					}
 				}
 			}
 		}
@@ -4,11 +4,13 @@
 #include "enums.h"
 #include "memory.h"
 #include "Geometry.h"
+#include "printutils.h"
 
 #include <utility>
 #include <list>
 #include <vector>
 #include <map>
+#include <unordered_map>
 
 class GeometryEvaluator : public NodeVisitor
 {
@@ -35,6 +37,11 @@ public:
 	virtual Response visit(State &state, const OffsetNode &node);
 
 	const Tree &getTree() const { return this->tree; }
+	// Prints messages when the cached geometry of the node with the given key
+	// is first used, in place of the messages of rendering it
+	void deferMessages(const std::string &key, const DeferredMessages &messages) {
+		if (!messages.empty()) this->deferredmessages[key] = messages;
+	}
 
 private:
 	class ResultObject {
@@ -70,6 +77,7 @@ private:
 	void addToParent(const State &state, const AbstractNode &node, const shared_ptr<const Geometry> &geom);
 
 	std::map<int, Geometry::Geometries> visitedchildren;
+	std::unordered_map<std::string, DeferredMessages> deferredmessages;
 	const Tree &tree;
 	shared_ptr<const Geometry> root;
 
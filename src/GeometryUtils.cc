@@ -2,20 +2,196 @@
 #include "tesselator.h"
 #include "printutils.h"
 #include "Reindexer.h"
+#include "parallel.h"
 #include <boost/lexical_cast.hpp>
 #include <unordered_map>
+#include <atomic>
 #include <cmath>
+#include <cstring>
+#include <memory>
+#include <mutex>
 
 #include <boost/functional/hash.hpp>
 
-static void *stdAlloc(void* userData, unsigned int size) {
-	TESS_NOTUSED(userData);
-	return malloc(size);
-}
+namespace {
+
+/*!
+	Memory allocator for libtess2 which keeps freed blocks for reuse.
+	A tesselator allocates its mesh buckets and output arrays anew for each
+	tessellation, so when a tesselator is used for many faces, the same block
+	sizes are requested over and over. Block sizes up to max_class_size are
+	rounded up to powers of two and cached, larger blocks are allocated and
+	freed directly. Each block is preceded by its size.
+*/
+class TessAllocator
+{
+public:
+	TessAllocator() : cached(0) {}
+	~TessAllocator() {
+		for (auto &list : this->freelists) {
+			for (auto block : list) free(block);
+		}
+	}
+
+	static void *allocate(void *userData, unsigned int size) {
+		auto self = static_cast<TessAllocator *>(userData);
+		void *block;
+		if (size > max_class_size) {
+			block = malloc(header_size + size);
+			if (!block) return nullptr;
+			*static_cast<size_t *>(block) = size;
+		}
+		else {
+			auto c = size_class(size);
+			if (!self->freelists[c].empty()) {
+				block = self->freelists[c].back();
+				self->freelists[c].pop_back();
+				self->cached -= class_size(c);
+			}
+			else {
+				block = malloc(header_size + class_size(c));
+				if (!block) return nullptr;
+				*static_cast<size_t *>(block) = class_size(c);
+			}
+		}
+		return static_cast<char *>(block) + header_size;
+	}
+
+	static void *reallocate(void *userData, void *ptr, unsigned int size) {
+		if (!ptr) return allocate(userData, size);
+		auto blocksize = *reinterpret_cast<size_t *>(static_cast<char *>(ptr) - header_size);
+		if (size <= blocksize) return ptr;
+		void *newptr = allocate(userData, size);
+		if (!newptr) return nullptr;
+		memcpy(newptr, ptr, blocksize);
+		deallocate(userData, ptr);
+		return newptr;
+	}
+
+	static void deallocate(void *userData, void *ptr) {
+		if (!ptr) return;
+		auto self = static_cast<TessAllocator *>(userData);
+		void *block = static_cast<char *>(ptr) - header_size;
+		auto blocksize = *static_cast<size_t *>(block);
+		if (blocksize <= max_class_size && self->cached + blocksize <= max_cached) {
+			self->freelists[size_class(blocksize)].push_back(block);
+			self->cached += blocksize;
+		}
+		else {
+			free(block);
+		}
+	}
+
+private:
+	// Keeps the returned memory aligned for any type
+	static const size_t header_size = 16;
+	static const size_t min_size = 64;
+	static const size_t num_classes = 16;
+	static const size_t max_class_size = min_size << (num_classes - 1);
+	// Upper bound of the memory kept in the free lists
+	static const size_t max_cached = 32*1024*1024;
+
+	static size_t size_class(size_t size) {
+		size_t c = 0;
+		while ((min_size << c) < size) c++;
+		return c;
+	}
+	static size_t class_size(size_t c) { return min_size << c; }
+
+	std::vector<void *> freelists[num_classes];
+	size_t cached;
+};
+
+/*!
+	A libtess2 tesselator with its own allocator. Tesselators are kept in
+	TesselatorPool between tessellations, so that their memory is reused.
+*/
+class PooledTesselator
+{
+public:
+	PooledTesselator() : tess(nullptr) {
+		memset(&this->ma, 0, sizeof(this->ma));
+		this->ma.memalloc = TessAllocator::allocate;
+		this->ma.memrealloc = TessAllocator::reallocate;
+		this->ma.memfree = TessAllocator::deallocate;
+		this->ma.userData = &this->allocator;
+		this->ma.extraVertices = 256;
+	}
+	~PooledTesselator() { reset(); }
+
+	TESStesselator *get() {
+		if (!this->tess) this->tess = tessNewTess(&this->ma);
+		return this->tess;
+	}
+	// Deletes the tesselator. Needed after a failed tessellation, which may
+	// leave the tesselator in an inconsistent state.
+	void reset() {
+		if (this->tess) tessDeleteTess(this->tess);
+		this->tess = nullptr;
+	}
+
+private:
+	TessAllocator allocator;
+	TESSalloc ma;
+	TESStesselator *tess;
+};
+
+/*!
+	Process wide pool of idle tesselators. At most one tesselator per thread
+	of the ThreadPool, plus one for a thread outside of it, is kept.
+*/
+class TesselatorPool
+{
+public:
+	static std::unique_ptr<PooledTesselator> acquire() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!idle.empty()) {
+				auto tesselator = std::move(idle.back());
+				idle.pop_back();
+				return tesselator;
+			}
+		}
+		return std::unique_ptr<PooledTesselator>(new PooledTesselator);
+	}
+
+	static void release(std::unique_ptr<PooledTesselator> tesselator) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (idle.size() <= ThreadPool::instance().concurrency()) {
+			idle.push_back(std::move(tesselator));
+		}
+	}
+
+private:
+	static std::mutex mutex;
+	static std::vector<std::unique_ptr<PooledTesselator>> idle;
+};
+
+std::mutex TesselatorPool::mutex;
+std::vector<std::unique_ptr<PooledTesselator>> TesselatorPool::idle;
+
+/*!
+	Takes a tesselator from the pool on first use and returns it when
+	destroyed, so that tessellations which don't need libtess2 don't touch
+	the pool.
+*/
+class TesselatorLease
+{
+public:
+	TesselatorLease() {}
+	~TesselatorLease() {
+		if (this->tesselator) TesselatorPool::release(std::move(this->tesselator));
+	}
+
+	PooledTesselator &get() {
+		if (!this->tesselator) this->tesselator = TesselatorPool::acquire();
+		return *this->tesselator;
+	}
+
+private:
+	std::unique_ptr<PooledTesselator> tesselator;
+};
 
-static void stdFree(void* userData, void* ptr) {
-	TESS_NOTUSED(userData);
-	free(ptr);
 }
 
 typedef std::pair<int,int> IndexedEdge;
@@ -188,10 +364,11 @@ public:
 
 	Returns true on error, false on success.
 */
-bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
-																							 const std::vector<IndexedFace> &faces, 
-																							 std::vector<IndexedTriangle> &triangles,
-																							 const Vector3f *normal)
+static bool tessellatePolygonWithHoles(TesselatorLease &lease,
+																			 const Vector3f *vertices,
+																			 const std::vector<IndexedFace> &faces,
+																			 std::vector<IndexedTriangle> &triangles,
+																			 const Vector3f *normal)
 {
 	// Algorithm outline:
   // o Remove consecutive equal vertices and null ears (i.e. 23,24,23)
@@ -264,15 +441,9 @@ bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
     normalvec = passednormal;
   }
 
-  TESSalloc ma;
-  TESStesselator* tess = 0;
-
-  memset(&ma, 0, sizeof(ma));
-  ma.memalloc = stdAlloc;
-  ma.memfree = stdFree;
-  ma.extraVertices = 256; // realloc not provided, allow 256 extra vertices.
-  
-  if (!(tess = tessNewTess(&ma))) return true;
+  auto &tesselator = lease.get();
+  TESStesselator *tess = tesselator.get();
+  if (!tess) return true;
 
 	int numContours = 0;
   std::vector<TESSreal> contour;
@@ -294,7 +465,10 @@ bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
 		numContours++;
   }
 
-  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) return -1;
+  if (!tessTesselate(tess, TESS_WINDING_ODD, TESS_CONSTRAINED_DELAUNAY_TRIANGLES, 3, 3, normalvec)) {
+		tesselator.reset();
+		return true;
+	}
 
   const auto vindices = tessGetVertexIndices(tess);
   const auto elements = tessGetElements(tess);
@@ -408,11 +582,66 @@ bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
 		}
 #endif
 
-  tessDeleteTess(tess);
-
   return false;
 }
 
+bool GeometryUtils::tessellatePolygonWithHoles(const Vector3f *vertices,
+																							 const std::vector<IndexedFace> &faces, 
+																							 std::vector<IndexedTriangle> &triangles,
+																							 const Vector3f *normal)
+{
+	TesselatorLease lease;
+	return ::tessellatePolygonWithHoles(lease, vertices, faces, triangles, normal);
+}
+
+/*!
+	Returns true if face is a triangle which tessellatePolygonWithHoles() would
+	pass through unchanged: three distinct indices of finite vertices.
+*/
+static bool isValidTriangle(const Vector3f *vertices, const IndexedFace &face)
+{
+	if (face.size() != 3) return false;
+	if (face[0] == face[1] || face[1] == face[2] || face[2] == face[0]) return false;
+	for (auto idx : face) {
+		if (!vertices[idx].allFinite()) return false;
+	}
+	return true;
+}
+
+/*!
+	Tessellates all polygons of a mesh, see tessellatePolygonWithHoles().
+	The polygons are processed in parallel, and the triangles are appended in
+	polygon order. Valid triangles without holes are passed through unchanged,
+	and polygons which fail to tessellate are skipped.
+
+	Returns true if any polygon failed, false otherwise.
+*/
+bool GeometryUtils::tessellatePolygonsWithHoles(const Vector3f *vertices,
+																								const std::vector<std::vector<IndexedFace>> &polygons,
+																								std::vector<IndexedTriangle> &triangles)
+{
+	const size_t rangesize = 256;
+	std::vector<std::vector<IndexedTriangle>> rangetriangles((polygons.size() + rangesize - 1) / rangesize);
+	std::atomic<bool> err(false);
+	parallel_for(polygons.size(), rangesize, [&](size_t begin, size_t end) {
+		auto &result = rangetriangles[begin / rangesize];
+		TesselatorLease lease;
+		for (size_t i = begin; i < end; i++) {
+			const auto &faces = polygons[i];
+			if (faces.size() == 1 && isValidTriangle(vertices, faces[0])) {
+				result.emplace_back(faces[0][0], faces[0][1], faces[0][2]);
+			}
+			else if (::tessellatePolygonWithHoles(lease, vertices, faces, result, nullptr)) {
+				err = true;
+			}
+		}
+	});
+	for (const auto &result : rangetriangles) {
+		triangles.insert(triangles.end(), result.begin(), result.end());
+	}
+	return err;
+}
+
 /*!
 	Tessellates a single contour. Non-indexed version.
 	Appends resulting triangles to triangles.
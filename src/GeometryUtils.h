@@ -33,6 +33,9 @@ namespace GeometryUtils {
 																	const std::vector<IndexedFace> &faces, 
 																	std::vector<IndexedTriangle> &triangles,
 																	const Vector3f *normal = nullptr);
+	bool tessellatePolygonsWithHoles(const Vector3f *vertices,
+																	 const std::vector<std::vector<IndexedFace>> &polygons,
+																	 std::vector<IndexedTriangle> &triangles);
 
 	int findUnconnectedEdges(const std::vector<std::vector<IndexedFace>> &polygons);
 	int findUnconnectedEdges(const std::vector<IndexedTriangle> &triangles);
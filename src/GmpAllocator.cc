@@ -0,0 +1,181 @@
+#include "GmpAllocator.h"
+
+#include <gmp.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <boost/format.hpp>
+
+namespace {
+
+// Blocks of sizes which are a multiple of the limb size up to
+// cached_classes limbs are cached, one free list per size.
+const size_t granularity = sizeof(mp_limb_t);
+const size_t cached_classes = 32;
+// Upper bound of blocks per free list, to limit the memory held between trims
+const size_t max_cached_blocks = 4096;
+
+std::atomic<bool> is_installed(false);
+std::atomic<unsigned long> total_allocations(0);
+std::atomic<unsigned long> total_cache_hits(0);
+std::atomic<unsigned long> total_trimmed(0);
+
+// Returns cached_classes if blocks of this size are not cached
+size_t size_class(size_t size)
+{
+	if (size == 0 || size % granularity != 0 || size > granularity * cached_classes) return cached_classes;
+	return size / granularity - 1;
+}
+
+struct FreeBlock {
+	FreeBlock *next;
+};
+
+struct FreeList {
+	FreeBlock *head;
+	size_t count;
+};
+
+// The per-thread state is trivially destructible, so it stays valid while
+// other thread local objects are destroyed. GMP numbers they hold are still
+// freed through the allocator then, e.g. by CGAL's thread local caches.
+struct ThreadState {
+	FreeList lists[cached_classes];
+	unsigned long allocations;
+	unsigned long cache_hits;
+	unsigned long trimmed;
+	bool guarded;   // guard has been constructed
+	bool torn_down; // guard has been destroyed, blocks go to free() directly
+};
+
+thread_local ThreadState state;
+
+void trim_thread()
+{
+	for (auto &list : state.lists) {
+		while (list.head) {
+			auto block = list.head;
+			list.head = block->next;
+			free(block);
+			state.trimmed++;
+		}
+		list.count = 0;
+	}
+	total_allocations += state.allocations;
+	total_cache_hits += state.cache_hits;
+	total_trimmed += state.trimmed;
+	state.allocations = state.cache_hits = state.trimmed = 0;
+}
+
+// Returns the cached blocks when the thread exits. It's constructed before
+// the first block is cached, and never touched again once destroyed.
+struct ThreadGuard {
+	~ThreadGuard() {
+		trim_thread();
+		state.torn_down = true;
+	}
+};
+
+thread_local ThreadGuard guard;
+
+void *checked_malloc(size_t size)
+{
+	void *ptr = malloc(size);
+	if (!ptr) {
+		// Same as GMP's default allocation function
+		fprintf(stderr, "GNU MP: Cannot allocate memory (size=%lu)\n", static_cast<unsigned long>(size));
+		abort();
+	}
+	return ptr;
+}
+
+void *allocate(size_t size)
+{
+	state.allocations++;
+	auto c = size_class(size);
+	if (c < cached_classes && state.lists[c].head) {
+		auto &list = state.lists[c];
+		auto block = list.head;
+		list.head = block->next;
+		list.count--;
+		state.cache_hits++;
+		return block;
+	}
+	return checked_malloc(size);
+}
+
+void deallocate(void *ptr, size_t size)
+{
+	auto c = size_class(size);
+	if (state.torn_down || c >= cached_classes || state.lists[c].count >= max_cached_blocks) {
+		free(ptr);
+		return;
+	}
+	if (!state.guarded) {
+		state.guarded = true;
+		(void)&guard; // constructs the guard and registers its destructor
+	}
+	auto &list = state.lists[c];
+	auto block = static_cast<FreeBlock *>(ptr);
+	block->next = list.head;
+	list.head = block;
+	list.count++;
+}
+
+void *gmp_allocate(size_t size)
+{
+	return allocate(size);
+}
+
+void *gmp_reallocate(void *ptr, size_t old_size, size_t new_size)
+{
+	auto old_class = size_class(old_size);
+	auto new_class = size_class(new_size);
+	if (old_class == cached_classes && new_class == cached_classes) {
+		void *newptr = realloc(ptr, new_size);
+		if (!newptr) newptr = checked_malloc(new_size); // aborts
+		return newptr;
+	}
+	if (old_size == new_size) return ptr;
+
+	void *newptr = allocate(new_size);
+	memcpy(newptr, ptr, std::min(old_size, new_size));
+	deallocate(ptr, old_size);
+	return newptr;
+}
+
+void gmp_free(void *ptr, size_t size)
+{
+	deallocate(ptr, size);
+}
+
+}
+
+namespace GmpAllocator
+{
+	void install()
+	{
+		mp_set_memory_functions(gmp_allocate, gmp_reallocate, gmp_free);
+		is_installed = true;
+	}
+
+	bool installed()
+	{
+		return is_installed;
+	}
+
+	void trim()
+	{
+		if (is_installed) trim_thread();
+	}
+
+	std::string statistics()
+	{
+		unsigned long allocations = total_allocations;
+		unsigned long hits = total_cache_hits;
+		return str(boost::format("%d allocations, %d (%.1f%%) served from the free lists, %d cached blocks freed")
+							 % allocations % hits % (allocations ? 100.0 * hits / allocations : 0.0) % total_trimmed.load());
+	}
+}
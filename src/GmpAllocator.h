@@ -0,0 +1,25 @@
+#pragma once
+
+#include <string>
+
+/*!
+	Memory functions for GMP, which allocates and frees huge numbers of small
+	limb arrays during Nef polyhedron operations.
+
+	Freed blocks of the common limb array sizes are kept in per-thread free
+	lists and handed out again by later allocations of the same size, so most
+	allocations don't reach the system allocator. trim() returns the cached
+	blocks to the system allocator and should be called after each larger
+	operation. All blocks are allocated with malloc(), so memory allocated
+	before install() can be freed through the allocator and vice versa.
+*/
+namespace GmpAllocator
+{
+	// Installs the allocator with mp_set_memory_functions()
+	void install();
+	bool installed();
+	// Frees the blocks cached by the calling thread
+	void trim();
+	// Summary of the allocations served so far, for debug output
+	std::string statistics();
+}
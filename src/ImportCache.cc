@@ -0,0 +1,39 @@
+#include "ImportCache.h"
+#include "printutils.h"
+
+#include <sstream>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+ImportCache *ImportCache::inst = nullptr;
+
+std::string ImportCache::key(const std::string &filename, int format, const std::string &options)
+{
+	boost::system::error_code ec;
+	auto path = fs::canonical(filename, ec);
+	if (ec) return "";
+	auto mtime = fs::last_write_time(path, ec);
+	if (ec) return "";
+	auto size = fs::file_size(path, ec);
+	if (ec) return "";
+
+	std::ostringstream stream;
+	stream << path.generic_string() << '\0' << mtime << '\0' << size << '\0' << format << '\0' << options;
+	return stream.str();
+}
+
+shared_ptr<const Geometry> ImportCache::get(const std::string &key, DeferredMessages &messages) const
+{
+	auto entry = this->cache[key];
+	if (!entry) return nullptr;
+	PRINTDB("Import Cache hit: %s", key.substr(0, key.find('\0')));
+	messages = entry->messages;
+	return entry->geometry;
+}
+
+bool ImportCache::insert(const std::string &key, const shared_ptr<const Geometry> &geom, const DeferredMessages &messages)
+{
+	size_t cost = geom->memsize();
+	for (const auto &msg : messages) cost += msg.second.size();
+	return this->cache.insert(key, new Entry{geom, messages}, cost);
+}
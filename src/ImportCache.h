@@ -0,0 +1,43 @@
+#pragma once
+
+#include "cache.h"
+#include "memory.h"
+#include "Geometry.h"
+#include "printutils.h"
+
+/*!
+	Cache of imported files, shared by all import() nodes.
+
+	Entries hold the parsed geometry and the messages printed while parsing,
+	and are keyed by the identity of the file (canonical path, modification
+	time and size), the file format and the options which affect parsing.
+	Import nodes share the cached geometry, so importing the same file in many
+	places only parses and stores it once.
+*/
+class ImportCache
+{
+public:
+	ImportCache(size_t memorylimit = 256*1024*1024) : cache(memorylimit) {}
+
+	static ImportCache *instance() { if (!inst) inst = new ImportCache; return inst; }
+
+	// Returns an empty key if the file can't be identified
+	static std::string key(const std::string &filename, int format, const std::string &options);
+
+	// Returns nullptr if there is no entry for key, otherwise the geometry and
+	// the messages printed while parsing it
+	shared_ptr<const Geometry> get(const std::string &key, DeferredMessages &messages) const;
+	bool insert(const std::string &key, const shared_ptr<const Geometry> &geom, const DeferredMessages &messages);
+	size_t maxSize() const { return this->cache.maxCost(); }
+	void setMaxSize(size_t limit) { this->cache.setMaxCost(limit); }
+	void clear() { cache.clear(); }
+
+private:
+	static ImportCache *inst;
+
+	struct Entry {
+		shared_ptr<const Geometry> geometry;
+		DeferredMessages messages;
+	};
+	Cache<std::string, Entry> cache;
+};
@@ -266,6 +266,8 @@ private:
 
 	shared_ptr<class CSGNode> csgRoot;		   // Result of the CSGTreeEvaluator
 	shared_ptr<CSGNode> normalizedRoot;		  // Normalized CSG tree
+	shared_ptr<class CSGTreeNormalizer> normalizer;
+	shared_ptr<CSGTreeNormalizer> thrownTogetherNormalizer; // without pruning by bounding box
  	shared_ptr<class CSGProducts> root_products;
 	shared_ptr<CSGProducts> highlights_products;
 	shared_ptr<CSGProducts> background_products;
@@ -0,0 +1,228 @@
+#include "MeshSlicer.h"
+#include "polyset.h"
+#include "Polygon2d.h"
+#include "clipper-utils.h"
+#include "GeometryUtils.h"
+#include "Reindexer.h"
+#include <algorithm>
+#include <unordered_map>
+
+MeshSlicer::MeshSlicer(const PolySet &ps) : min_z(0), max_z(0)
+{
+	Reindexer<Vector3d> uniqueVertices;
+	std::vector<IndexedFace> face(1);
+	std::vector<Vector3f> facevertices;
+	std::vector<IndexedTriangle> facetriangles;
+	for (const auto &p : ps.polygons) {
+		auto &indices = face[0];
+		indices.clear();
+		for (const auto &v : p) {
+			auto idx = uniqueVertices.lookup(v);
+			if (idx == int(this->vertices.size())) this->vertices.push_back(v);
+			if (indices.empty() || idx != indices.back()) indices.push_back(idx);
+		}
+		if (indices.size() > 1 && indices.front() == indices.back()) indices.pop_back();
+		if (indices.size() < 3) continue;
+		if (indices.size() == 3) {
+			this->triangles.emplace_back(indices[0], indices[1], indices[2]);
+			continue;
+		}
+		// Tessellate on local indices, so the triangles keep the exact vertices
+		std::vector<int> global;
+		global.swap(indices);
+		facevertices.clear();
+		for (size_t i = 0; i < global.size(); i++) {
+			facevertices.push_back(this->vertices[global[i]].cast<float>());
+			indices.push_back(int(i));
+		}
+		facetriangles.clear();
+		GeometryUtils::tessellatePolygonWithHoles(facevertices.data(), face, facetriangles);
+		for (const auto &t : facetriangles) {
+			this->triangles.emplace_back(global[t[0]], global[t[1]], global[t[2]]);
+		}
+	}
+	// Number each undirected edge, so the two triangles sharing an edge find
+	// the same crossing point
+	std::unordered_map<uint64_t, int> edges;
+	this->triangle_edges.reserve(this->triangles.size());
+	for (const auto &t : this->triangles) {
+		Vector3i e;
+		for (int k = 0; k < 3; k++) {
+			auto a = uint64_t(std::min(t[k], t[(k + 1) % 3]));
+			auto b = uint64_t(std::max(t[k], t[(k + 1) % 3]));
+			e[k] = edges.emplace((a << 32) | b, int(edges.size())).first->second;
+		}
+		this->triangle_edges.push_back(e);
+	}
+
+	if (!this->vertices.empty()) {
+		this->min_z = this->max_z = this->vertices[0][2];
+		for (const auto &v : this->vertices) {
+			this->min_z = std::min(this->min_z, v[2]);
+			this->max_z = std::max(this->max_z, v[2]);
+		}
+	}
+}
+
+/*!
+	Chains the crossing segments of the active triangles into outlines.
+	A vertex counts as above the plane if its z is greater than z, or greater
+	or equal if inclusive is set.
+
+	Each segment is directed by its triangle, so that the inside of the mesh
+	is on its left, which makes outer outlines counter-clockwise and holes
+	clockwise.
+*/
+void MeshSlicer::cut(const std::vector<int> &active, double z, bool inclusive, Polygon2d &result) const
+{
+	struct Node {
+		Vector2d p;
+		int segments; // First segment starting at this node
+	};
+	struct Segment {
+		int from, to;
+		int next; // Next segment starting at the same node
+		bool used;
+	};
+	std::vector<Node> nodes;
+	std::vector<Segment> segments;
+	std::unordered_map<int, int> edgenodes;
+
+	auto above = [&](int v) {
+		return inclusive ? this->vertices[v][2] >= z : this->vertices[v][2] > z;
+	};
+	auto node = [&](int edge, int v0, int v1) {
+		auto it = edgenodes.emplace(edge, int(nodes.size()));
+		if (it.second) {
+			// Always interpolate from the lower vertex, so the point only depends on the edge
+			const Vector3d &a = this->vertices[above(v0) ? v1 : v0];
+			const Vector3d &b = this->vertices[above(v0) ? v0 : v1];
+			double t = (z - a[2]) / (b[2] - a[2]);
+			if (t < 0) t = 0;
+			Vector2d p(a[0] + t * (b[0] - a[0]), a[1] + t * (b[1] - a[1]));
+			nodes.push_back({p, -1});
+		}
+		return it.first->second;
+	};
+
+	for (int i : active) {
+		const auto &t = this->triangles[i];
+		bool a[3] = {above(t[0]), above(t[1]), above(t[2])};
+		if (a[0] == a[1] && a[1] == a[2]) continue;
+		// With the triangle counter-clockwise seen from outside, the inside is on
+		// the left when going from the edge leading down to the edge leading up
+		int up = -1, down = -1;
+		for (int k = 0; k < 3; k++) {
+			if (a[k] == a[(k + 1) % 3]) continue;
+			int n = node(this->triangle_edges[i][k], t[k], t[(k + 1) % 3]);
+			if (a[k]) down = n;
+			else up = n;
+		}
+		segments.push_back({down, up, nodes[down].segments, false});
+		nodes[down].segments = int(segments.size()) - 1;
+	}
+
+	// Walk the loops. Open chains only come from meshes which aren't closed,
+	// and are dropped. Where more than two triangles share an edge, a node
+	// starts several segments, and loops may pass through it more than once.
+	for (size_t first = 0; first < segments.size(); first++) {
+		if (segments[first].used) continue;
+		Outline2d outline;
+		int start = segments[first].from;
+		int curr = int(first);
+		bool closed = false;
+		while (curr >= 0) {
+			auto &segment = segments[curr];
+			segment.used = true;
+			outline.vertices.push_back(nodes[segment.from].p);
+			if (segment.to == start) {
+				closed = true;
+				break;
+			}
+			curr = nodes[segment.to].segments;
+			while (curr >= 0 && segments[curr].used) curr = segments[curr].next;
+		}
+		if (closed && outline.vertices.size() >= 3) result.addOutline(outline);
+	}
+}
+
+/*!
+	Fills the outlines with the nonzero rule, so that regions where closed
+	parts of the mesh overlap stay filled.
+*/
+static Polygon2d *fill(const Polygon2d &outlines)
+{
+	ClipperLib::Paths paths;
+	for (const auto &outline : outlines.outlines()) {
+		paths.push_back(ClipperUtils::fromOutline2d(outline, true));
+	}
+	return ClipperUtils::toPolygon2d(ClipperUtils::sanitize(paths, ClipperLib::pftNonZero));
+}
+
+Polygon2d *MeshSlicer::cut(const std::vector<int> &active, double z) const
+{
+	Polygon2d below;
+	cut(active, z, false, below);
+	Polygon2d *result = fill(below);
+
+	// Faces lying in the plane only show up if the vertices on the plane count
+	// as above it
+	bool touching = false;
+	for (int i : active) {
+		const auto &t = this->triangles[i];
+		for (int k = 0; k < 3; k++) touching |= this->vertices[t[k]][2] == z;
+		if (touching) break;
+	}
+	if (touching) {
+		Polygon2d above;
+		cut(active, z, true, above);
+		Polygon2d *second = fill(above);
+		Polygon2d *merged = ClipperUtils::apply(std::vector<const Polygon2d *>{result, second}, ClipperLib::ctUnion);
+		delete result;
+		delete second;
+		result = merged;
+	}
+	return result;
+}
+
+Polygon2d *MeshSlicer::slice(double z) const
+{
+	std::vector<int> active;
+	for (size_t i = 0; i < this->triangles.size(); i++) {
+		const auto &t = this->triangles[i];
+		double lo = std::min({this->vertices[t[0]][2], this->vertices[t[1]][2], this->vertices[t[2]][2]});
+		double hi = std::max({this->vertices[t[0]][2], this->vertices[t[1]][2], this->vertices[t[2]][2]});
+		if (lo <= z && z <= hi) active.push_back(int(i));
+	}
+	return cut(active, z);
+}
+
+std::vector<shared_ptr<const Polygon2d>> MeshSlicer::slice(const std::vector<double> &heights) const
+{
+	std::vector<shared_ptr<const Polygon2d>> results(heights.size());
+
+	std::vector<int> order(this->triangles.size());
+	std::vector<double> lo(this->triangles.size()), hi(this->triangles.size());
+	for (size_t i = 0; i < this->triangles.size(); i++) {
+		const auto &t = this->triangles[i];
+		lo[i] = std::min({this->vertices[t[0]][2], this->vertices[t[1]][2], this->vertices[t[2]][2]});
+		hi[i] = std::max({this->vertices[t[0]][2], this->vertices[t[1]][2], this->vertices[t[2]][2]});
+		order[i] = int(i);
+	}
+	std::sort(order.begin(), order.end(), [&](int a, int b) { return lo[a] < lo[b]; });
+
+	std::vector<int> slices(heights.size());
+	for (size_t i = 0; i < slices.size(); i++) slices[i] = int(i);
+	std::sort(slices.begin(), slices.end(), [&](int a, int b) { return heights[a] < heights[b]; });
+
+	// Sweep upwards, keeping the triangles spanning the current height active
+	std::vector<int> active;
+	size_t next = 0;
+	for (int s : slices) {
+		double z = heights[s];
+		while (next < order.size() && lo[order[next]] <= z) active.push_back(order[next++]);
+		active.erase(std::remove_if(active.begin(), active.end(), [&](int i) { return hi[i] < z; }), active.end());
+		results[s].reset(cut(active, z));
+	}
+	return results;
+}
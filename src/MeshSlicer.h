@@ -0,0 +1,46 @@
+#pragma once
+
+#include "linalg.h"
+#include "memory.h"
+#include <vector>
+
+class PolySet;
+class Polygon2d;
+
+/*!
+	Cuts a polyhedral mesh with horizontal planes.
+
+	The mesh is triangulated and its vertices and edges are indexed once, so
+	each cross section only has to look at the triangles spanning its plane.
+	The segments where these triangles cross the plane are chained into closed
+	outlines through the shared edges. The outlines are oriented by the faces
+	and filled with the nonzero rule, so parts of a mesh which overlap, like
+	the children of an unrendered union, don't cancel each other out.
+
+	The cross section of a closed mesh includes any faces lying in the plane,
+	just like the intersection of the plane with a Nef polyhedron.
+*/
+class MeshSlicer
+{
+public:
+	MeshSlicer(const PolySet &ps);
+
+	// Returns the cross section at height z
+	Polygon2d *slice(double z) const;
+	// Returns the cross sections at the given heights in a single sweep over
+	// the mesh
+	std::vector<shared_ptr<const Polygon2d>> slice(const std::vector<double> &heights) const;
+
+	double zmin() const { return this->min_z; }
+	double zmax() const { return this->max_z; }
+
+private:
+	void cut(const std::vector<int> &active, double z, bool inclusive, Polygon2d &result) const;
+	Polygon2d *cut(const std::vector<int> &active, double z) const;
+
+	std::vector<Vector3d> vertices;
+	std::vector<Vector3i> triangles;
+	// Index of the edge from vertex k to vertex k+1 of each triangle
+	std::vector<Vector3i> triangle_edges;
+	double min_z, max_z;
+};
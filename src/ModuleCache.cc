@@ -1,8 +1,12 @@
 #include "ModuleCache.h"
 #include "StatCache.h"
+#include "ASTCache.h"
 #include "FileModule.h"
 #include "printutils.h"
 #include "openscad.h"
+#include "SourceBuffer.h"
+#include "parsersettings.h"
+#include "parallel.h"
 
 #include <boost/format.hpp>
 #include <boost/filesystem.hpp>
@@ -13,15 +17,47 @@
 #include <time.h>
 #include <sys/stat.h>
 #include <algorithm>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <unordered_set>
 
 namespace fs=boost::filesystem;
-//#include "parsersettings.h"
 /*!
 	FIXME: Implement an LRU scheme to avoid having an ever-growing module cache
 */
 
 ModuleCache *ModuleCache::inst = nullptr;
 
+static std::string make_cache_id(const struct stat &st)
+{
+	return str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+}
+
+/*!
+	Loads the library from the AST cache, or reads and parses it.
+
+	Returns false if the file can't be read. Otherwise sets parsed_module, which
+	is set even if there were parse errors, and lib_mod, which is nullptr on
+	parse errors.
+*/
+static bool compile_library(const std::string &filename, const struct stat &st,
+														FileModule *&parsed_module, FileModule *&lib_mod)
+{
+	parsed_module = lib_mod = ASTCache::enabled() ? ASTCache::load(filename, st) : nullptr;
+	if (lib_mod) return true;
+
+	SourceBuffer source;
+	if (!source.load(filename)) return false;
+
+	fs::path pathname = fs::path(filename);
+	lib_mod = parse(parsed_module, source, pathname, false) ? parsed_module : nullptr;
+	PRINTDB("  compiled module: %p", lib_mod);
+	if (lib_mod && ASTCache::enabled()) ASTCache::store(filename, st, *lib_mod);
+	return true;
+}
+
 /*!
 	Reevaluate the given file and all it's dependencies and recompile anything
 	needing reevaluation. Updates the cache if necessary.
@@ -54,7 +90,15 @@ time_t ModuleCache::evaluate(const std::string &filename, FileModule *&module)
 	if (!valid) return 0;
 
 	// If the file is present, we'll always cache some result
-	std::string cache_id = str(boost::format("%x.%x") % st.st_mtime % st.st_size);
+	std::string cache_id = make_cache_id(st);
+
+	// Take the result of prefetch(), if any
+	prefetch_entry prefetched;
+	auto it = this->prefetched.find(filename);
+	if (it != this->prefetched.end()) {
+		prefetched = std::move(it->second);
+		this->prefetched.erase(it);
+	}
 
 	cache_entry &entry = this->entries[filename];
 	// Initialize entry, if new
@@ -98,27 +142,33 @@ time_t ModuleCache::evaluate(const std::string &filename, FileModule *&module)
 		}
 #endif
 
-		std::stringstream textbuf;
-		{
-			std::ifstream ifs(filename.c_str());
-			if (!ifs.is_open()) {
-				PRINTB("WARNING: Can't open library file '%s'\n", filename);
-				return 0;
-			}
-			textbuf << ifs.rdbuf();
-		}
-		textbuf << "\n" << commandline_commands;
-		
+		FileModule *parsed_module = nullptr;
+		bool readable;
 		print_messages_push();
-		
-		fs::path pathname = fs::path(filename);
+		if (prefetched.parsed_module && prefetched.cache_id == cache_id) {
+			print_deferred_messages(prefetched.messages);
+			parsed_module = prefetched.parsed_module;
+			lib_mod = prefetched.module;
+			prefetched.parsed_module = nullptr;
+			readable = true;
+		}
+		else {
+			readable = compile_library(filename, st, parsed_module, lib_mod);
+		}
+		print_messages_pop();
+		delete prefetched.parsed_module;
+
+		if (!readable) {
+			PRINTB("WARNING: Can't open library file '%s'\n", filename);
+			return 0;
+		}
 		delete entry.parsed_module;
-		lib_mod = parse(entry.parsed_module, textbuf.str().c_str(), pathname, false) ? entry.parsed_module : nullptr;
-		PRINTDB("  compiled module: %p", lib_mod);
+		entry.parsed_module = parsed_module;
 		entry.module = lib_mod;
 		entry.cache_id = cache_id;
-		
-		print_messages_pop();
+	}
+	else {
+		delete prefetched.parsed_module;
 	}
 	
 	module = lib_mod;
@@ -130,6 +180,113 @@ time_t ModuleCache::evaluate(const std::string &filename, FileModule *&module)
 void ModuleCache::clear()
 {
 	this->entries.clear();
+	for (auto &prefetched : this->prefetched) delete prefetched.second.parsed_module;
+	this->prefetched.clear();
+}
+
+/*!
+	Parses the given libraries, and all libraries they use, concurrently on a
+	pool of threads. evaluate() picks up the parsed modules and still handles
+	the dependencies in order, so this only moves the parsing ahead.
+
+	Libraries which are cached and up to date are not parsed again, but the
+	libraries they use are checked as well. Messages printed while parsing are
+	kept and printed by evaluate(). The given filenames must be absolute.
+*/
+void ModuleCache::prefetch(const std::vector<std::string> &filenames)
+{
+	struct Job {
+		std::string filename;
+		struct stat st;
+	};
+	std::deque<Job> queue;
+	std::unordered_set<std::string> visited;
+	std::mutex mutex;
+	std::condition_variable cv;
+	unsigned int active = 0;
+
+	// Queues filename if it needs to be compiled, else visits the libraries
+	// used by its cached module. Called with the mutex held.
+	std::function<void (const FileModule *)> visit_uses;
+	auto visit = [&](const std::string &filename) {
+		if (!visited.insert(filename).second) return;
+
+		struct stat st;
+		if (StatCache::stat(filename.c_str(), &st) != 0) return;
+		auto cache_id = make_cache_id(st);
+
+		auto prefetched = this->prefetched.find(filename);
+		if (prefetched != this->prefetched.end() && prefetched->second.cache_id == cache_id) {
+			visit_uses(prefetched->second.module);
+			return;
+		}
+		auto cached = this->entries.find(filename);
+		if (cached != this->entries.end() && cached->second.cache_id == cache_id) {
+			const auto &entry = cached->second;
+			if (!entry.parsed_module || entry.parsed_module->includesChanged() <= entry.includes_mtime) {
+				visit_uses(entry.module);
+				return;
+			}
+		}
+		queue.push_back({filename, st});
+	};
+	visit_uses = [&](const FileModule *module) {
+		if (!module) return;
+		for (const auto &lib : module->usedlibs) {
+			// Relative paths are libraries which were missing, see FileModule::handleDependencies()
+			if (fs::path(lib).is_absolute()) visit(lib);
+			else {
+				auto fullpath = find_valid_path(module->modulePath(), lib);
+				if (!fullpath.empty()) visit(fullpath.generic_string());
+			}
+		}
+	};
+
+	for (const auto &filename : filenames) visit(filename);
+	if (queue.empty()) return;
+
+	auto worker = [&]() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			cv.wait(lock, [&]() { return !queue.empty() || active == 0; });
+			if (queue.empty()) break;
+			auto job = queue.front();
+			queue.pop_front();
+			active++;
+			lock.unlock();
+
+			prefetch_entry result;
+			FileModule *lib_mod = nullptr;
+			bool readable = false;
+			print_messages_defer(&result.messages);
+			try {
+				readable = compile_library(job.filename, job.st, result.parsed_module, lib_mod);
+			}
+			catch (...) {
+				// Leave it to evaluate(), which reports the error
+				delete result.parsed_module;
+				readable = false;
+			}
+			print_messages_defer(nullptr);
+
+			lock.lock();
+			// Libraries which can't be read are reported by evaluate()
+			if (readable) {
+				result.module = lib_mod;
+				result.cache_id = make_cache_id(job.st);
+				auto &prefetched = this->prefetched[job.filename];
+				delete prefetched.parsed_module;
+				prefetched = std::move(result);
+				visit_uses(lib_mod);
+			}
+			active--;
+			cv.notify_all();
+		}
+		cv.notify_all();
+	};
+
+	auto &pool = ThreadPool::instance();
+	pool.run(pool.concurrency(), worker);
 }
 
 FileModule *ModuleCache::lookup(const std::string &filename)
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <string>
+#include <vector>
 #include <unordered_map>
+#include "printutils.h"
 
 /*!
 	Caches FileModules based on their filenames
@@ -11,6 +13,7 @@ class ModuleCache
 public:
 	static ModuleCache *instance() { if (!inst) inst = new ModuleCache; return inst; }
 	time_t evaluate(const std::string &filename, class FileModule *&module);
+	void prefetch(const std::vector<std::string> &filenames);
 	class FileModule *lookup(const std::string &filename);
 	bool isCached(const std::string &filename);
 	size_t size() { return this->entries.size(); }
@@ -30,4 +33,14 @@ private:
 		time_t includes_mtime; // time the includes last changed
 	};
 	std::unordered_map<std::string, cache_entry> entries;
+
+	// Libraries parsed by prefetch() which evaluate() hasn't picked up yet
+	struct prefetch_entry {
+		prefetch_entry() : module(nullptr), parsed_module(nullptr) {}
+		class FileModule *module;
+		class FileModule *parsed_module;
+		std::string cache_id;
+		DeferredMessages messages;
+	};
+	std::unordered_map<std::string, prefetch_entry> prefetched;
 };
@@ -28,6 +28,8 @@ public:
 
 	AssignmentList arguments;
 	LocalScope scope;
+	// Loop invariant subexpressions of a for loop body, see ASTOptimizer
+	std::vector<shared_ptr<class HoistedExpression>> invariants;
 
 	bool tag_root;
 	bool tag_highlight;
@@ -40,6 +40,7 @@ public:
 	shared_ptr<const Geometry> geom;
 	Transform3d m;
 	Renderer::csgmode_e csgmode;
+	Color4f color;
 	virtual void render() {
 		glPushMatrix();
 		glMultMatrixd(m.data());
@@ -58,29 +59,44 @@ OpenCSGRenderer::OpenCSGRenderer(shared_ptr<CSGProducts> root_products,
 		highlights_products(highlights_products), 
 		background_products(background_products), shaderinfo(shaderinfo)
 {
+#ifdef ENABLE_OPENCSG
+	this->root_primitives = createCSGPrimitives(root_products, false, false);
+	this->background_primitives = createCSGPrimitives(background_products, false, true);
+	this->highlights_primitives = createCSGPrimitives(highlights_products, true, false);
+#endif
+}
+
+OpenCSGRenderer::~OpenCSGRenderer()
+{
+#ifdef ENABLE_OPENCSG
+	for (const auto *primitives : {&this->root_primitives, &this->background_primitives, &this->highlights_primitives}) {
+		for (const auto &product : *primitives) {
+			for (auto p : product) delete p;
+		}
+	}
+#endif
 }
 
 void OpenCSGRenderer::draw(bool /*showfaces*/, bool showedges) const
 {
+#ifdef ENABLE_OPENCSG
 	GLint *shaderinfo = this->shaderinfo;
 	if (!shaderinfo[0]) shaderinfo = nullptr;
-	if (this->root_products) {
-		renderCSGProducts(*this->root_products, showedges ? shaderinfo : nullptr, false, false);
-	}
-	if (this->background_products) {
-		renderCSGProducts(*this->background_products, showedges ? shaderinfo : nullptr, false, true);
-	}
-	if (this->highlights_products) {
-		renderCSGProducts(*this->highlights_products, showedges ? shaderinfo : nullptr, true, false);
-	}
+	renderCSGProducts(this->root_primitives, showedges ? shaderinfo : nullptr, false, false);
+	renderCSGProducts(this->background_primitives, showedges ? shaderinfo : nullptr, false, true);
+	renderCSGProducts(this->highlights_primitives, showedges ? shaderinfo : nullptr, true, false);
+#endif
 }
 
+#ifdef ENABLE_OPENCSG
+
 // Primitive for rendering using OpenCSG
 OpenCSGPrim *OpenCSGRenderer::createCSGPrimitive(const CSGChainObject &csgobj, OpenCSG::Operation operation, bool highlight_mode, bool background_mode, OpenSCADOperator type) const
 {
 	OpenCSGPrim *prim = new OpenCSGPrim(operation, csgobj.leaf->geom->getConvexity());
 	prim->geom = csgobj.leaf->geom;
 	prim->m = csgobj.leaf->matrix;
+	prim->color = csgobj.leaf->color;
 	prim->csgmode = csgmode_e(
 		(highlight_mode ? 
 		 CSGMODE_HIGHLIGHT :
@@ -89,76 +105,75 @@ OpenCSGPrim *OpenCSGRenderer::createCSGPrimitive(const CSGChainObject &csgobj, O
 	return prim;
 }
 
-void OpenCSGRenderer::renderCSGProducts(const CSGProducts &products, GLint *shaderinfo, 
-																				bool highlight_mode, bool background_mode) const
+/*!
+	Creates the primitives of each product, skipping what can't contribute to
+	the image: Products whose intersections have an empty common bounding box
+	get no primitives, and subtractions which don't overlap that box are left
+	out. Leaves with empty geometry have empty bounding boxes.
+*/
+OpenCSGRenderer::Primitives OpenCSGRenderer::createCSGPrimitives(const shared_ptr<CSGProducts> &products,
+																																	bool highlight_mode, bool background_mode) const
 {
-#ifdef ENABLE_OPENCSG
-	for(const auto &product : products.products) {
-		std::vector<OpenCSG::Primitive*> primitives;
+	Primitives result;
+	if (!products) return result;
+	for(const auto &product : products->products) {
+		result.emplace_back();
+		auto &primitives = result.back();
+		if (product.intersections.empty()) continue;
+		auto bbox = product.intersections.front().leaf->getBoundingBox();
+		for(const auto &csgobj : product.intersections) {
+			bbox = bbox.intersection(csgobj.leaf->getBoundingBox());
+		}
+		if (bbox.isEmpty()) continue;
+
 		for(const auto &csgobj : product.intersections) {
 			if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Intersection, highlight_mode, background_mode, OpenSCADOperator::INTERSECTION));
 		}
 		for(const auto &csgobj : product.subtractions) {
+			if (bbox.intersection(csgobj.leaf->getBoundingBox()).isEmpty()) continue;
 			if (csgobj.leaf->geom) primitives.push_back(createCSGPrimitive(csgobj, OpenCSG::Subtraction, highlight_mode, background_mode, OpenSCADOperator::DIFFERENCE));
 		}
+	}
+	return result;
+}
+
+void OpenCSGRenderer::renderCSGProducts(const Primitives &allprimitives, GLint *shaderinfo,
+																				bool highlight_mode, bool background_mode) const
+{
+	for (const auto &primitives : allprimitives) {
 		if (primitives.size() > 1) {
 			OpenCSG::render(primitives);
 			glDepthFunc(GL_EQUAL);
 		}
 		if (shaderinfo) glUseProgram(shaderinfo[0]);
 
-		for(const auto &csgobj : product.intersections) {
-			const Color4f &c = csgobj.leaf->color;
-				csgmode_e csgmode = csgmode_e(
-					highlight_mode ? 
-					CSGMODE_HIGHLIGHT :
-					(background_mode ? CSGMODE_BACKGROUND : CSGMODE_NORMAL));
-			
-			ColorMode colormode = ColorMode::NONE;
-			if (highlight_mode) {
-				colormode = ColorMode::HIGHLIGHT;
-			} else if (background_mode) {
-				colormode = ColorMode::BACKGROUND;
-			} else {
-				colormode = ColorMode::MATERIAL;
-			}
-			
-			setColor(colormode, c.data(), shaderinfo);
-			glPushMatrix();
-			glMultMatrixd(csgobj.leaf->matrix.data());
-			render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
-			glPopMatrix();
-		}
-		for(const auto &csgobj : product.subtractions) {
-			const Color4f &c = csgobj.leaf->color;
-				csgmode_e csgmode = csgmode_e(
-					(highlight_mode ? 
-					 CSGMODE_HIGHLIGHT :
-					 (background_mode ? CSGMODE_BACKGROUND : CSGMODE_NORMAL)) | CSGMODE_DIFFERENCE);
-			
+		for (const auto *primitive : primitives) {
+			const auto *prim = static_cast<const OpenCSGPrim *>(primitive);
+			const bool subtraction = prim->getOperation() == OpenCSG::Subtraction;
+
 			ColorMode colormode = ColorMode::NONE;
 			if (highlight_mode) {
 				colormode = ColorMode::HIGHLIGHT;
 			} else if (background_mode) {
 				colormode = ColorMode::BACKGROUND;
 			} else {
-				colormode = ColorMode::CUTOUT;
+				colormode = subtraction ? ColorMode::CUTOUT : ColorMode::MATERIAL;
 			}
-			
-			setColor(colormode, c.data(), shaderinfo);
+
+			setColor(colormode, prim->color.data(), shaderinfo);
 			glPushMatrix();
-			glMultMatrixd(csgobj.leaf->matrix.data());
-			render_surface(csgobj.leaf->geom, csgmode, csgobj.leaf->matrix, shaderinfo);
+			glMultMatrixd(prim->m.data());
+			render_surface(prim->geom, prim->csgmode, prim->m, shaderinfo);
 			glPopMatrix();
 		}
 
 		if (shaderinfo) glUseProgram(0);
-		for(auto &p : primitives) delete p;
 		glDepthFunc(GL_LEQUAL);
 	}
-#endif
 }
 
+#endif // ENABLE_OPENCSG
+
 BoundingBox OpenCSGRenderer::getBoundingBox() const
 {
 	BoundingBox bbox;
@@ -6,6 +6,7 @@
 #include <opencsg.h>
 #endif
 #include "csgnode.h"
+#include <vector>
 
 class OpenCSGRenderer : public Renderer
 {
@@ -14,14 +15,22 @@ public:
 									shared_ptr<CSGProducts> highlights_products,
 									shared_ptr<CSGProducts> background_products,
 									GLint *shaderinfo);
+	virtual ~OpenCSGRenderer();
 	virtual void draw(bool showfaces, bool showedges) const;
 	virtual BoundingBox getBoundingBox() const;
 private:
 #ifdef ENABLE_OPENCSG
+	// The OpenCSG primitives of each product, built once and reused by every redraw
+	typedef std::vector<std::vector<OpenCSG::Primitive *>> Primitives;
+
 	class OpenCSGPrim *createCSGPrimitive(const class CSGChainObject &csgobj, OpenCSG::Operation operation, bool highlight_mode, bool background_mode, OpenSCADOperator type) const;
+	Primitives createCSGPrimitives(const shared_ptr<CSGProducts> &products, bool highlight_mode, bool background_mode) const;
+	void renderCSGProducts(const Primitives &primitives, GLint *shaderinfo, bool highlight_mode, bool background_mode) const;
+
+	Primitives root_primitives;
+	Primitives highlights_primitives;
+	Primitives background_primitives;
 #endif
-	void renderCSGProducts(const class CSGProducts &products, GLint *shaderinfo, 
-											bool highlight_mode, bool background_mode) const;
 
 	shared_ptr<CSGProducts> root_products;
 	shared_ptr<CSGProducts> highlights_products;
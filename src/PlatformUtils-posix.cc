@@ -54,6 +54,23 @@ std::string PlatformUtils::userConfigPath()
     return "";
 }
 
+std::string PlatformUtils::userCachePath()
+{
+    fs::path cache_path;
+
+    const char *xdg_env = getenv("XDG_CACHE_HOME");
+    if (xdg_env && fs::path(xdg_env).is_absolute()) {
+	cache_path = fs::path(xdg_env) / OPENSCAD_FOLDER_NAME;
+    } else {
+	const char *home = getenv("HOME");
+	if (home) {
+	    cache_path = fs::path(home) / ".cache" / OPENSCAD_FOLDER_NAME;
+	}
+    }
+
+    return cache_path.generic_string();
+}
+
 unsigned long PlatformUtils::stackLimit()
 {
     struct rlimit limit;
@@ -95,6 +95,11 @@ std::string PlatformUtils::userConfigPath()
 	return retval + std::string("/") + PlatformUtils::OPENSCAD_FOLDER_NAME;
 }
 
+std::string PlatformUtils::userCachePath()
+{
+	return userConfigPath();
+}
+
 unsigned long PlatformUtils::stackLimit()
 {
     return STACK_LIMIT_DEFAULT;
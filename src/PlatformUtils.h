@@ -31,6 +31,17 @@ namespace PlatformUtils {
          */
         std::string userConfigPath();
 
+        /**
+         * Base path for files which can be recreated, like the font index.
+         * On Linux this is $XDG_CACHE_HOME, on Windows the local AppData
+         * folder and on Mac OS X the user's Caches folder, each with an
+         * OpenSCAD specific part appended.
+         *
+         * @return absolute path to the cache folder, which may not exist
+         * yet, or an empty string if it can't be determined.
+         */
+        std::string userCachePath();
+
 	bool createUserLibraryPath();
 	std::string backupPath();
 	bool createBackupPath();
@@ -1,4 +1,5 @@
 #include "Polygon2d.h"
+#include "clipper-utils.h"
 #include "printutils.h"
 
 /*!
@@ -16,11 +17,86 @@
 	the flag can be set manually.
 */
 
+Polygon2d::Polygon2d(shared_ptr<const ClipperLib::Paths> paths)
+	: sanitized(true), paths(paths), outlines_valid(false)
+{
+}
+
+Polygon2d::Polygon2d(const Polygon2d &other)
+	: Geometry(other), sanitized(other.sanitized), paths(other.paths), outlines_valid(false)
+{
+	if (!this->paths) {
+		this->theoutlines = other.theoutlines;
+		this->outlines_valid = true;
+	}
+}
+
+Polygon2d &Polygon2d::operator=(const Polygon2d &other)
+{
+	if (this != &other) {
+		Geometry::operator=(other);
+		this->sanitized = other.sanitized;
+		this->paths = other.paths;
+		if (this->paths) {
+			this->theoutlines.clear();
+			this->outlines_valid = false;
+		}
+		else {
+			this->theoutlines = other.theoutlines;
+			this->outlines_valid = true;
+		}
+	}
+	return *this;
+}
+
+/*!
+	Converts the Clipper paths to outlines. Each path is an outline, which is
+	positive if it's counter-clockwise.
+*/
+void Polygon2d::convertPaths() const
+{
+	std::lock_guard<std::mutex> lock(this->convert_mutex);
+	if (this->outlines_valid.load(std::memory_order_relaxed)) return;
+	const double scale = ClipperUtils::CLIPPER_SCALE;
+	this->theoutlines.reserve(this->paths->size());
+	for (const auto &path : *this->paths) {
+		Outline2d outline;
+		outline.positive = ClipperLib::Orientation(path);
+		outline.vertices.reserve(path.size());
+		for (const auto &ip : path) outline.vertices.emplace_back(ip.X / scale, ip.Y / scale);
+		this->theoutlines.push_back(std::move(outline));
+	}
+	this->outlines_valid.store(true, std::memory_order_release);
+}
+
+/*!
+	Returns the outlines for modification. The Clipper paths no longer match
+	afterwards, so they are dropped.
+*/
+Polygon2d::Outlines2d &Polygon2d::mutableOutlines()
+{
+	outlines();
+	this->paths.reset();
+	return this->theoutlines;
+}
+
+void Polygon2d::addOutline(const Outline2d &outline)
+{
+	mutableOutlines().push_back(outline);
+}
+
 size_t Polygon2d::memsize() const
 {
 	size_t mem = 0;
-	for (const auto &o : this->outlines()) {
-		mem += o.vertices.size() * sizeof(Vector2d) + sizeof(Outline2d);
+	if (this->outlines_valid) {
+		for (const auto &o : this->theoutlines) {
+			mem += o.vertices.size() * sizeof(Vector2d) + sizeof(Outline2d);
+		}
+	}
+	if (this->paths) {
+		for (const auto &path : *this->paths) {
+			mem += path.size() * sizeof(ClipperLib::IntPoint) + sizeof(ClipperLib::Path);
+		}
 	}
 	mem += sizeof(Polygon2d);
 	return mem;
@@ -29,6 +105,15 @@ size_t Polygon2d::memsize() const
 BoundingBox Polygon2d::getBoundingBox() const
 {
 	BoundingBox bbox;
+	if (!this->outlines_valid && this->paths) {
+		const double scale = ClipperUtils::CLIPPER_SCALE;
+		for (const auto &path : *this->paths) {
+			for (const auto &ip : path) {
+				bbox.extend(Vector3d(ip.X / scale, ip.Y / scale, 0));
+			}
+		}
+		return bbox;
+	}
 	for (const auto &o : this->outlines()) {
 		for (const auto &v : o.vertices) {
 			bbox.extend(Vector3d(v[0], v[1], 0));
@@ -40,7 +125,7 @@ BoundingBox Polygon2d::getBoundingBox() const
 std::string Polygon2d::dump() const
 {
 	std::stringstream out;
-	for (const auto &o : this->theoutlines) {
+	for (const auto &o : this->outlines()) {
 		out << "contour:\n";
 		for (const auto &v : o.vertices) {
 			out << "  " << v.transpose();
@@ -52,6 +137,7 @@ std::string Polygon2d::dump() const
 
 bool Polygon2d::isEmpty() const
 {
+	if (this->paths) return this->paths->empty();
 	return this->theoutlines.empty();
 }
 
@@ -59,10 +145,10 @@ void Polygon2d::transform(const Transform2d &mat)
 {
 	if (mat.matrix().determinant() == 0) {
 		PRINT("WARNING: Scaling a 2D object with 0 - removing object");
-		this->theoutlines.clear();
+		mutableOutlines().clear();
 		return;
 	}
-	for (auto &o : this->theoutlines) {
+	for (auto &o : mutableOutlines()) {
 		for (auto &v : o.vertices) {
 			v = mat * v;
 		}
@@ -96,6 +182,7 @@ void Polygon2d::resize(const Vector2d &newsize, const Eigen::Matrix<bool,2,1> &a
 
 bool Polygon2d::is_convex() const
 {
+	const auto &theoutlines = outlines();
 	if (theoutlines.size() > 1) return false;
 	if (theoutlines.empty()) return true;
 
@@ -2,8 +2,17 @@
 
 #include "Geometry.h"
 #include "linalg.h"
+#include "memory.h"
+#include <atomic>
+#include <mutex>
 #include <vector>
 
+namespace ClipperLib {
+	struct IntPoint;
+	typedef std::vector<IntPoint> Path;
+	typedef std::vector<Path> Paths;
+}
+
 /*!
 	A single contour.
 	positive is (optionally) used to distinguish between polygon contours and hold contours.
@@ -14,10 +23,19 @@ struct Outline2d {
 	bool positive;
 };
 
+/*!
+	A Polygon2d created by ClipperUtils keeps Clipper's integer paths, so
+	chained 2D operations can pass them on without converting to doubles and
+	back. The outlines are only converted when first requested, e.g. by
+	extrusion or export. Modifying the outlines drops the integer paths.
+*/
 class Polygon2d : public Geometry
 {
 public:
-	Polygon2d() : sanitized(false) {}
+	Polygon2d() : sanitized(false), outlines_valid(true) {}
+	explicit Polygon2d(shared_ptr<const ClipperLib::Paths> paths);
+	Polygon2d(const Polygon2d &other);
+	Polygon2d &operator=(const Polygon2d &other);
 	virtual size_t memsize() const;
 	virtual BoundingBox getBoundingBox() const;
 	virtual std::string dump() const;
@@ -25,11 +43,16 @@ public:
 	virtual bool isEmpty() const;
 	virtual Geometry *copy() const { return new Polygon2d(*this); }
 
-	void addOutline(const Outline2d &outline) { this->theoutlines.push_back(outline); }
+	void addOutline(const Outline2d &outline);
 	class PolySet *tessellate() const;
 
 	typedef std::vector<Outline2d> Outlines2d;
-	const Outlines2d &outlines() const { return theoutlines; }
+	const Outlines2d &outlines() const {
+		if (!this->outlines_valid.load(std::memory_order_acquire)) convertPaths();
+		return theoutlines;
+	}
+	// Clipper paths (scaled by ClipperUtils::CLIPPER_SCALE) of a sanitized polygon, or nullptr
+	const shared_ptr<const ClipperLib::Paths> &clipperPaths() const { return this->paths; }
 
 	void transform(const Transform2d &mat);
 	void resize(const Vector2d &newsize, const Eigen::Matrix<bool,2,1> &autosize);
@@ -38,6 +61,12 @@ public:
 	void setSanitized(bool s) { this->sanitized = s; }
 	bool is_convex() const;
 private:
-	Outlines2d theoutlines;
+	void convertPaths() const;
+	Outlines2d &mutableOutlines();
+
+	mutable Outlines2d theoutlines;
 	bool sanitized;
+	shared_ptr<const ClipperLib::Paths> paths;
+	mutable std::atomic<bool> outlines_valid;
+	mutable std::mutex convert_mutex;
 };
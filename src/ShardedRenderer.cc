@@ -0,0 +1,415 @@
+#include "ShardedRenderer.h"
+#include "GeometryEvaluator.h"
+#include "GeometryCache.h"
+#include "CGALCache.h"
+#include "CGAL_Nef_polyhedron.h"
+#include "Polygon2d.h"
+#include "polyset.h"
+#include "Reindexer.h"
+#include "Tree.h"
+#include "node.h"
+#include "printutils.h"
+
+#include <CGAL/IO/Nef_polyhedron_iostream_3.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#endif
+
+namespace {
+
+enum class ShardType : uint8_t { POLYSET, POLYGON2D, NEF };
+
+template <typename T> void put(std::string &out, const T &value)
+{
+	out.append(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T> bool get(const std::string &in, size_t &pos, T &value)
+{
+	if (in.size() - pos < sizeof(T)) return false;
+	std::memcpy(&value, in.data() + pos, sizeof(T));
+	pos += sizeof(T);
+	return true;
+}
+
+void putString(std::string &out, const std::string &value)
+{
+	put(out, uint64_t(value.size()));
+	out += value;
+}
+
+bool getString(const std::string &in, size_t &pos, std::string &value)
+{
+	uint64_t length;
+	if (!get(in, pos, length) || in.size() - pos < length) return false;
+	value = in.substr(pos, length);
+	pos += length;
+	return true;
+}
+
+void putMessages(std::string &out, const DeferredMessages &messages)
+{
+	put(out, uint64_t(messages.size()));
+	for (const auto &msg : messages) {
+		put(out, int8_t(msg.first));
+		putString(out, msg.second);
+	}
+}
+
+bool getMessages(const std::string &in, size_t &pos, DeferredMessages &messages)
+{
+	uint64_t count;
+	if (!get(in, pos, count)) return false;
+	for (uint64_t i = 0; i < count; i++) {
+		int8_t nocache;
+		std::string msg;
+		if (!get(in, pos, nocache) || !getString(in, pos, msg)) return false;
+		messages.emplace_back(nocache != 0, msg);
+	}
+	return true;
+}
+
+// Encodes geometry as [type][convexity][data], returns false for
+// geometry which can't be sent
+bool encode(const Geometry &geom, std::string &out)
+{
+	int32_t convexity = geom.getConvexity();
+	if (auto N = dynamic_cast<const CGAL_Nef_polyhedron *>(&geom)) {
+		put(out, ShardType::NEF);
+		put(out, convexity);
+		if (N->p3) {
+			std::ostringstream stream;
+			stream << *N->p3;
+			out += stream.str();
+		}
+		return true;
+	}
+	if (auto ps = dynamic_cast<const PolySet *>(&geom)) {
+		if (ps->getDimension() != 3) return false;
+		Reindexer<Vector3d> vertices;
+		std::vector<std::vector<int>> faces;
+		faces.reserve(ps->polygons.size());
+		for (const auto &p : ps->polygons) {
+			faces.emplace_back();
+			for (const auto &v : p) faces.back().push_back(vertices.lookup(v));
+		}
+		put(out, ShardType::POLYSET);
+		put(out, convexity);
+		auto convex = ps->convexValue();
+		put(out, int8_t(convex ? 1 : !convex ? 0 : 2));
+		put(out, uint64_t(vertices.size()));
+		const Vector3d *verts = vertices.getArray();
+		for (size_t i = 0; i < vertices.size(); i++) {
+			for (int j = 0; j < 3; j++) put(out, verts[i][j]);
+		}
+		put(out, uint64_t(faces.size()));
+		for (const auto &f : faces) {
+			put(out, uint32_t(f.size()));
+			for (int idx : f) put(out, int32_t(idx));
+		}
+		return true;
+	}
+	if (auto poly = dynamic_cast<const Polygon2d *>(&geom)) {
+		put(out, ShardType::POLYGON2D);
+		put(out, convexity);
+		put(out, int8_t(poly->isSanitized()));
+		put(out, uint64_t(poly->outlines().size()));
+		for (const auto &o : poly->outlines()) {
+			put(out, int8_t(o.positive));
+			put(out, uint64_t(o.vertices.size()));
+			for (const auto &v : o.vertices) {
+				put(out, v[0]);
+				put(out, v[1]);
+			}
+		}
+		return true;
+	}
+	return false;
+}
+
+shared_ptr<const Geometry> decode(const std::string &in)
+{
+	size_t pos = 0;
+	ShardType type;
+	int32_t convexity;
+	if (!get(in, pos, type) || !get(in, pos, convexity)) return nullptr;
+
+	switch (type) {
+	case ShardType::NEF: {
+		auto N = make_shared<CGAL_Nef_polyhedron>();
+		if (pos < in.size()) {
+			std::istringstream stream(in.substr(pos));
+			N->p3.reset(new CGAL_Nef_polyhedron3);
+			stream >> *N->p3;
+			if (stream.fail()) return nullptr;
+		}
+		N->setConvexity(convexity);
+		return N;
+	}
+	case ShardType::POLYSET: {
+		int8_t convex;
+		uint64_t numvertices, numfaces;
+		if (!get(in, pos, convex) || !get(in, pos, numvertices)) return nullptr;
+		if ((in.size() - pos) / sizeof(Vector3d) < numvertices) return nullptr;
+		std::vector<Vector3d> vertices(numvertices);
+		for (auto &v : vertices) {
+			for (int j = 0; j < 3; j++) get(in, pos, v[j]);
+		}
+		if (!get(in, pos, numfaces)) return nullptr;
+		auto ps = make_shared<PolySet>(3, convex == 2 ? boost::tribool(unknown) : boost::tribool(convex == 1));
+		ps->polygons.reserve(numfaces);
+		for (uint64_t i = 0; i < numfaces; i++) {
+			uint32_t n;
+			if (!get(in, pos, n)) return nullptr;
+			ps->append_poly();
+			for (uint32_t j = 0; j < n; j++) {
+				int32_t idx;
+				if (!get(in, pos, idx) || idx < 0 || uint64_t(idx) >= numvertices) return nullptr;
+				ps->append_vertex(vertices[idx]);
+			}
+		}
+		ps->setConvexity(convexity);
+		return ps;
+	}
+	case ShardType::POLYGON2D: {
+		int8_t sanitized;
+		uint64_t numoutlines;
+		if (!get(in, pos, sanitized) || !get(in, pos, numoutlines)) return nullptr;
+		auto poly = make_shared<Polygon2d>();
+		for (uint64_t i = 0; i < numoutlines; i++) {
+			Outline2d o;
+			int8_t positive;
+			uint64_t n;
+			if (!get(in, pos, positive) || !get(in, pos, n)) return nullptr;
+			if ((in.size() - pos) / sizeof(Vector2d) < n) return nullptr;
+			o.positive = positive;
+			o.vertices.resize(n);
+			for (auto &v : o.vertices) {
+				get(in, pos, v[0]);
+				get(in, pos, v[1]);
+			}
+			poly->addOutline(o);
+		}
+		poly->setSanitized(sanitized);
+		poly->setConvexity(convexity);
+		return poly;
+	}
+	}
+	return nullptr;
+}
+
+size_t countNodes(const AbstractNode &node, std::unordered_map<const AbstractNode *, size_t> &counts)
+{
+	size_t count = 1;
+	for (const auto child : node.getChildren()) count += countNodes(*child, counts);
+	counts[&node] = count;
+	return count;
+}
+
+#ifndef _WIN32
+
+bool writeAll(int fd, const std::string &data)
+{
+	size_t written = 0;
+	while (written < data.size()) {
+		auto n = write(fd, data.data() + written, data.size() - written);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+// Evaluates the given nodes and writes one [task][error][messages][geometry]
+// record per node. The geometry is empty if the node failed to evaluate or
+// its geometry can't be sent, the coordinator evaluates it itself then.
+void runWorker(const Tree &tree, const std::vector<const AbstractNode *> &nodes,
+							 const std::vector<uint32_t> &tasks, int fd)
+{
+	GeometryEvaluator evaluator(tree);
+	for (auto task : tasks) {
+		DeferredMessages messages;
+		auto previous = print_messages_defer(&messages);
+		std::string error, data;
+		try {
+			auto geom = evaluator.evaluateGeometry(*nodes[task], true);
+			if (geom && !encode(*geom, data)) data.clear();
+		}
+		catch (const std::exception &e) {
+			error = e.what();
+		}
+		catch (...) {
+			error = "unknown exception";
+		}
+		print_messages_defer(previous);
+
+		std::string record;
+		put(record, task);
+		putString(record, error);
+		putMessages(record, messages);
+		putString(record, data);
+		if (!writeAll(fd, record)) break;
+	}
+}
+
+#endif // _WIN32
+
+} // namespace
+
+void ShardedRenderer::prerender(GeometryEvaluator &evaluator, const AbstractNode &root, unsigned int jobs)
+{
+#ifndef _WIN32
+	if (jobs < 2) return;
+	const auto &tree = evaluator.getTree();
+
+	auto cached = [&](const AbstractNode &node) {
+		const auto &key = tree.getIdString(node);
+		return GeometryCache::instance()->contains(key) || CGALCache::instance()->contains(key);
+	};
+	if (cached(root)) return;
+
+	// Split the largest subtree until there are a couple of subtrees per job
+	std::unordered_map<const AbstractNode *, size_t> counts;
+	countNodes(root, counts);
+	std::vector<const AbstractNode *> frontier{&root};
+	while (frontier.size() < 2 * jobs) {
+		auto largest = frontier.end();
+		for (auto it = frontier.begin(); it != frontier.end(); ++it) {
+			if (!(*it)->getChildren().empty() && !cached(**it) &&
+					(largest == frontier.end() || counts[*it] > counts[*largest])) largest = it;
+		}
+		if (largest == frontier.end()) break;
+		auto node = *largest;
+		frontier.erase(largest);
+		frontier.insert(frontier.end(), node->getChildren().begin(), node->getChildren().end());
+	}
+
+	// Leaves are cheap, and identical subtrees only need to be rendered once
+	std::vector<const AbstractNode *> nodes;
+	std::unordered_set<std::string> keys;
+	for (auto node : frontier) {
+		if (node->getChildren().empty() || cached(*node)) continue;
+		if (keys.insert(tree.getIdString(*node)).second) nodes.push_back(node);
+	}
+	if (nodes.size() < 2) return;
+
+	// Hand out the largest subtrees first, each to the least loaded worker
+	std::vector<uint32_t> order(nodes.size());
+	for (uint32_t i = 0; i < order.size(); i++) order[i] = i;
+	std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return counts[nodes[a]] > counts[nodes[b]]; });
+	size_t numworkers = std::min(size_t(jobs), nodes.size());
+	std::vector<std::vector<uint32_t>> tasks(numworkers);
+	std::vector<size_t> load(numworkers);
+	for (auto task : order) {
+		auto w = std::min_element(load.begin(), load.end()) - load.begin();
+		tasks[w].push_back(task);
+		load[w] += counts[nodes[task]];
+	}
+
+	// Make sure the workers don't inherit pending output
+	std::cout.flush();
+	std::cerr.flush();
+
+	std::vector<pid_t> pids;
+	std::vector<pollfd> fds;
+	for (const auto &workertasks : tasks) {
+		int p[2];
+		if (pipe(p) != 0) break;
+		pid_t pid = fork();
+		if (pid < 0) {
+			close(p[0]);
+			close(p[1]);
+			break;
+		}
+		if (pid == 0) {
+			close(p[0]);
+			for (const auto &fd : fds) close(fd.fd);
+			runWorker(tree, nodes, workertasks, p[1]);
+			close(p[1]);
+			std::cout.flush();
+			std::cerr.flush();
+			_exit(0);
+		}
+		close(p[1]);
+		pids.push_back(pid);
+		fds.push_back({p[0], POLLIN, 0});
+	}
+	if (pids.empty()) {
+		PRINT("WARNING: Could not start worker processes, rendering in a single process");
+		return;
+	}
+
+	// Collect the output of all workers, which may not fit into a pipe buffer
+	std::vector<std::string> output(fds.size());
+	size_t open = fds.size();
+	char buf[65536];
+	while (open > 0) {
+		if (poll(fds.data(), fds.size(), -1) < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		for (size_t i = 0; i < fds.size(); i++) {
+			if (fds[i].fd < 0 || !fds[i].revents) continue;
+			auto n = read(fds[i].fd, buf, sizeof(buf));
+			if (n > 0) output[i].append(buf, n);
+			else if (n == 0 || errno != EINTR) {
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				open--;
+			}
+		}
+	}
+	for (size_t i = 0; i < fds.size(); i++) {
+		if (fds[i].fd >= 0) close(fds[i].fd);
+	}
+	for (auto pid : pids) {
+		int status;
+		while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+		if (WIFSIGNALED(status)) {
+			PRINTB("WARNING: Worker process was terminated by signal %d, rendering its subtrees again", WTERMSIG(status));
+		}
+	}
+
+	// Cache the results, a missing or truncated record just means that
+	// subtree is rendered again by the coordinator. Messages of subtrees
+	// rendered again are printed by that rendering.
+	for (const auto &data : output) {
+		size_t pos = 0;
+		uint32_t task;
+		std::string error, geomdata;
+		DeferredMessages messages;
+		while (get(data, pos, task) && getString(data, pos, error) &&
+					 getMessages(data, pos, messages) && getString(data, pos, geomdata)) {
+			if (!error.empty()) {
+				PRINTB("WARNING: Worker process failed to render a subtree (%s), rendering it again", error);
+			}
+			auto geom = task < nodes.size() && !geomdata.empty() ? decode(geomdata) : nullptr;
+			if (geom) {
+				const auto &key = tree.getIdString(*nodes[task]);
+				if (auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(geom)) {
+					CGALCache::instance()->insert(key, N);
+				}
+				else if (!GeometryCache::instance()->insert(key, geom)) {
+					PRINT("WARNING: GeometryEvaluator: Node didn't fit into cache");
+				}
+				evaluator.deferMessages(key, messages);
+			}
+			messages.clear();
+		}
+	}
+#endif
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+class GeometryEvaluator;
+class AbstractNode;
+
+/*!
+	Renders independent subtrees of a node tree in worker processes.
+
+	The coordinator picks the largest subtrees which aren't cached yet and
+	forks up to jobs worker processes, each evaluating its share of them with a
+	GeometryEvaluator of its own. The workers send the resulting geometry back
+	over pipes: Nef polyhedra in the .nef3 format, PolySets and 2D polygons as
+	raw indexed vertex data. The coordinator inserts the results into the
+	geometry caches, so the subsequent evaluation of the whole tree only has to
+	combine them.
+
+	Messages printed by a worker are sent back along with the geometry and
+	handed to the coordinator's GeometryEvaluator, which prints them when it
+	reaches the subtree. The output is thus in the same order as without
+	workers. Subtrees which a worker fails to render are rendered again by the
+	coordinator.
+
+	Separate processes sidestep the thread safety issues of CGAL's Nef code.
+	Workers are only available on POSIX systems; elsewhere this does nothing.
+*/
+namespace ShardedRenderer
+{
+	void prerender(GeometryEvaluator &evaluator, const AbstractNode &root, unsigned int jobs);
+}
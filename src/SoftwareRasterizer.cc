@@ -0,0 +1,283 @@
+#include "SoftwareRasterizer.h"
+#include "polyset.h"
+#include "polyset-utils.h"
+#include "imageutils.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+
+namespace {
+
+const int TILE_SIZE = 64;
+
+Matrix4d perspective(double fovy, double aspect, double znear, double zfar)
+{
+	double f = 1 / tan(fovy / 2 * M_PI / 180);
+	Matrix4d m = Matrix4d::Zero();
+	m(0, 0) = f / aspect;
+	m(1, 1) = f;
+	m(2, 2) = (zfar + znear) / (znear - zfar);
+	m(2, 3) = 2 * zfar * znear / (znear - zfar);
+	m(3, 2) = -1;
+	return m;
+}
+
+Matrix4d ortho(double left, double right, double bottom, double top, double znear, double zfar)
+{
+	Matrix4d m = Matrix4d::Identity();
+	m(0, 0) = 2 / (right - left);
+	m(1, 1) = 2 / (top - bottom);
+	m(2, 2) = -2 / (zfar - znear);
+	m(0, 3) = -(right + left) / (right - left);
+	m(1, 3) = -(top + bottom) / (top - bottom);
+	m(2, 3) = -(zfar + znear) / (zfar - znear);
+	return m;
+}
+
+Matrix4d lookAt(const Vector3d &eye, const Vector3d &center, const Vector3d &up)
+{
+	Vector3d f = (center - eye).normalized();
+	Vector3d s = f.cross(up).normalized();
+	Vector3d u = s.cross(f);
+	Matrix4d m = Matrix4d::Identity();
+	m.block<1, 3>(0, 0) = s.transpose();
+	m.block<1, 3>(1, 0) = u.transpose();
+	m.block<1, 3>(2, 0) = -f.transpose();
+	m(0, 3) = -s.dot(eye);
+	m(1, 3) = -u.dot(eye);
+	m(2, 3) = f.dot(eye);
+	return m;
+}
+
+uint32_t packColor(const Color4f &c, float light)
+{
+	uint32_t rgba = 0;
+	for (int i = 0; i < 3; i++) {
+		float v = std::min(std::max(c[i] * light, 0.0f), 1.0f);
+		rgba |= uint32_t(v * 255 + 0.5f) << (8 * i);
+	}
+	return rgba | 0xff000000;
+}
+
+} // namespace
+
+SoftwareRasterizer::SoftwareRasterizer(unsigned int width, unsigned int height)
+	: width(width), height(height), projection(Matrix4d::Identity()), modelview(Matrix4d::Identity())
+{
+}
+
+/*!
+	Mirrors GLView::setupCamera(), including the translation GLView::paintGL()
+	applies for gimbal cameras
+*/
+void SoftwareRasterizer::setCamera(const Camera &cam)
+{
+	Camera c = cam;
+	double aspectratio = double(this->width) / this->height;
+	this->modelview = Matrix4d::Identity();
+
+	switch (c.type) {
+	case Camera::CameraType::GIMBAL: {
+		auto dist = c.zoomValue();
+		if (c.projection == Camera::ProjectionType::PERSPECTIVE) {
+			this->projection = perspective(c.fov, aspectratio, 0.1 * dist, 100 * dist);
+		}
+		else {
+			auto height = dist * tan(c.fov / 2 * M_PI / 180);
+			this->projection = ortho(-height * aspectratio, height * aspectratio, -height, height, -100 * dist, 100 * dist);
+		}
+		this->projection *= lookAt(Vector3d(0, -dist, 0), Vector3d::Zero(), Vector3d(0, 0, 1));
+		Transform3d m = Transform3d::Identity();
+		m.rotate(Eigen::AngleAxisd(c.object_rot.x() * M_PI / 180, Vector3d::UnitX()));
+		m.rotate(Eigen::AngleAxisd(c.object_rot.y() * M_PI / 180, Vector3d::UnitY()));
+		m.rotate(Eigen::AngleAxisd(c.object_rot.z() * M_PI / 180, Vector3d::UnitZ()));
+		m.translate(c.object_trans);
+		this->modelview = m.matrix();
+		break;
+	}
+	case Camera::CameraType::VECTOR: {
+		auto dist = (c.center - c.eye).norm();
+		if (c.projection == Camera::ProjectionType::PERSPECTIVE) {
+			this->projection = perspective(c.fov, aspectratio, 0.1 * dist, 100 * dist);
+		}
+		else {
+			auto height = dist * tan(c.fov / 2 * M_PI / 180);
+			this->projection = ortho(-height * aspectratio, height * aspectratio, -height, height, -100 * dist, 100 * dist);
+		}
+		Vector3d dir(c.eye - c.center);
+		Vector3d up(0.0, 0.0, 1.0);
+		if (dir.cross(up).norm() < 0.001) up << 0.0, 1.0, 0.0;
+		this->modelview = lookAt(c.eye, c.center, up);
+		break;
+	}
+	default:
+		this->projection = Matrix4d::Identity();
+		break;
+	}
+}
+
+void SoftwareRasterizer::addPolySet(const PolySet &ps, const Transform3d &m,
+																		const Color4f &front, const Color4f &back, bool lit)
+{
+	// Mirroring transforms flip the winding, which would swap the sides
+	bool mirrored = m.matrix().determinant() < 0;
+	const PolySet *polyset = &ps;
+	PolySet tessellated(3);
+	if (ps.getDimension() == 3) {
+		PolysetUtils::tessellate_faces(ps, tessellated);
+		polyset = &tessellated;
+	}
+	for (const auto &p : polyset->polygons) {
+		for (size_t i = 2; i < p.size(); i++) {
+			Face face{{m * p[0], m * p[mirrored ? i : i - 1], m * p[mirrored ? i - 1 : i]}, front, back, lit};
+			this->faces.push_back(face);
+		}
+	}
+}
+
+/*!
+	Projects a face to window coordinates, clipped at the near plane, and
+	shades it. Appends the visible part of the face to triangles, as up to two
+	triangles.
+*/
+void SoftwareRasterizer::project(const Face &face, std::vector<Triangle> &triangles) const
+{
+	Vector3d eye[3];
+	Eigen::Vector4d clip[3];
+	for (int i = 0; i < 3; i++) {
+		const Vector3d &p = face.v[i];
+		Eigen::Vector4d v = this->modelview * Eigen::Vector4d(p[0], p[1], p[2], 1);
+		eye[i] = v.head<3>();
+		clip[i] = this->projection * v;
+	}
+
+	// Clip against the near plane, z >= -w in clip coordinates. This also
+	// removes everything behind the viewer.
+	Eigen::Vector4d clipped[4];
+	int n = 0;
+	for (int i = 0; i < 3; i++) {
+		const auto &a = clip[i], &b = clip[(i + 1) % 3];
+		double da = a[2] + a[3], db = b[2] + b[3];
+		if (da >= 0) clipped[n++] = a;
+		if ((da >= 0) != (db >= 0)) clipped[n++] = a + (b - a) * (da / (da - db));
+	}
+	if (n < 3) return;
+
+	Vector3f v[4];
+	for (int i = 0; i < n; i++) {
+		const auto &c = clipped[i];
+		if (c[3] <= 0) return;
+		v[i] << float((c[0] / c[3] + 1) / 2 * this->width),
+			float((c[1] / c[3] + 1) / 2 * this->height),
+			float(c[2] / c[3]);
+	}
+
+	// Clipping keeps the winding, so the whole polygon shows the same side
+	float area = 0;
+	for (int i = 0; i < n; i++) {
+		const auto &a = v[i], &b = v[(i + 1) % n];
+		area += a[0] * b[1] - b[0] * a[1];
+	}
+	if (area == 0) return;
+
+	// The lights are at (-1,-1,1) and (1,1,-1) in eye space, at full diffuse
+	// intensity, over the default ambient light of 0.2
+	float light = 1;
+	if (face.lit) {
+		Vector3d n = (eye[1] - eye[0]).cross(eye[2] - eye[0]);
+		double len = n.norm();
+		light = 0.2f + (len > 0 ? float(std::abs(n.dot(Vector3d(-1, -1, 1).normalized())) / len) : 0);
+	}
+	auto rgba = packColor(area > 0 ? face.front : face.back, light);
+	for (int i = 2; i < n; i++) triangles.push_back(Triangle{{v[0], v[i - 1], v[i]}, rgba});
+}
+
+void SoftwareRasterizer::render(const Color4f &background)
+{
+	this->color.assign(size_t(this->width) * this->height, packColor(background, 1));
+	this->depth.assign(size_t(this->width) * this->height, 1.0f);
+
+	this->triangles.clear();
+	this->triangles.reserve(this->faces.size());
+	for (const auto &face : this->faces) project(face, this->triangles);
+
+	// Bin the triangles into tiles, keeping their order within each tile
+	int tilesx = (this->width + TILE_SIZE - 1) / TILE_SIZE;
+	int tilesy = (this->height + TILE_SIZE - 1) / TILE_SIZE;
+	std::vector<std::vector<size_t>> tiles(tilesx * tilesy);
+	for (size_t i = 0; i < this->triangles.size(); i++) {
+		const auto &t = this->triangles[i];
+		float xmin = std::min({t.v[0][0], t.v[1][0], t.v[2][0]});
+		float xmax = std::max({t.v[0][0], t.v[1][0], t.v[2][0]});
+		float ymin = std::min({t.v[0][1], t.v[1][1], t.v[2][1]});
+		float ymax = std::max({t.v[0][1], t.v[1][1], t.v[2][1]});
+		if (xmax < 0 || ymax < 0 || xmin >= this->width || ymin >= this->height) continue;
+		int tx0 = int(std::max(xmin, 0.0f)) / TILE_SIZE, tx1 = std::min(tilesx - 1, int(std::min(xmax, float(this->width))) / TILE_SIZE);
+		int ty0 = int(std::max(ymin, 0.0f)) / TILE_SIZE, ty1 = std::min(tilesy - 1, int(std::min(ymax, float(this->height))) / TILE_SIZE);
+		for (int ty = ty0; ty <= ty1; ty++) {
+			for (int tx = tx0; tx <= tx1; tx++) tiles[ty * tilesx + tx].push_back(i);
+		}
+	}
+
+	parallel_for(tiles.size(), 1, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			int x0 = int(i % tilesx) * TILE_SIZE, y0 = int(i / tilesx) * TILE_SIZE;
+			renderTile(tiles[i], x0, y0, std::min(x0 + TILE_SIZE, int(this->width)), std::min(y0 + TILE_SIZE, int(this->height)));
+		}
+	});
+}
+
+void SoftwareRasterizer::renderTile(const std::vector<size_t> &triangles, int x0, int y0, int x1, int y1)
+{
+	for (auto i : triangles) {
+		const auto &t = this->triangles[i];
+		const Vector3f *v[3] = {&t.v[0], &t.v[1], &t.v[2]};
+		float area = ((*v[1])[0] - (*v[0])[0]) * ((*v[2])[1] - (*v[0])[1]) -
+			((*v[2])[0] - (*v[0])[0]) * ((*v[1])[1] - (*v[0])[1]);
+		if (area == 0) continue;
+		if (area < 0) {
+			std::swap(v[1], v[2]);
+			area = -area;
+		}
+
+		// Clamp in floating point, vertices far outside the image don't fit an int
+		int xmin = int(std::floor(std::max(std::min({(*v[0])[0], (*v[1])[0], (*v[2])[0]}), float(x0))));
+		int xmax = int(std::min(std::max({(*v[0])[0], (*v[1])[0], (*v[2])[0]}), float(x1 - 1)));
+		int ymin = int(std::floor(std::max(std::min({(*v[0])[1], (*v[1])[1], (*v[2])[1]}), float(y0))));
+		int ymax = int(std::min(std::max({(*v[0])[1], (*v[1])[1], (*v[2])[1]}), float(y1 - 1)));
+
+		for (int y = ymin; y <= ymax; y++) {
+			float py = y + 0.5f;
+			for (int x = xmin; x <= xmax; x++) {
+				float px = x + 0.5f;
+				float w[3];
+				for (int k = 0; k < 3; k++) {
+					const Vector3f &a = *v[(k + 1) % 3], &b = *v[(k + 2) % 3];
+					w[k] = (b[0] - a[0]) * (py - a[1]) - (b[1] - a[1]) * (px - a[0]);
+				}
+				if (w[0] < 0 || w[1] < 0 || w[2] < 0) continue;
+				float z = (w[0] * (*v[0])[2] + w[1] * (*v[1])[2] + w[2] * (*v[2])[2]) / area;
+				if (z < -1) continue;
+				size_t idx = size_t(y) * this->width + x;
+				if (z < this->depth[idx]) {
+					this->depth[idx] = z;
+					this->color[idx] = t.rgba;
+				}
+			}
+		}
+	}
+}
+
+bool SoftwareRasterizer::save(std::ostream &output) const
+{
+	// Images are stored bottom-up, PNG rows go top-down
+	std::vector<unsigned char> pixels(this->color.size() * 4);
+	for (unsigned int y = 0; y < this->height; y++) {
+		const uint32_t *row = &this->color[size_t(this->height - 1 - y) * this->width];
+		unsigned char *out = &pixels[size_t(y) * this->width * 4];
+		for (unsigned int x = 0; x < this->width; x++) {
+			for (int c = 0; c < 4; c++) *out++ = (row[x] >> (8 * c)) & 0xff;
+		}
+	}
+	return write_png(output, pixels.data(), this->width, this->height);
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "linalg.h"
+#include "Camera.h"
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+class PolySet;
+
+/*!
+	Renders triangle meshes into an image on the CPU, for exporting images
+	without an OpenGL context.
+
+	Faces are kept in world coordinates, so the same scene can be rendered from
+	several cameras. render() projects and shades them, using the same camera
+	setup and the same two directional lights as GLView, with one color per
+	face. It then rasterizes them with a depth buffer, splitting the image into
+	tiles which are rendered in parallel.
+*/
+class SoftwareRasterizer
+{
+public:
+	SoftwareRasterizer(unsigned int width, unsigned int height);
+
+	void setCamera(const Camera &cam);
+
+	/*!
+		Adds the faces of ps, transformed by m. Faces which are wound counter
+		clockwise on screen get the front color, the others the back color.
+		2D PolySets are drawn flat at z=0. Unlit faces keep their color
+		regardless of their orientation.
+	*/
+	void addPolySet(const PolySet &ps, const Transform3d &m,
+									const Color4f &front, const Color4f &back, bool lit = true);
+
+	void render(const Color4f &background);
+	bool save(std::ostream &output) const;
+
+private:
+	struct Face {
+		Vector3d v[3]; // world coordinates
+		Color4f front, back;
+		bool lit;
+	};
+	struct Triangle {
+		Vector3f v[3]; // window coordinates and depth
+		uint32_t rgba; // shaded color of the visible side
+	};
+
+	void project(const Face &face, std::vector<Triangle> &triangles) const;
+	void renderTile(const std::vector<size_t> &triangles, int x0, int y0, int x1, int y1);
+
+	unsigned int width, height;
+	Eigen::Matrix4d projection, modelview;
+	std::vector<Face> faces;
+	std::vector<Triangle> triangles;
+	std::vector<uint32_t> color;
+	std::vector<float> depth;
+};
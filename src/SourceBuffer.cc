@@ -0,0 +1,79 @@
+#include "SourceBuffer.h"
+
+#include <ctime>
+#include <fstream>
+#include <sstream>
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+namespace fs = boost::filesystem;
+namespace bip = boost::interprocess;
+
+SourceBuffer::SourceBuffer()
+{
+	assign(std::string());
+}
+
+SourceBuffer::SourceBuffer(std::string &&text)
+{
+	assign(std::move(text));
+}
+
+SourceBuffer::SourceBuffer(char *text, size_t size) : begin(text), len(size)
+{
+}
+
+SourceBuffer::~SourceBuffer()
+{
+}
+
+void SourceBuffer::assign(std::string &&text)
+{
+	this->region.reset();
+	this->text = std::move(text);
+	this->len = this->text.size();
+	this->text.append(2, '\0');
+	this->begin = &this->text[0];
+}
+
+// Smaller files are read, mapping them isn't faster
+static const uintmax_t MIN_MAPPED_SIZE = 256 * 1024;
+// Files modified less than this many seconds ago are read, since they may
+// still be being written
+static const std::time_t MIN_MAPPED_AGE = 10;
+
+bool SourceBuffer::load(const std::string &filename)
+{
+	// The bytes between the end of the file and the end of its last page read
+	// as zero. If there are at least two of them, they terminate the text and
+	// the file can be scanned without copying it.
+	try {
+		auto size = fs::file_size(filename);
+		auto pagesize = bip::mapped_region::get_page_size();
+		auto slack = (pagesize - size % pagesize) % pagesize;
+		auto age = std::time(nullptr) - fs::last_write_time(filename);
+		if (size >= MIN_MAPPED_SIZE && slack >= 2 && age >= MIN_MAPPED_AGE) {
+			bip::file_mapping mapping(filename.c_str(), bip::read_only);
+			std::unique_ptr<bip::mapped_region> region(new bip::mapped_region(mapping, bip::copy_on_write, 0, size + 2));
+			this->text.clear();
+			this->region = std::move(region);
+			this->begin = static_cast<char *>(this->region->get_address());
+			this->len = size;
+			return true;
+		}
+	}
+	catch (const fs::filesystem_error &) {
+		return false;
+	}
+	catch (const bip::interprocess_exception &) {
+		// Fall back to reading the file, e.g. where files can't be mapped beyond their end
+	}
+
+	std::ifstream ifs(filename.c_str(), std::ios::binary);
+	if (!ifs.is_open()) return false;
+	std::stringstream textbuf;
+	textbuf << ifs.rdbuf();
+	assign(textbuf.str());
+	return true;
+}
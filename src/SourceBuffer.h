@@ -0,0 +1,47 @@
+#pragma once
+
+#include <string>
+#include <memory>
+
+namespace boost { namespace interprocess { class mapped_region; } }
+
+/*!
+	Source text in the form the lexer scans it in place: followed by two NUL
+	bytes, and writable, since flex temporarily modifies the text while
+	scanning.
+
+	Large files are memory mapped copy-on-write where possible, so only the
+	pages the lexer writes to are copied. Small files, and files which were
+	modified just now and may still be being written, e.g. by an editor
+	saving them, are read instead, since a mapped file which is truncated
+	while it's being scanned crashes the process. Text given as a string is
+	taken over without copying.
+*/
+class SourceBuffer
+{
+public:
+	SourceBuffer();
+	explicit SourceBuffer(std::string &&text);
+	// Scans text owned by the caller, which must be writable, followed by
+	// two NUL bytes and outlive the buffer
+	SourceBuffer(char *text, size_t size);
+	SourceBuffer(const SourceBuffer &) = delete;
+	SourceBuffer &operator=(const SourceBuffer &) = delete;
+	~SourceBuffer();
+
+	// Maps or reads the file. Returns false if the file can't be read.
+	bool load(const std::string &filename);
+
+	char *data() { return this->begin; }
+	const char *data() const { return this->begin; }
+	// Size of the text, not counting the terminating NUL bytes
+	size_t size() const { return this->len; }
+
+private:
+	void assign(std::string &&text);
+
+	std::unique_ptr<boost::interprocess::mapped_region> region;
+	std::string text;
+	char *begin;
+	size_t len;
+};
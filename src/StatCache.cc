@@ -31,6 +31,7 @@
 #include <sys/timeb.h>
 #include <string>
 #include <unordered_map>
+#include <mutex>
 
 const float stale = 0.190;  // Maximum lifetime of a cache entry chosen to be shorter than the automatic reload poll time
 
@@ -49,9 +50,11 @@ struct CacheEntry {
 typedef std::unordered_map<std::string, CacheEntry> StatMap;
 
 static StatMap statMap;
+static std::mutex statMutex;
 
 int StatCache::stat(const char *path, struct stat *st)
 {
+	std::lock_guard<std::mutex> lock(statMutex);
 	auto iter = statMap.find(path);
 	if (iter != statMap.end()) {                      // Have we got an entry for this file?
 		if (ms_clock() - iter->second.timestamp < stale) {
@@ -0,0 +1,156 @@
+#include "ValueIndex.h"
+
+#include <cmath>
+#include <algorithm>
+#include <glib.h>
+
+// Number of queries after which the corresponding part of the index is built
+static const unsigned int queries_before_indexing = 2;
+
+// -0 and 0 compare equal and must hash to the same bucket
+static double normalized_key(double d)
+{
+	return d == 0 ? 0.0 : d;
+}
+
+static void add_key(std::unordered_map<double, ValueIndex::Matches> &numbers,
+										std::unordered_map<std::string, ValueIndex::Matches> &strings,
+										const Value &key, uint32_t idx)
+{
+	if (key.type() == Value::ValueType::NUMBER) {
+		double d = key.toDouble();
+		if (!std::isnan(d)) numbers[normalized_key(d)].push_back(idx);
+	}
+	else if (key.type() == Value::ValueType::STRING) {
+		strings[key.toString()].push_back(idx);
+	}
+}
+
+void ValueIndex::buildColumn(Column &column, const Value::VectorType &vec, unsigned int col)
+{
+	for (size_t j = 0; j < vec.size(); j++) {
+		const Value &entry = *vec[j];
+		if (col == 0 && entry.type() != Value::ValueType::VECTOR) {
+			add_key(column.numbers, column.strings, entry, j);
+		}
+		else {
+			const Value::VectorType &entryVec = entry.toVector();
+			if (col < entryVec.size()) add_key(column.numbers, column.strings, *entryVec[col], j);
+		}
+	}
+	column.built = true;
+}
+
+const ValueIndex::Matches *ValueIndex::find(const Value::VectorType &vec, unsigned int col, const Value &key)
+{
+	static const Matches none;
+
+	if (vec.size() < MIN_INDEXED_SIZE) return nullptr;
+	if (key.type() != Value::ValueType::NUMBER && key.type() != Value::ValueType::STRING) return nullptr;
+
+	Column &column = this->columns[col];
+	if (!column.built) {
+		if (++column.queries < queries_before_indexing) return nullptr;
+		buildColumn(column, vec, col);
+	}
+
+	if (key.type() == Value::ValueType::NUMBER) {
+		double d = key.toDouble();
+		if (std::isnan(d)) return &none;
+		auto it = column.numbers.find(normalized_key(d));
+		return it == column.numbers.end() ? &none : &it->second;
+	}
+	auto it = column.strings.find(key.toString());
+	return it == column.strings.end() ? &none : &it->second;
+}
+
+void ValueIndex::buildCharColumn(CharColumn &column, const Value::VectorType &vec, unsigned int col)
+{
+	for (size_t j = 0; j < vec.size(); j++) {
+		const Value::VectorType &entryVec = vec[j]->toVector();
+		if (entryVec.size() <= col) {
+			column.valid = false;
+			column.chars.clear();
+			break;
+		}
+		std::string str = entryVec[col]->toString();
+		column.chars[g_utf8_get_char(str.c_str())].push_back(j);
+	}
+	column.built = true;
+}
+
+const ValueIndex::Matches *ValueIndex::findFirstChar(const Value::VectorType &vec, unsigned int col, uint32_t c)
+{
+	static const Matches none;
+
+	if (vec.size() < MIN_INDEXED_SIZE) return nullptr;
+
+	CharColumn &column = this->charColumns[col];
+	if (!column.built) {
+		if (++column.queries < queries_before_indexing) return nullptr;
+		buildCharColumn(column, vec, col);
+	}
+	if (!column.valid) return nullptr;
+
+	auto it = column.chars.find(c);
+	return it == column.chars.end() ? &none : &it->second;
+}
+
+void ValueIndex::buildInterpolation(const Value::VectorType &vec)
+{
+	auto &points = this->interpolation.points;
+	for (const auto &entry : vec) {
+		double p, v;
+		if (entry->getVec2(p, v) && !std::isnan(p)) points.emplace_back(p, v);
+	}
+	// Stable, so the earliest of several entries with the same key comes first
+	std::stable_sort(points.begin(), points.end(),
+									 [](const std::pair<double, double> &a, const std::pair<double, double> &b) {
+										 return a.first < b.first;
+									 });
+	this->interpolation.built = true;
+}
+
+/*!
+	Same result as the linear scan in builtin_lookup(): the lower point is the
+	first entry with the largest key <= p, the upper point the first entry with
+	the smallest key >= p. If there is no such entry, the first entry is used.
+ */
+bool ValueIndex::lookup(const Value::VectorType &vec, double p, double &result)
+{
+	if (vec.size() < MIN_INDEXED_SIZE || std::isnan(p)) return false;
+
+	double first_p, first_v;
+	if (!vec[0]->getVec2(first_p, first_v) || std::isnan(first_p)) return false;
+
+	if (!this->interpolation.built) {
+		if (++this->interpolation.queries < queries_before_indexing) return false;
+		buildInterpolation(vec);
+	}
+
+	typedef std::pair<double, double> Point;
+	const auto &points = this->interpolation.points;
+	auto key_less = [](const Point &a, double b) { return a.first < b; };
+	auto less_key = [](double a, const Point &b) { return a < b.first; };
+
+	double low_p = first_p, low_v = first_v, high_p = first_p, high_v = first_v;
+	auto above = std::upper_bound(points.begin(), points.end(), p, less_key);
+	if (above != points.begin()) {
+		auto low = std::lower_bound(points.begin(), above, std::prev(above)->first, key_less);
+		low_p = low->first;
+		low_v = low->second;
+	}
+	auto high = std::lower_bound(points.begin(), points.end(), p, key_less);
+	if (high != points.end()) {
+		high_p = high->first;
+		high_v = high->second;
+	}
+
+	if (p <= low_p) result = high_v;
+	else if (p >= high_p) result = low_v;
+	else {
+		double f = (p-low_p) / (high_p-low_p);
+		result = high_v * f + low_v * (1-f);
+	}
+	return true;
+}
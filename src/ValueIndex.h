@@ -0,0 +1,76 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include "value.h"
+
+/*!
+	Lookup index over the elements of a vector Value.
+
+	Values are immutable once they are wrapped in a ValuePtr, so an index built
+	over a vector stays valid for as long as the vector itself is alive. The
+	index is owned by the vector storage (see Value::VectorType::getIndex()),
+	and is used by search() and lookup() to answer repeated queries against
+	the same table in constant or logarithmic time instead of scanning it
+	every time.
+
+	Each part of the index is built lazily on the second query that needs it,
+	so tables which are only queried once don't pay for building it.
+	All query functions take the vector the index belongs to, and return false
+	or nullptr if the caller should fall back to a linear scan.
+*/
+class ValueIndex
+{
+public:
+	typedef std::vector<uint32_t> Matches;
+
+	// Tables smaller than this are always scanned linearly
+	static const size_t MIN_INDEXED_SIZE = 16;
+
+	ValueIndex() {}
+
+	// Indices of the entries e where e == key (column 0 only) or e[col] == key,
+	// in table order. Only number and string keys are indexed.
+	const Matches *find(const Value::VectorType &vec, unsigned int col, const Value &key);
+	// Indices of the entries e where the first unicode character of
+	// e[col].toString() is c, in table order. Returns nullptr if some entry
+	// has no column col, since search() has to report that.
+	const Matches *findFirstChar(const Value::VectorType &vec, unsigned int col, uint32_t c);
+	// Interpolates the [key, value] pairs in vec at p, see builtin_lookup()
+	bool lookup(const Value::VectorType &vec, double p, double &result);
+
+private:
+	struct Column {
+		Column() : queries(0), built(false) {}
+		unsigned int queries;
+		bool built;
+		std::unordered_map<double, Matches> numbers;
+		std::unordered_map<std::string, Matches> strings;
+	};
+
+	struct CharColumn {
+		CharColumn() : queries(0), built(false), valid(true) {}
+		unsigned int queries;
+		bool built;
+		bool valid;
+		std::unordered_map<uint32_t, Matches> chars;
+	};
+
+	struct Interpolation {
+		Interpolation() : queries(0), built(false) {}
+		unsigned int queries;
+		bool built;
+		// Valid [key, value] pairs sorted by (key, table index)
+		std::vector<std::pair<double, double>> points;
+	};
+
+	void buildColumn(Column &column, const Value::VectorType &vec, unsigned int col);
+	void buildCharColumn(CharColumn &column, const Value::VectorType &vec, unsigned int col);
+	void buildInterpolation(const Value::VectorType &vec);
+
+	std::unordered_map<unsigned int, Column> columns;
+	std::unordered_map<unsigned int, CharColumn> charColumns;
+	Interpolation interpolation;
+};
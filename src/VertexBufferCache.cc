@@ -0,0 +1,204 @@
+#include "VertexBufferCache.h"
+#include "polyset.h"
+#include "printutils.h"
+#include <vector>
+
+VertexBufferCache *VertexBufferCache::curr = nullptr;
+
+#ifndef NULLGL
+
+namespace {
+
+struct Vertex {
+	GLfloat position[3];
+	GLfloat normal[3];
+};
+
+// The attributes of the OpenCSG edge shader, see GLView::enable_opencsg_shaders()
+struct ShaderVertex {
+	GLfloat position[3];
+	GLfloat normal[3];
+	GLfloat edges[3];
+	GLfloat p1[3];
+	GLfloat p2[3];
+	GLfloat barycentric[3];
+};
+
+void set(GLfloat *out, const Vector3d &v, double z = 0)
+{
+	out[0] = GLfloat(v[0]);
+	out[1] = GLfloat(v[1]);
+	out[2] = GLfloat(v[2] + z);
+}
+
+// Same as gl_draw_triangle() in polyset-gl.cc
+Vector3d normal(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2)
+{
+	return (p1 - p0).cross(p1 - p2).normalized();
+}
+
+template <typename T> GLuint upload(const std::vector<T> &data)
+{
+	GLuint vbo;
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(T), data.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return vbo;
+}
+
+} // namespace
+
+const VertexBufferCache::Entry *VertexBufferCache::lookup(const shared_ptr<const PolySet> &ps, BufferType type,
+																												 Renderer::csgmode_e csgmode)
+{
+	// Only the slabs of 2D objects depend on the mode
+	int mode = 0;
+	if (ps->getDimension() == 2) {
+		mode = type == BufferType::EDGES && csgmode == Renderer::CSGMODE_NONE ? -1 : (csgmode & CSGMODE_DIFFERENCE_FLAG);
+	}
+	Key key(ps.get(), type, mode);
+	auto it = this->entries.find(key);
+	if (it != this->entries.end()) {
+		// A live weak pointer means the address hasn't been reused
+		if (!it->second.ps.expired()) return &it->second;
+		glDeleteBuffers(1, &it->second.vbo);
+		this->entries.erase(it);
+	}
+
+	Entry entry;
+	entry.ps = ps;
+	if (type == BufferType::SURFACE) {
+		std::vector<Vertex> vertices;
+		ps->visit_surface(csgmode, [&](const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
+																	 bool, bool, bool, double z) {
+			Vertex v;
+			set(v.normal, normal(p0, p1, p2));
+			for (const auto p : {&p0, &p1, &p2}) {
+				set(v.position, *p, z);
+				vertices.push_back(v);
+			}
+		});
+		entry.vbo = upload(vertices);
+		entry.count = vertices.size();
+	}
+	else if (type == BufferType::SURFACE_SHADER) {
+		std::vector<ShaderVertex> vertices;
+		ps->visit_surface(csgmode, [&](const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
+																	 bool e0, bool e1, bool e2, double z) {
+			const Vector3d *p[3] = {&p0, &p1, &p2};
+			ShaderVertex v;
+			set(v.normal, normal(p0, p1, p2));
+			set(v.edges, Vector3d(e0 ? 2.0 : -1.0, e1 ? 2.0 : -1.0, e2 ? 2.0 : -1.0));
+			// Each vertex gets the other two, and its barycentric coordinates
+			// in the order the edge shader expects them
+			for (int i = 0; i < 3; i++) {
+				set(v.position, *p[i], z);
+				set(v.p1, *p[i == 0 ? 1 : 0], z);
+				set(v.p2, *p[i == 2 ? 1 : 2], z);
+				set(v.barycentric, Vector3d(i == 2, i == 0, i == 1));
+				vertices.push_back(v);
+			}
+		});
+		entry.vbo = upload(vertices);
+		entry.count = vertices.size();
+	}
+	else {
+		std::vector<GLfloat> vertices;
+		ps->visit_edges(csgmode, [&](const Vector3d &p0, const Vector3d &p1) {
+			for (const auto p : {&p0, &p1}) {
+				for (int i = 0; i < 3; i++) vertices.push_back(GLfloat((*p)[i]));
+			}
+		});
+		entry.vbo = upload(vertices);
+		entry.count = vertices.size() / 3;
+	}
+	return &(this->entries[key] = entry);
+}
+
+bool VertexBufferCache::drawSurface(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode,
+																		const Transform3d &m, GLint *shaderinfo)
+{
+	if (!GLEW_VERSION_1_5) return false;
+#ifndef ENABLE_OPENCSG
+	shaderinfo = nullptr;
+#endif
+	auto entry = lookup(ps, shaderinfo ? BufferType::SURFACE_SHADER : BufferType::SURFACE, csgmode);
+	if (!entry->count) return true;
+
+	// Mirrored triangles are drawn in reverse order by PolySet::render_surface()
+	bool mirrored = m.matrix().determinant() < 0;
+	if (mirrored) glFrontFace(GL_CW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, entry->vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+#ifdef ENABLE_OPENCSG
+	if (shaderinfo) {
+		glUniform1f(shaderinfo[7], shaderinfo[9]);
+		glUniform1f(shaderinfo[8], shaderinfo[10]);
+		GLsizei stride = sizeof(ShaderVertex);
+		glVertexPointer(3, GL_FLOAT, stride, reinterpret_cast<void *>(offsetof(ShaderVertex, position)));
+		glNormalPointer(GL_FLOAT, stride, reinterpret_cast<void *>(offsetof(ShaderVertex, normal)));
+		const size_t offsets[] = {offsetof(ShaderVertex, edges), offsetof(ShaderVertex, p1),
+															offsetof(ShaderVertex, p2), offsetof(ShaderVertex, barycentric)};
+		for (int i = 0; i < 4; i++) {
+			glEnableVertexAttribArray(shaderinfo[3 + i]);
+			glVertexAttribPointer(shaderinfo[3 + i], 3, GL_FLOAT, GL_FALSE, stride, reinterpret_cast<void *>(offsets[i]));
+		}
+		glDrawArrays(GL_TRIANGLES, 0, GLsizei(entry->count));
+		for (int i = 0; i < 4; i++) glDisableVertexAttribArray(shaderinfo[3 + i]);
+	}
+	else
+#endif
+	{
+		GLsizei stride = sizeof(Vertex);
+		glVertexPointer(3, GL_FLOAT, stride, reinterpret_cast<void *>(offsetof(Vertex, position)));
+		glNormalPointer(GL_FLOAT, stride, reinterpret_cast<void *>(offsetof(Vertex, normal)));
+		glDrawArrays(GL_TRIANGLES, 0, GLsizei(entry->count));
+	}
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	if (mirrored) glFrontFace(GL_CCW);
+	return true;
+}
+
+bool VertexBufferCache::drawEdges(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode)
+{
+	if (!GLEW_VERSION_1_5) return false;
+	auto entry = lookup(ps, BufferType::EDGES, csgmode);
+
+	glDisable(GL_LIGHTING);
+	glBindBuffer(GL_ARRAY_BUFFER, entry->vbo);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 0, nullptr);
+	glDrawArrays(GL_LINES, 0, GLsizei(entry->count));
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glEnable(GL_LIGHTING);
+	return true;
+}
+
+void VertexBufferCache::collect()
+{
+	for (auto it = this->entries.begin(); it != this->entries.end();) {
+		if (it->second.ps.expired()) {
+			glDeleteBuffers(1, &it->second.vbo);
+			it = this->entries.erase(it);
+		}
+		else {
+			++it;
+		}
+	}
+}
+
+#else // NULLGL
+
+bool VertexBufferCache::drawSurface(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode,
+																		const Transform3d &m, GLint *shaderinfo) { return false; }
+bool VertexBufferCache::drawEdges(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode) { return false; }
+void VertexBufferCache::collect() {}
+
+#endif // NULLGL
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "system-gl.h"
+#include "renderer.h"
+#include "memory.h"
+#include <cstdint>
+#include <map>
+#include <tuple>
+
+class PolySet;
+
+/*!
+	Keeps the triangles and edges of PolySets in OpenGL vertex buffers, so
+	repaints only need one draw call per object.
+
+	Buffers are built on first use from the same triangles PolySet draws in
+	immediate mode, and are keyed by the identity of the PolySet. Each entry
+	holds a weak pointer to its PolySet; buffers of PolySets which no longer
+	exist are released by collect(). Mirroring transforms are handled by
+	flipping the front face instead of building another buffer.
+
+	Buffer names belong to a GL context, so each GLView owns a cache, which it
+	makes current while painting.
+*/
+class VertexBufferCache
+{
+public:
+	VertexBufferCache() {}
+
+	static VertexBufferCache *current() { return curr; }
+	static void setCurrent(VertexBufferCache *cache) { curr = cache; }
+
+	// Return false if vertex buffers aren't supported, the caller should draw
+	// in immediate mode then
+	bool drawSurface(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode,
+									 const Transform3d &m, GLint *shaderinfo);
+	bool drawEdges(const shared_ptr<const PolySet> &ps, Renderer::csgmode_e csgmode);
+
+	// Releases the buffers of PolySets which have been deleted, needs the
+	// context of the cache to be current
+	void collect();
+
+private:
+	VertexBufferCache(const VertexBufferCache &) = delete;
+	VertexBufferCache &operator=(const VertexBufferCache &) = delete;
+
+	enum class BufferType : uint8_t { SURFACE, SURFACE_SHADER, EDGES };
+	typedef std::tuple<const PolySet *, BufferType, int> Key;
+
+	struct Entry {
+		std::weak_ptr<const PolySet> ps;
+		GLuint vbo;
+		size_t count;
+	};
+
+	const Entry *lookup(const shared_ptr<const PolySet> &ps, BufferType type, Renderer::csgmode_e csgmode);
+
+	static VertexBufferCache *curr;
+	std::map<Key, Entry> entries;
+};
@@ -0,0 +1,122 @@
+#include "VertexWelder.h"
+
+static inline size_t hash_key(int64_t x, int64_t y, int64_t z)
+{
+	uint64_t h = uint64_t(x) * 0x9E3779B97F4A7C15ULL;
+	h ^= uint64_t(y) * 0xC2B2AE3D27D4EB4FULL;
+	h ^= uint64_t(z) * 0x165667B19E3779F9ULL;
+	h ^= h >> 29;
+	h ^= h >> 32;
+	return size_t(h);
+}
+
+VertexWelder::VertexWelder(double resolution, size_t expected) : res(resolution), count(0)
+{
+	size_t numslots = 16;
+	while (numslots < 2 * expected) numslots *= 2;
+	rehash(numslots);
+}
+
+const VertexWelder::Slot *VertexWelder::find(int64_t x, int64_t y, int64_t z) const
+{
+	size_t mask = this->slots.size() - 1;
+	for (size_t i = hash_key(x, y, z) & mask;; i = (i + 1) & mask) {
+		const Slot &slot = this->slots[i];
+		if (slot.index < 0) return nullptr;
+		if (slot.key[0] == x && slot.key[1] == y && slot.key[2] == z) return &slot;
+	}
+}
+
+void VertexWelder::insert(int64_t x, int64_t y, int64_t z, int index)
+{
+	// Keep the load factor at most 1/2, so probe sequences stay short
+	if (2 * (this->count + 1) > this->slots.size()) rehash(2 * this->slots.size());
+
+	size_t mask = this->slots.size() - 1;
+	size_t i = hash_key(x, y, z) & mask;
+	while (this->slots[i].index >= 0) i = (i + 1) & mask;
+	this->slots[i] = {{x, y, z}, index};
+	markBlock(x, y, z);
+	this->count++;
+}
+
+void VertexWelder::rehash(size_t numslots)
+{
+	std::vector<Slot> old;
+	old.swap(this->slots);
+	this->slots.assign(numslots, Slot{{0, 0, 0}, -1});
+	// 32 bits per slot, so with the load factor at most 1/2, no more than one
+	// in 64 bits is set
+	this->blocks.assign(numslots / 2, 0);
+
+	size_t mask = numslots - 1;
+	for (const auto &slot : old) {
+		if (slot.index < 0) continue;
+		size_t i = hash_key(slot.key[0], slot.key[1], slot.key[2]) & mask;
+		while (this->slots[i].index >= 0) i = (i + 1) & mask;
+		this->slots[i] = slot;
+		markBlock(slot.key[0], slot.key[1], slot.key[2]);
+	}
+}
+
+bool VertexWelder::blockOccupied(int64_t bx, int64_t by, int64_t bz) const
+{
+	size_t bit = hash_key(bx, by, bz) & (64 * this->blocks.size() - 1);
+	return this->blocks[bit / 64] & (uint64_t(1) << (bit % 64));
+}
+
+void VertexWelder::markBlock(int64_t x, int64_t y, int64_t z)
+{
+	size_t bit = hash_key(x >> 2, y >> 2, z >> 2) & (64 * this->blocks.size() - 1);
+	this->blocks[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+int VertexWelder::align(Vector3d &v)
+{
+	int64_t key[3] = {int64_t(v[0] / this->res), int64_t(v[1] / this->res), int64_t(v[2] / this->res)};
+
+	const Slot *slot = find(key[0], key[1], key[2]);
+	if (!slot) {
+		// Only probe the neighbouring cells if a block they are in is occupied
+		bool probe = false;
+		for (int64_t bx = (key[0] - 1) >> 2; !probe && bx <= (key[0] + 1) >> 2; bx++) {
+			for (int64_t by = (key[1] - 1) >> 2; !probe && by <= (key[1] + 1) >> 2; by++) {
+				for (int64_t bz = (key[2] - 1) >> 2; !probe && bz <= (key[2] + 1) >> 2; bz++) {
+					probe = blockOccupied(bx, by, bz);
+				}
+			}
+		}
+		if (probe) {
+			// Use the closest neighbour, the first one found if several are equally close
+			int64_t dist = 4; // > max possible squared distance
+			for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++) {
+				for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
+					for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
+						const Slot *s = find(jx, jy, jz);
+						if (!s) continue;
+						int64_t d = (jx - key[0]) * (jx - key[0]) + (jy - key[1]) * (jy - key[1]) + (jz - key[2]) * (jz - key[2]);
+						if (d < dist) {
+							dist = d;
+							slot = s;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	int index;
+	if (slot) {
+		index = slot->index;
+		for (int i = 0; i < 3; i++) key[i] = slot->key[i];
+	}
+	else {
+		index = int(this->count);
+		insert(key[0], key[1], key[2], index);
+	}
+
+	v[0] = key[0] * this->res;
+	v[1] = key[1] * this->res;
+	v[2] = key[2] * this->res;
+	return index;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "linalg.h"
+#include <cstdint>
+#include <vector>
+
+/*!
+	Welds vertices to a grid, merging vertices which are closer than about one
+	grid cell.
+
+	A vertex is snapped to the grid cell containing it. If that cell is empty but
+	one of its 26 neighbours already holds a vertex, the vertex is snapped to the
+	closest such neighbour instead. Each distinct cell gets an index, counting
+	from 0 in order of insertion.
+
+	The cells are kept in a flat open addressing hash table. An occupancy bitmap
+	of 4x4x4 cell blocks lets most new vertices skip probing their neighbours.
+*/
+class VertexWelder
+{
+public:
+	VertexWelder(double resolution, size_t expected = 0);
+
+	// Aligns v to the grid and returns the index of its cell
+	int align(Vector3d &v);
+	size_t size() const { return this->count; }
+
+private:
+	struct Slot {
+		int64_t key[3];
+		int index; // -1 for an empty slot
+	};
+
+	const Slot *find(int64_t x, int64_t y, int64_t z) const;
+	void insert(int64_t x, int64_t y, int64_t z, int index);
+	void rehash(size_t numslots);
+	bool blockOccupied(int64_t bx, int64_t by, int64_t bz) const;
+	void markBlock(int64_t x, int64_t y, int64_t z);
+
+	double res;
+	std::vector<Slot> slots;
+	std::vector<uint64_t> blocks;
+	size_t count;
+};
@@ -41,10 +41,16 @@ typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_ExactKernel2;
 typedef CGAL::Polygon_2<CGAL_ExactKernel2> CGAL_Poly2;
 typedef CGAL::Polygon_with_holes_2<CGAL_ExactKernel2> CGAL_Poly2h;
 
+#ifdef USE_LAZY_KERNEL
+// Lazy exact kernel: predicates are evaluated on double intervals first and
+// only fall back to exact rationals if the interval result is ambiguous.
+// Selected at build time, see LAZY_KERNEL in CMakeLists.txt.
+typedef CGAL::Exact_predicates_exact_constructions_kernel::FT NT3;
+typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_Kernel3;
+#else
 typedef CGAL::Gmpq NT3;
 typedef CGAL::Cartesian<NT3> CGAL_Kernel3;
-//typedef CGAL::Exact_predicates_exact_constructions_kernel::FT NT3;
-//typedef CGAL::Exact_predicates_exact_constructions_kernel CGAL_Kernel3;
+#endif
 typedef CGAL::Nef_polyhedron_3<CGAL_Kernel3> CGAL_Nef_polyhedron3;
 typedef CGAL_Nef_polyhedron3::Aff_transformation_3 CGAL_Aff_transformation;
 
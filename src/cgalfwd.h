@@ -19,11 +19,16 @@ typedef CGAL::Nef_polyhedron_2<CGAL_Kernel2, CGAL::HDS_items, bool> CGAL_Nef_pol
 	
 namespace CGAL { 
 	template <class T> class Cartesian;
+	class Epeck;
 	template<class T> struct Default_items;
 	class SNC_indexed_items;
 	template <typename Kernel_, typename Items_, typename Mark_> class Nef_polyhedron_3;
 }
+#ifdef USE_LAZY_KERNEL
+typedef CGAL::Epeck CGAL_Kernel3;
+#else
 typedef CGAL::Cartesian<NT> CGAL_Kernel3;
+#endif
 typedef CGAL::Nef_polyhedron_3<CGAL_Kernel3, CGAL::SNC_indexed_items, bool> CGAL_Nef_polyhedron3;
 
 namespace CGAL {
@@ -28,11 +28,16 @@
 
 #include "svg.h"
 #include "Reindexer.h"
+#include "GmpAllocator.h"
 #include "GeometryUtils.h"
+#include "parallel.h"
 
 #include <map>
 #include <queue>
 #include <unordered_set>
+#include <limits>
+#include <cstdlib>
+#include <cstring>
 
 namespace CGALUtils {
 
@@ -144,18 +149,122 @@ namespace CGALUtils {
 			PRINTB("ERROR: CGAL error in CGALUtils::applyBinaryOperator %s: %s", opstr % e.what());
 		}
 		CGAL::set_error_behaviour(old_behaviour);
+		// Free the number blocks cached during the operation
+		GmpAllocator::trim();
+		PRINTDB("GMP allocator: %s", GmpAllocator::statistics());
 		return N;
 	}
 
 
 
+	namespace {
+		typedef CGAL::Epick HullKernel;
+
+		// OPENSCAD_DISABLE_HULL_PREFILTER hulls all points at once, for comparing
+		// the results in tests.
+		bool hullPrefilterEnabled()
+		{
+			const char *env = getenv("OPENSCAD_DISABLE_HULL_PREFILTER");
+			return !env || !strcmp(env, "0");
+		}
+
+		/*!
+			Removes points which lie strictly inside the convex hull of the extreme
+			points in 26 directions (the axes, and the diagonals of the cube).
+			Such points can't be vertices of the hull. The tests use exact predicates,
+			so points on the boundary are always kept.
+		*/
+		void removeInteriorPoints(std::vector<HullKernel::Point_3> &points)
+		{
+			typedef HullKernel::Point_3 Point;
+
+			int directions[26][3];
+			int d = 0;
+			for (int dx = -1; dx <= 1; dx++) {
+				for (int dy = -1; dy <= 1; dy++) {
+					for (int dz = -1; dz <= 1; dz++) {
+						if (dx == 0 && dy == 0 && dz == 0) continue;
+						directions[d][0] = dx;
+						directions[d][1] = dy;
+						directions[d][2] = dz;
+						d++;
+					}
+				}
+			}
+			std::vector<size_t> extremes(26, 0);
+			std::vector<double> extremedots(26, -std::numeric_limits<double>::infinity());
+			for (size_t i = 0; i < points.size(); i++) {
+				const auto &p = points[i];
+				for (d = 0; d < 26; d++) {
+					double dot = directions[d][0]*p.x() + directions[d][1]*p.y() + directions[d][2]*p.z();
+					if (dot > extremedots[d]) {
+						extremedots[d] = dot;
+						extremes[d] = i;
+					}
+				}
+			}
+			std::sort(extremes.begin(), extremes.end());
+			extremes.erase(std::unique(extremes.begin(), extremes.end()), extremes.end());
+
+			std::vector<Point> extremepoints;
+			for (auto i : extremes) extremepoints.push_back(points[i]);
+			if (extremepoints.size() < 4) return;
+
+			CGAL::Polyhedron_3<HullKernel> polytope;
+			CGAL::convex_hull_3(extremepoints.begin(), extremepoints.end(), polytope);
+			if (polytope.size_of_facets() < 4 || !polytope.is_closed() || !polytope.is_pure_triangle()) return;
+
+			// For each facet, the orientation of points on the inner side. A facet
+			// without any extreme points off its plane means the polytope is flat.
+			struct Facet {
+				Point a, b, c;
+				CGAL::Orientation inside;
+			};
+			std::vector<Facet> facets;
+			for (auto f = polytope.facets_begin(); f != polytope.facets_end(); ++f) {
+				auto h = f->halfedge();
+				Facet facet{h->vertex()->point(), h->next()->vertex()->point(), h->next()->next()->vertex()->point(), CGAL::COPLANAR};
+				for (const auto &p : extremepoints) {
+					facet.inside = CGAL::orientation(facet.a, facet.b, facet.c, p);
+					if (facet.inside != CGAL::COPLANAR) break;
+				}
+				if (facet.inside == CGAL::COPLANAR) return;
+				facets.push_back(facet);
+			}
+
+			std::vector<char> keep(points.size());
+			parallel_for(points.size(), 16384, [&](size_t begin, size_t end) {
+				for (size_t i = begin; i < end; i++) {
+					keep[i] = false;
+					for (const auto &facet : facets) {
+						if (CGAL::orientation(facet.a, facet.b, facet.c, points[i]) != facet.inside) {
+							keep[i] = true;
+							break;
+						}
+					}
+				}
+			});
+			size_t n = 0;
+			for (size_t i = 0; i < points.size(); i++) {
+				if (keep[i]) points[n++] = points[i];
+			}
+			points.resize(n);
+		}
+	}
+
+	/*!
+		Computes the convex hull of all vertices of the children.
+
+		Duplicate vertices and vertices inside a polytope of extreme points are
+		removed first. Large point sets are then split into ranges which are
+		hulled in parallel, and the final hull is computed from the vertices of
+		the partial hulls.
+	*/
 	bool applyHull(const Geometry::Geometries &children, PolySet &result)
 	{
-		typedef CGAL::Epick K;
+		typedef HullKernel K;
 		// Collect point cloud
-		// NB! CGAL's convex_hull_3() doesn't like std::set iterators, so we use a list
-		// instead.
-		std::list<K::Point_3> points;
+		Reindexer<Vector3d> vertices;
 
 		for(const auto &item : children) {
 			const shared_ptr<const Geometry> &chgeom = item.second;
@@ -163,7 +272,7 @@ namespace CGALUtils {
 			if (N) {
 				if (!N->isEmpty()) {
 					for (CGAL_Nef_polyhedron3::Vertex_const_iterator i = N->p3->vertices_begin(); i != N->p3->vertices_end(); ++i) {
-						points.push_back(vector_convert<K::Point_3>(i->point()));
+						vertices.lookup(vector_convert<Vector3d>(i->point()));
 					}
 				}
 			} else {
@@ -171,33 +280,58 @@ namespace CGALUtils {
 				if (ps) {
 					for(const auto &p : ps->polygons) {
 						for(const auto &v : p) {
-							points.push_back(K::Point_3(v[0], v[1], v[2]));
+							vertices.lookup(v);
 						}
 					}
 				}
 			}
 		}
 
-		if (points.size() <= 3) return false;
+		if (vertices.size() <= 3) return false;
+
+		std::vector<K::Point_3> points;
+		points.reserve(vertices.size());
+		const auto *verts = vertices.getArray();
+		for (size_t i = 0; i < vertices.size(); i++) points.emplace_back(verts[i][0], verts[i][1], verts[i][2]);
 
 		// Apply hull
 		bool success = false;
-		if (points.size() >= 4) {
-			CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
-			try {
-				CGAL::Polyhedron_3<K> r;
-				CGAL::convex_hull_3(points.begin(), points.end(), r);
-                            PRINTDB("After hull vertices: %d", r.size_of_vertices());
-                            PRINTDB("After hull facets: %d", r.size_of_facets());
-                            PRINTDB("After hull closed: %d", r.is_closed());
-                            PRINTDB("After hull valid: %d", r.is_valid());
-				success = !createPolySetFromPolyhedron(r, result);
-			}
-			catch (const CGAL::Failure_exception &e) {
-				PRINTB("ERROR: CGAL error in applyHull(): %s", e.what());
+		CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
+		try {
+			const bool prefilter = hullPrefilterEnabled();
+			if (prefilter) removeInteriorPoints(points);
+			PRINTDB("Hull points after filtering: %d", points.size());
+
+			const size_t rangesize = 65536;
+			if (prefilter && points.size() > rangesize) {
+				std::vector<std::vector<K::Point_3>> rangepoints((points.size() + rangesize - 1) / rangesize);
+				parallel_for(points.size(), rangesize, [&](size_t begin, size_t end) {
+					auto &hullpoints = rangepoints[begin / rangesize];
+					CGAL::Polyhedron_3<K> r;
+					CGAL::convex_hull_3(points.begin() + begin, points.begin() + end, r);
+					if (r.size_of_facets() >= 4 && r.is_closed()) {
+						for (auto v = r.vertices_begin(); v != r.vertices_end(); ++v) hullpoints.push_back(v->point());
+					}
+					else {
+						hullpoints.assign(points.begin() + begin, points.begin() + end);
+					}
+				});
+				points.clear();
+				for (const auto &hullpoints : rangepoints) points.insert(points.end(), hullpoints.begin(), hullpoints.end());
 			}
-			CGAL::set_error_behaviour(old_behaviour);
+
+			CGAL::Polyhedron_3<K> r;
+			CGAL::convex_hull_3(points.begin(), points.end(), r);
+			PRINTDB("After hull vertices: %d", r.size_of_vertices());
+			PRINTDB("After hull facets: %d", r.size_of_facets());
+			PRINTDB("After hull closed: %d", r.is_closed());
+			PRINTDB("After hull valid: %d", r.is_valid());
+			success = !createPolySetFromPolyhedron(r, result);
+		}
+		catch (const CGAL::Failure_exception &e) {
+			PRINTB("ERROR: CGAL error in applyHull(): %s", e.what());
 		}
+		CGAL::set_error_behaviour(old_behaviour);
 		return success;
 	}
 
@@ -5,6 +5,7 @@
 #include "printutils.h"
 #include "polyset-utils.h"
 #include "grid.h"
+#include "VertexWelder.h"
 
 #include "cgal.h"
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
@@ -43,7 +44,7 @@ namespace /* anonymous */ {
 		void operator()(HDS& hds) {
 			CGAL_Polybuilder B(hds, true);
 		
-			Grid3d<int> grid(GRID_FINE);
+			VertexWelder grid(GRID_FINE);
 			std::vector<CGALPoint> vertices;
 			std::vector<std::vector<size_t>> indices;
 
@@ -9,6 +9,7 @@
 #include "Polygon2d.h"
 #include "polyset-utils.h"
 #include "grid.h"
+#include "VertexWelder.h"
 #include "node.h"
 
 #include "cgal.h"
@@ -30,56 +31,189 @@
 #include "Reindexer.h"
 #include "hash.h"
 #include "GeometryUtils.h"
+#include "parallel.h"
+
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,11,0)
+#include <CGAL/Surface_mesh.h>
+#endif
+#include <boost/range/adaptor/reversed.hpp>
 
 #include <map>
 #include <queue>
 
+#ifdef USE_LAZY_KERNEL
+namespace {
+	// By default, CGAL::to_double() of a lazy number only computes the exact value
+	// if the interval approximation is wider than a relative precision of 1e-5.
+	// Always compute it, so the interval is as tight as possible. to_double()
+	// still returns the interval's midpoint, which can differ from the Gmpq
+	// kernel's conversion in the last bit, so exports aren't bit-identical.
+	// The setting is per thread if CGAL has thread support.
+	void set_lazy_kernel_precision() { NT3::set_relative_precision_of_to_double(0.0); }
+
+	struct LazyKernelPrecision {
+		LazyKernelPrecision() {
+			register_thread_initializer(set_lazy_kernel_precision);
+			initialize_thread();
+		}
+	} lazy_kernel_precision;
+}
+#endif
+
+/*!
+	Returns true if all vertices of face lie exactly in the plane the Nef
+	polyhedron constructor will compute for the face, using Newell's method.
+*/
+static bool isPlanar(const std::vector<CGAL_Point_3> &points, const IndexedFace &face)
+{
+	NT3 nx(0), ny(0), nz(0);
+	for (size_t i = 0; i < face.size(); i++) {
+		const auto &a = points[face[i]];
+		const auto &b = points[face[(i+1)%face.size()]];
+		nx += (a.y()-b.y())*(a.z()+b.z());
+		ny += (a.z()-b.z())*(a.x()+b.x());
+		nz += (a.x()-b.x())*(a.y()+b.y());
+	}
+	CGAL_Kernel3::Vector_3 normal(nx, ny, nz);
+	if (normal == CGAL::NULL_VECTOR) return false;
+	CGAL_Kernel3::Plane_3 plane(points[face[0]], normal);
+	for (auto idx : face) {
+		if (!plane.has_on(points[idx])) return false;
+	}
+	return true;
+}
+
+/*!
+	Creates a Nef polyhedron from an indexed mesh of planar faces.
+	Throws CGAL::Assertion_exception if CGAL finds a face not to be planar.
+*/
+static CGAL_Nef_polyhedron3 *createNefPolyhedron3FromMesh(const std::vector<Vector3d> &vertices,
+																													const std::vector<CGAL_Point_3> &points,
+																													const std::vector<IndexedFace> &faces)
+{
+#if CGAL_VERSION_NR >= CGAL_VERSION_NUMBER(4,11,0)
+	typedef CGAL::Surface_mesh<CGAL_Point_3> Mesh;
+	Mesh mesh;
+	mesh.reserve(points.size(), 3*faces.size()/2, faces.size());
+	std::vector<Mesh::Vertex_index> vindices;
+	vindices.reserve(points.size());
+	for (const auto &p : points) vindices.push_back(mesh.add_vertex(p));
+	std::vector<Mesh::Vertex_index> facevertices;
+	for (const auto &face : faces) {
+		// PolySet faces are clockwise, mesh faces counterclockwise
+		facevertices.clear();
+		for (auto idx : boost::adaptors::reverse(face)) facevertices.push_back(vindices[idx]);
+		// Faces which would make the mesh non-manifold are skipped, like
+		// Polyhedron_incremental_builder_3::test_facet() does
+		mesh.add_face(facevertices);
+	}
+	for (auto v : vindices) {
+		if (mesh.is_isolated(v)) mesh.remove_vertex(v);
+	}
+	mesh.collect_garbage();
+	return new CGAL_Nef_polyhedron3(mesh);
+#else
+	PolySet psp(3);
+	for (const auto &face : faces) {
+		psp.append_poly();
+		for (auto idx : face) psp.append_vertex(vertices[idx]);
+	}
+	CGAL_Polyhedron P;
+	if (CGALUtils::createPolyhedronFromPolySet(psp, P)) return nullptr;
+	PRINTDB("Polyhedron is closed: %d", P.is_closed());
+	return new CGAL_Nef_polyhedron3(P);
+#endif
+}
+
+/*!
+	Creates a Nef polyhedron from a PolySet without going through a CGAL_Polyhedron.
+
+	The vertices are quantized and indexed once, and converted to exact points once
+	per vertex. Faces which aren't exactly planar are tessellated up front, so the
+	convexity test and the Nef polyhedron construction use the same mesh. If CGAL
+	still finds a non-planar face, the construction is retried with all faces
+	tessellated.
+*/
 static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 {
 	if (ps.isEmpty()) return new CGAL_Nef_polyhedron();
 	assert(ps.getDimension() == 3);
 
-	// Since is_convex doesn't work well with non-planar faces,
-	// we tessellate the polyset before checking.
-	PolySet psq(ps);
-	psq.quantizeVertices();
-	PolySet ps_tri(3, psq.convexValue());
-	PolysetUtils::tessellate_faces(psq, ps_tri);
-	if (ps_tri.is_convex()) {
+	// 1. Build indexed mesh of quantized vertices, removing consecutive duplicate vertices
+	VertexWelder grid(GRID_FINE, ps.polygons.size());
+	std::vector<Vector3d> vertices;
+	std::vector<IndexedFace> polygons;
+	polygons.reserve(ps.polygons.size());
+	for (const auto &p : ps.polygons) {
+		IndexedFace face;
+		face.reserve(p.size());
+		for (auto v : p) {
+			size_t idx = grid.align(v);
+			if (idx == vertices.size()) vertices.push_back(v);
+			if (face.empty() || int(idx) != face.back()) face.push_back(idx);
+		}
+		if (face.size() > 1 && face.front() == face.back()) face.pop_back();
+		if (face.size() >= 3) polygons.push_back(std::move(face));
+	}
+
+	std::vector<CGAL_Point_3> points;
+	points.reserve(vertices.size());
+	for (const auto &v : vertices) points.emplace_back(v[0], v[1], v[2]);
+
+	// 2. Tessellate non-planar faces
+	std::vector<Vector3f> fvertices;
+	auto tessellate = [&](const IndexedFace &face, std::vector<IndexedFace> &faces) {
+		if (fvertices.empty()) {
+			fvertices.reserve(vertices.size());
+			for (const auto &v : vertices) fvertices.push_back(v.cast<float>());
+		}
+		std::vector<IndexedTriangle> triangles;
+		if (!GeometryUtils::tessellatePolygonWithHoles(fvertices.data(), {face}, triangles, nullptr)) {
+			for (const auto &t : triangles) faces.push_back({t[0], t[1], t[2]});
+		}
+	};
+	std::vector<IndexedFace> faces;
+	faces.reserve(polygons.size());
+	for (auto &face : polygons) {
+		if (face.size() == 3 || isPlanar(points, face)) faces.push_back(std::move(face));
+		else tessellate(face, faces);
+	}
+	polygons.clear();
+
+	// 3. Convex shapes are built from their convex hull
+	bool convex = bool(ps.convexValue());
+	if (boost::indeterminate(ps.convexValue())) {
+		// Since is_convex doesn't work well with non-planar faces, we test the planar mesh
+		PolySet psp(3, ps.convexValue());
+		for (const auto &face : faces) {
+			psp.append_poly();
+			for (auto idx : face) psp.append_vertex(vertices[idx]);
+		}
+		convex = psp.is_convex();
+	}
+	if (convex) {
 		typedef CGAL::Epick K;
-		// Collect point cloud
-		// FIXME: Use unordered container (need hash)
 		// NB! CGAL's convex_hull_3() doesn't like std::set iterators, so we use a list
 		// instead.
-		std::list<K::Point_3> points;
-		for (const auto &poly : psq.polygons) {
-			for (const auto &p : poly) {
-				points.push_back(vector_convert<K::Point_3>(p));
-			}
-		}
+		std::list<K::Point_3> hullpoints;
+		for (const auto &v : vertices) hullpoints.push_back(vector_convert<K::Point_3>(v));
 
-		if (points.size() <= 3) return new CGAL_Nef_polyhedron();
+		if (hullpoints.size() <= 3) return new CGAL_Nef_polyhedron();
 
 		// Apply hull
 		CGAL::Polyhedron_3<K> r;
-		CGAL::convex_hull_3(points.begin(), points.end(), r);
+		CGAL::convex_hull_3(hullpoints.begin(), hullpoints.end(), r);
 		CGAL_Polyhedron r_exact;
 		CGALUtils::copyPolyhedron(r, r_exact);
 		return new CGAL_Nef_polyhedron(new CGAL_Nef_polyhedron3(r_exact));
 	}
 
+	// 4. Build the Nef polyhedron from the indexed mesh
 	CGAL_Nef_polyhedron3 *N = nullptr;
 	auto plane_error = false;
 	CGAL::Failure_behaviour old_behaviour = CGAL::set_error_behaviour(CGAL::THROW_EXCEPTION);
 	try {
-		CGAL_Polyhedron P;
-		auto err = CGALUtils::createPolyhedronFromPolySet(psq, P);
-		 if (!err) {
-		 	PRINTDB("Polyhedron is closed: %d", P.is_closed());
-		 	PRINTDB("Polyhedron is valid: %d", P.is_valid(false, 0));
-		 }
-
-		if (!err) N = new CGAL_Nef_polyhedron3(P);
+		N = createNefPolyhedron3FromMesh(vertices, points, faces);
 	}
 	catch (const CGAL::Assertion_exception &e) {
 		if (std::string(e.what()).find("Plane_constructor")!=std::string::npos &&
@@ -90,14 +224,15 @@ static CGAL_Nef_polyhedron *createNefPolyhedronFromPolySet(const PolySet &ps)
 			PRINTB("ERROR: CGAL error in CGAL_Nef_polyhedron3(): %s", e.what());
 		}
 	}
+	// 5. If CGAL's plane of a face differs from ours, retry with only triangles
 	if (plane_error) try {
-			CGAL_Polyhedron P;
-			auto err = CGALUtils::createPolyhedronFromPolySet(ps_tri, P);
-            if (!err) {
-                PRINTDB("Polyhedron is closed: %d", P.is_closed());
-                PRINTDB("Polyhedron is valid: %d", P.is_valid(false, 0));
-            }
-			if (!err) N = new CGAL_Nef_polyhedron3(P);
+			std::vector<IndexedFace> triangles;
+			triangles.reserve(2*faces.size());
+			for (const auto &face : faces) {
+				if (face.size() == 3) triangles.push_back(face);
+				else tessellate(face, triangles);
+			}
+			N = createNefPolyhedron3FromMesh(vertices, points, triangles);
 		}
 		catch (const CGAL::Assertion_exception &e) {
 			PRINTB("ERROR: Alternate construction failed. CGAL error in CGAL_Nef_polyhedron3(): %s", e.what());
@@ -271,34 +406,35 @@ namespace CGALUtils {
 		bool err = false;
 
 		// 1. Build Indexed PolyMesh
+		// This pass is serial. Copying points copies the handles of their exact
+		// coordinates, and those aren't reference counted atomically. Only the
+		// tessellation of the converted faces below runs in parallel.
 		Reindexer<Vector3f> allVertices;
 		std::vector<std::vector<IndexedFace>> polygons;
 
 		CGAL_Nef_polyhedron3::Halffacet_const_iterator hfaceti;
 		CGAL_forall_halffacets(hfaceti, N) {
-			CGAL::Plane_3<CGAL_Kernel3> plane(hfaceti->plane());
 			// Since we're downscaling to float, vertices might merge during this conversion.
 			// To avoid passing equal vertices to the tessellator, we remove consecutively identical
 			// vertices.
+			// the 0-mark-volume is the 'empty' volume of space. skip it.
+			if (hfaceti->incident_volume()->mark()) continue;
 			polygons.push_back(std::vector<IndexedFace>());
 			auto &faces = polygons.back();
-			// the 0-mark-volume is the 'empty' volume of space. skip it.
-			if (!hfaceti->incident_volume()->mark()) {
-				CGAL_Nef_polyhedron3::Halffacet_cycle_const_iterator cyclei;
-				CGAL_forall_facet_cycles_of(cyclei, hfaceti) {
-					CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c1(cyclei);
-					CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c2(c1);
-					faces.push_back(IndexedFace());
-					auto &currface = faces.back();
-					CGAL_For_all(c1, c2) {
-						CGAL_Point_3 p = c1->source()->center_vertex()->point();
-						// Create vertex indices and remove consecutive duplicate vertices
-						auto idx = allVertices.lookup(vector_convert<Vector3f>(p));
-						if (currface.empty() || idx != currface.back()) currface.push_back(idx);
-					}
-					if (!currface.empty() && currface.front() == currface.back()) currface.pop_back();
-					if (currface.size() < 3) faces.pop_back(); // Cull empty triangles
+			CGAL_Nef_polyhedron3::Halffacet_cycle_const_iterator cyclei;
+			CGAL_forall_facet_cycles_of(cyclei, hfaceti) {
+				CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c1(cyclei);
+				CGAL_Nef_polyhedron3::SHalfedge_around_facet_const_circulator c2(c1);
+				faces.push_back(IndexedFace());
+				auto &currface = faces.back();
+				CGAL_For_all(c1, c2) {
+					const CGAL_Point_3 &p = c1->source()->center_vertex()->point();
+					// Create vertex indices and remove consecutive duplicate vertices
+					auto idx = allVertices.lookup(vector_convert<Vector3f>(p));
+					if (currface.empty() || idx != currface.back()) currface.push_back(idx);
 				}
+				if (!currface.empty() && currface.front() == currface.back()) currface.pop_back();
+				if (currface.size() < 3) faces.pop_back(); // Cull empty triangles
 			}
 			if (faces.empty()) polygons.pop_back(); // Cull empty faces
 		}
@@ -309,57 +445,23 @@ namespace CGALUtils {
 			PRINTB("Error: Non-manifold mesh encountered: %d unconnected edges", unconnected);
 		}
 		// 3. Triangulate each face
+		/* at this stage, we have a sequence of polygons. the first
+			 is the "outside edge' or 'body' or 'border', and the rest of the
+			 polygons are 'holes' within the first. there are several
+			 options here to get rid of the holes. we choose to go ahead
+			 and let the tessellater deal with the holes, and then
+			 just output the resulting 3d triangles*/
+
+		// We cannot trust the plane from Nef polyhedron to be correct.
+		// Passing an incorrect normal vector can cause a crash in the constrained delaunay triangulator
+		// See http://cgal-discuss.949826.n4.nabble.com/Nef3-Wrong-normal-vector-reported-causes-triangulator-crash-tt4660282.html
 		const auto verts = allVertices.getArray();
 		std::vector<IndexedTriangle> allTriangles;
-		for (const auto &faces : polygons) {
-#if 0 // For debugging
-			std::cerr << "---\n";
-			for(const auto &poly : faces) {
-				for(auto i : poly) {
-					std::cerr << i << " ";
-				}
-				std::cerr << "\n";
-			}
-#if 0 // debug
-			std::cerr.precision(20);
-			for(const auto &poly : faces) {
-				for(auto i : poly) {
-					std::cerr << verts[i][0] << "," << verts[i][1] << "," << verts[i][2] << "\n";
-				}
-				std::cerr << "\n";
-			}
-#endif // debug
-			std::cerr << "-\n";
-#endif // debug
-#if 0 // For debugging
-		std::cerr.precision(20);
-		for (size_t i=0;i<allVertices.size();i++) {
-			std::cerr << verts[i][0] << ", " << verts[i][1] << ", " << verts[i][2] << "\n";
-		}		
-#endif // debug
-
-			/* at this stage, we have a sequence of polygons. the first
-				 is the "outside edge' or 'body' or 'border', and the rest of the
-				 polygons are 'holes' within the first. there are several
-				 options here to get rid of the holes. we choose to go ahead
-				 and let the tessellater deal with the holes, and then
-				 just output the resulting 3d triangles*/
-
-			// We cannot trust the plane from Nef polyhedron to be correct.
-			// Passing an incorrect normal vector can cause a crash in the constrained delaunay triangulator
-			// See http://cgal-discuss.949826.n4.nabble.com/Nef3-Wrong-normal-vector-reported-causes-triangulator-crash-tt4660282.html
-			// CGAL::Vector_3<CGAL_Kernel3> nvec = plane.orthogonal_vector();
-			// K::Vector_3 normal(CGAL::to_double(nvec.x()), CGAL::to_double(nvec.y()), CGAL::to_double(nvec.z()));
-			std::vector<IndexedTriangle> triangles;
-			auto err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, nullptr);
-			if (!err) {
-				for (const auto &t : triangles) {
-					assert(t[0] >= 0 && t[0] < static_cast<int>(allVertices.size()));
-					assert(t[1] >= 0 && t[1] < static_cast<int>(allVertices.size()));
-					assert(t[2] >= 0 && t[2] < static_cast<int>(allVertices.size()));
-					allTriangles.push_back(t);
-				}
-			}
+		GeometryUtils::tessellatePolygonsWithHoles(verts, polygons, allTriangles);
+		for (const auto &t : allTriangles) {
+			assert(t[0] >= 0 && t[0] < static_cast<int>(allVertices.size()));
+			assert(t[1] >= 0 && t[1] < static_cast<int>(allVertices.size()));
+			assert(t[2] >= 0 && t[2] < static_cast<int>(allVertices.size()));
 		}
 
 #if 0 // For debugging
@@ -493,7 +595,7 @@ namespace CGALUtils {
 	{
 		bool err = false;
 		// Grid all vertices in a Nef polyhedron to merge close vertices.
-		Grid3d<int> grid(GRID_FINE);
+		VertexWelder grid(GRID_FINE);
 		CGAL_Nef_polyhedron3::Halffacet_const_iterator hfaceti;
 		CGAL_forall_halffacets(hfaceti, N) {
 			CGAL::Plane_3<CGAL_Kernel3> plane(hfaceti->plane());
@@ -5,6 +5,7 @@
 #include "GeometryEvaluator.h"
 #include "progress.h"
 #include "printutils.h"
+#include "parallel.h"
 
 CGALWorker::CGALWorker()
 {
@@ -27,6 +28,9 @@ void CGALWorker::start(const Tree &tree)
 
 void CGALWorker::work()
 {
+	// The thread is started anew for each render
+	initialize_thread();
+
 	shared_ptr<const Geometry> root_geom;
 	try {
 		GeometryEvaluator evaluator(*this->tree);
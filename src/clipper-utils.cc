@@ -1,5 +1,9 @@
 #include "clipper-utils.h"
 #include "printutils.h"
+#include "parallel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
 
 namespace ClipperUtils {
 
@@ -18,6 +22,9 @@ namespace ClipperUtils {
 
 	ClipperLib::Paths fromPolygon2d(const Polygon2d &poly)
 	{
+		// Results of earlier Clipper operations still have their integer paths
+		if (poly.isSanitized() && poly.clipperPaths()) return *poly.clipperPaths();
+
 		ClipperLib::Paths result;
 		for (const auto &outline : poly.outlines()) {
 			result.push_back(fromOutline2d(outline, poly.isSanitized() ? true : false));
@@ -30,7 +37,7 @@ namespace ClipperUtils {
 		return toPolygon2d(sanitize(ClipperUtils::fromPolygon2d(poly)));
 	}
 
-	ClipperLib::PolyTree sanitize(const ClipperLib::Paths &paths)
+	ClipperLib::PolyTree sanitize(const ClipperLib::Paths &paths, ClipperLib::PolyFillType filltype)
 	{
 		ClipperLib::PolyTree result;
 		ClipperLib::Clipper clipper;
@@ -43,7 +50,7 @@ namespace ClipperUtils {
 			// an exception of type char* rather than a clipperException()
 		  PRINT("WARNING: Range check failed for polygon. skipping");
 		}
-		clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftEvenOdd);
+		clipper.Execute(ClipperLib::ctUnion, result, filltype);
 		return result;
 	}
 	
@@ -52,34 +59,33 @@ namespace ClipperUtils {
 	 have an explicit notion of holes.
 	 We could use a Paths structure, but we'd have to check the orientation of each
 	 path before adding it to the Polygon2d.
+
+	 The Polygon2d keeps the cleaned integer paths, and only converts them to
+	 outlines when they're needed.
  */
-	Polygon2d *toPolygon2d(const ClipperLib::PolyTree &poly)
+	static void appendCleanedPaths(const ClipperLib::PolyTree &poly, ClipperLib::Paths &paths)
 	{
 		const double CLEANING_DISTANCE = 0.001 * CLIPPER_SCALE;
 
-		auto result = new Polygon2d;
 		auto node = poly.GetFirst();
 		while (node) {
-			Outline2d outline;
-			// Apparently, when using offset(), clipper gets the hole status wrong
-			//outline.positive = !node->IsHole();
-			outline.positive = Orientation(node->Contour);
-
+			// Apparently, when using offset(), clipper gets the hole status wrong,
+			// so Polygon2d uses the orientation of the paths instead of IsHole()
 			ClipperLib::Path cleaned_path;
 			ClipperLib::CleanPolygon(node->Contour, cleaned_path, CLEANING_DISTANCE);
 
 			// CleanPolygon can in some cases reduce the polygon down to no vertices
-			if (cleaned_path.size() >= 3)  {
-				for (const auto &ip : cleaned_path) {
-					outline.vertices.emplace_back(1.0*ip.X/CLIPPER_SCALE, 1.0*ip.Y/CLIPPER_SCALE);
-				}
-				result->addOutline(outline);
-			}
+			if (cleaned_path.size() >= 3) paths.push_back(std::move(cleaned_path));
 
 			node = node->GetNext();
 		}
-		result->setSanitized(true);
-		return result;
+	}
+
+	Polygon2d *toPolygon2d(const ClipperLib::PolyTree &poly)
+	{
+		auto paths = make_shared<ClipperLib::Paths>();
+		appendCleanedPaths(poly, *paths);
+		return new Polygon2d(paths);
 	}
 
 	ClipperLib::Paths process(const ClipperLib::Paths &polygons, 
@@ -93,6 +99,295 @@ namespace ClipperUtils {
 		return result;
 	}
 
+	namespace {
+		// Children of a union or difference before it's worth partitioning them
+		const size_t PARTITION_MIN_CHILDREN = 32;
+
+		struct IntBox {
+			IntBox() : minx(std::numeric_limits<ClipperLib::cInt>::max()), miny(minx),
+								 maxx(std::numeric_limits<ClipperLib::cInt>::min()), maxy(maxx) {}
+			bool isEmpty() const { return minx > maxx; }
+			void extend(const ClipperLib::IntPoint &p) {
+				minx = std::min(minx, p.X);
+				miny = std::min(miny, p.Y);
+				maxx = std::max(maxx, p.X);
+				maxy = std::max(maxy, p.Y);
+			}
+			void extend(const IntBox &b) {
+				minx = std::min(minx, b.minx);
+				miny = std::min(miny, b.miny);
+				maxx = std::max(maxx, b.maxx);
+				maxy = std::max(maxy, b.maxy);
+			}
+			// Touching boxes overlap, so shapes sharing an edge end up together
+			bool overlaps(const IntBox &b) const {
+				return minx <= b.maxx && b.minx <= maxx && miny <= b.maxy && b.miny <= maxy;
+			}
+			ClipperLib::cInt minx, miny, maxx, maxy;
+		};
+
+		IntBox boundingBox(const ClipperLib::Paths &paths)
+		{
+			IntBox box;
+			for (const auto &path : paths) {
+				for (const auto &p : path) box.extend(p);
+			}
+			return box;
+		}
+
+		/*!
+			Groups the non-empty boxes into clusters of transitively overlapping
+			boxes. Clusters are ordered by their first box, and boxes within a
+			cluster by index.
+		*/
+		std::vector<std::vector<size_t>> clusterBoxes(const std::vector<IntBox> &boxes)
+		{
+			std::vector<size_t> parent(boxes.size());
+			for (size_t i = 0; i < parent.size(); i++) parent[i] = i;
+			auto root = [&](size_t i) {
+				while (parent[i] != i) i = parent[i] = parent[parent[i]];
+				return i;
+			};
+
+			// Sweep along x, comparing each box with the boxes it may overlap
+			std::vector<size_t> order;
+			for (size_t i = 0; i < boxes.size(); i++) {
+				if (!boxes[i].isEmpty()) order.push_back(i);
+			}
+			std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return boxes[a].minx < boxes[b].minx; });
+			std::vector<size_t> active;
+			for (auto i : order) {
+				size_t n = 0;
+				for (auto j : active) {
+					if (boxes[j].maxx < boxes[i].minx) continue; // Can't overlap any later box
+					active[n++] = j;
+					if (boxes[i].overlaps(boxes[j])) {
+						size_t ri = root(i), rj = root(j);
+						if (ri != rj) parent[std::max(ri, rj)] = std::min(ri, rj);
+					}
+				}
+				active.resize(n);
+				active.push_back(i);
+			}
+
+			std::vector<std::vector<size_t>> clusters;
+			std::vector<size_t> clusterindex(boxes.size(), 0);
+			for (size_t i = 0; i < boxes.size(); i++) {
+				if (boxes[i].isEmpty()) continue;
+				size_t r = root(i);
+				if (r == i) {
+					clusterindex[i] = clusters.size();
+					clusters.push_back({});
+				}
+				clusters[clusterindex[r]].push_back(i);
+			}
+			return clusters;
+		}
+
+		/*!
+			Index of the edges of a polygon in a uniform grid, used to find the
+			position of shapes relative to the polygon.
+		*/
+		class EdgeGrid
+		{
+		public:
+			EdgeGrid(const ClipperLib::Paths &paths) : box(boundingBox(paths)) {
+				for (const auto &path : paths) {
+					for (size_t i = 0; i < path.size(); i++) {
+						this->edges.emplace_back(path[i], path[(i+1)%path.size()]);
+					}
+				}
+				if (this->box.isEmpty()) return;
+				this->size = std::max<size_t>(1, std::min<size_t>(1024, std::sqrt(double(this->edges.size()))));
+				this->cellw = (this->box.maxx - this->box.minx) / ClipperLib::cInt(this->size) + 1;
+				this->cellh = (this->box.maxy - this->box.miny) / ClipperLib::cInt(this->size) + 1;
+				this->cells.resize(this->size * this->size);
+				for (size_t e = 0; e < this->edges.size(); e++) {
+					IntBox ebox;
+					ebox.extend(this->edges[e].first);
+					ebox.extend(this->edges[e].second);
+					forCells(ebox, [&](size_t cell) { this->cells[cell].push_back(e); });
+				}
+			}
+
+			// Returns true if the box overlaps the bounding box of any edge
+			bool touches(const IntBox &b) const {
+				if (!this->box.overlaps(b)) return false;
+				bool found = false;
+				forCells(b, [&](size_t cell) {
+					for (auto e : this->cells[cell]) {
+						IntBox ebox;
+						ebox.extend(this->edges[e].first);
+						ebox.extend(this->edges[e].second);
+						if (ebox.overlaps(b)) found = true;
+					}
+				});
+				return found;
+			}
+
+			/*!
+				Returns true if p is inside the polygon, using the non-zero rule.
+				p must be outside the bounding boxes of all edges, see touches().
+			*/
+			bool inside(const ClipperLib::IntPoint &p) const {
+				if (p.X < this->box.minx || p.X > this->box.maxx || p.Y < this->box.miny || p.Y > this->box.maxy) return false;
+				// Count the edges crossing the ray from p in positive x direction. As p
+				// is outside the edge's bounding box, the crossing is right of p if and
+				// only if the edge is.
+				IntBox ray;
+				ray.extend(p);
+				ray.extend(ClipperLib::IntPoint(this->box.maxx, p.Y));
+				std::vector<size_t> candidates;
+				forCells(ray, [&](size_t cell) {
+					candidates.insert(candidates.end(), this->cells[cell].begin(), this->cells[cell].end());
+				});
+				std::sort(candidates.begin(), candidates.end());
+				candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+				int winding = 0;
+				for (auto e : candidates) {
+					const auto &a = this->edges[e].first;
+					const auto &b = this->edges[e].second;
+					if (std::min(a.X, b.X) < p.X) continue;
+					if (a.Y <= p.Y && p.Y < b.Y) winding++;
+					else if (b.Y <= p.Y && p.Y < a.Y) winding--;
+				}
+				return winding != 0;
+			}
+
+		private:
+			template <typename F> void forCells(const IntBox &b, F f) const {
+				auto clampx = [&](ClipperLib::cInt x) {
+					return size_t(std::max<ClipperLib::cInt>(0, std::min<ClipperLib::cInt>(this->size - 1, (x - this->box.minx) / this->cellw)));
+				};
+				auto clampy = [&](ClipperLib::cInt y) {
+					return size_t(std::max<ClipperLib::cInt>(0, std::min<ClipperLib::cInt>(this->size - 1, (y - this->box.miny) / this->cellh)));
+				};
+				size_t x0 = clampx(b.minx), x1 = clampx(b.maxx), y0 = clampy(b.miny), y1 = clampy(b.maxy);
+				for (size_t y = y0; y <= y1; y++) {
+					for (size_t x = x0; x <= x1; x++) f(y * this->size + x);
+				}
+			}
+
+			IntBox box;
+			std::vector<std::pair<ClipperLib::IntPoint, ClipperLib::IntPoint>> edges;
+			size_t size = 0;
+			ClipperLib::cInt cellw = 1, cellh = 1;
+			std::vector<std::vector<size_t>> cells;
+		};
+
+		// Unions the children in cluster, optionally cleaning the result like toPolygon2d()
+		ClipperLib::Paths unionCluster(const std::vector<ClipperLib::Paths> &pathsvector,
+																	 const std::vector<size_t> &cluster, bool clean)
+		{
+			ClipperLib::Clipper clipper;
+			for (auto i : cluster) clipper.AddPaths(pathsvector[i], ClipperLib::ptSubject, true);
+			ClipperLib::Paths result;
+			if (clean) {
+				ClipperLib::PolyTree tree;
+				clipper.Execute(ClipperLib::ctUnion, tree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+				appendCleanedPaths(tree, result);
+			}
+			else {
+				clipper.Execute(ClipperLib::ctUnion, result, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+			}
+			return result;
+		}
+
+		const ClipperLib::IntPoint &firstPoint(const ClipperLib::Paths &paths)
+		{
+			for (const auto &path : paths) {
+				if (!path.empty()) return path[0];
+			}
+			assert(false && "paths without points");
+			return paths[0][0];
+		}
+
+		/*!
+			Union of many children. Children are grouped into clusters with
+			overlapping bounding boxes, which are disjoint from each other. The
+			clusters are unioned in parallel and their outlines concatenated.
+
+			Returns nullptr if all children are in one cluster.
+		*/
+		Polygon2d *applyUnionPartitioned(const std::vector<ClipperLib::Paths> &pathsvector)
+		{
+			std::vector<IntBox> boxes;
+			for (const auto &paths : pathsvector) boxes.push_back(boundingBox(paths));
+			auto clusters = clusterBoxes(boxes);
+			if (clusters.size() <= 1) return nullptr;
+
+			std::vector<ClipperLib::Paths> results(clusters.size());
+			parallel_for(clusters.size(), 16, [&](size_t begin, size_t end) {
+				for (size_t c = begin; c < end; c++) results[c] = unionCluster(pathsvector, clusters[c], true);
+			});
+
+			auto paths = make_shared<ClipperLib::Paths>();
+			for (auto &result : results) {
+				for (auto &path : result) paths->push_back(std::move(path));
+			}
+			return new Polygon2d(paths);
+		}
+
+		/*!
+			Difference of the first child and many others. The other children are
+			grouped into clusters like for a union, and each cluster is unioned in
+			parallel. Clusters outside the first child are dropped. Clusters
+			strictly inside of it become holes without running Clipper on them.
+			Only the remaining clusters, which cross its outlines, are subtracted
+			by Clipper.
+
+			Returns nullptr if all children are in one cluster.
+		*/
+		Polygon2d *applyDifferencePartitioned(const std::vector<ClipperLib::Paths> &pathsvector)
+		{
+			const auto &subject = pathsvector[0];
+			std::vector<IntBox> boxes(1);
+			for (size_t i = 1; i < pathsvector.size(); i++) boxes.push_back(boundingBox(pathsvector[i]));
+			auto clusters = clusterBoxes(boxes);
+			if (clusters.size() <= 1) return nullptr;
+
+			EdgeGrid grid(subject);
+			enum class Position { OUTSIDE, INSIDE, CROSSING };
+			std::vector<ClipperLib::Paths> results(clusters.size());
+			std::vector<Position> positions(clusters.size(), Position::OUTSIDE);
+			parallel_for(clusters.size(), 16, [&](size_t begin, size_t end) {
+				for (size_t c = begin; c < end; c++) {
+					IntBox box;
+					for (auto i : clusters[c]) box.extend(boxes[i]);
+					if (grid.touches(box)) {
+						positions[c] = Position::CROSSING;
+						results[c] = unionCluster(pathsvector, clusters[c], false);
+					}
+					else if (grid.inside(firstPoint(pathsvector[clusters[c][0]]))) {
+						positions[c] = Position::INSIDE;
+						results[c] = unionCluster(pathsvector, clusters[c], true);
+					}
+				}
+			});
+
+			ClipperLib::Clipper clipper;
+			clipper.AddPaths(subject, ClipperLib::ptSubject, true);
+			for (size_t c = 0; c < clusters.size(); c++) {
+				if (positions[c] == Position::CROSSING) clipper.AddPaths(results[c], ClipperLib::ptClip, true);
+			}
+			ClipperLib::PolyTree tree;
+			clipper.Execute(ClipperLib::ctDifference, tree, ClipperLib::pftNonZero, ClipperLib::pftNonZero);
+
+			auto paths = make_shared<ClipperLib::Paths>();
+			appendCleanedPaths(tree, *paths);
+			// Outlines of inside clusters are reversed: outer outlines become holes,
+			// and holes in them become islands
+			for (size_t c = 0; c < clusters.size(); c++) {
+				if (positions[c] != Position::INSIDE) continue;
+				for (auto &path : results[c]) {
+					ClipperLib::ReversePath(path);
+					paths->push_back(std::move(path));
+				}
+			}
+			return new Polygon2d(paths);
+		}
+	}
+
 	/*!
 		Apply the clipper operator to the given paths.
 
@@ -101,6 +396,13 @@ namespace ClipperUtils {
 	Polygon2d *apply(const std::vector<ClipperLib::Paths> &pathsvector,
 									 ClipperLib::ClipType clipType)
 	{
+		if (pathsvector.size() >= PARTITION_MIN_CHILDREN) {
+			Polygon2d *result = nullptr;
+			if (clipType == ClipperLib::ctUnion) result = applyUnionPartitioned(pathsvector);
+			else if (clipType == ClipperLib::ctDifference) result = applyDifferencePartitioned(pathsvector);
+			if (result) return result;
+		}
+
 		ClipperLib::Clipper clipper;
 
 		if (clipType == ClipperLib::ctIntersection && pathsvector.size() >= 2) {
@@ -9,7 +9,8 @@ namespace ClipperUtils {
 
 	ClipperLib::Path fromOutline2d(const Outline2d &poly, bool keep_orientation);
 	ClipperLib::Paths fromPolygon2d(const Polygon2d &poly);
-	ClipperLib::PolyTree sanitize(const ClipperLib::Paths &paths);
+	ClipperLib::PolyTree sanitize(const ClipperLib::Paths &paths,
+																ClipperLib::PolyFillType filltype = ClipperLib::pftEvenOdd);
 	Polygon2d *sanitize(const Polygon2d &poly);
 	Polygon2d *toPolygon2d(const ClipperLib::PolyTree &poly);
 	ClipperLib::Paths process(const ClipperLib::Paths &polygons, 
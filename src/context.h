@@ -48,6 +48,18 @@ protected:
 
 	std::string document_path; // FIXME: This is a remnant only needed by dxfdim
 
+	// Loop invariants bound to this context by bind_invariants(). They are
+	// evaluated on first use, so loops which never use them don't pay for
+	// them or issue their warnings.
+	struct Invariant {
+		enum class State { UNEVALUATED, EVALUATED, PER_USE };
+		State state = State::UNEVALUATED;
+		ValuePtr value;
+	};
+	mutable std::unordered_map<const class HoistedExpression *, Invariant> invariants;
+	friend class HoistedExpression;
+	friend void bind_invariants(const std::vector<shared_ptr<class HoistedExpression>> &invariants, Context &context);
+
 public:
 #ifdef DEBUG
 	virtual std::string dump(const class AbstractModule *mod, const ModuleInstantiation *inst);
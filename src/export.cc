@@ -27,8 +27,17 @@
 #include "export.h"
 #include "printutils.h"
 #include "Geometry.h"
+#include "polyset.h"
+#include "MeshSlicer.h"
+
+#ifdef ENABLE_CGAL
+#include "CGAL_Nef_polyhedron.h"
+#include "cgalutils.h"
+#endif
 
 #include <fstream>
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
 
 #define QUOTE(x__) # x__
 #define QUOTED(x__) QUOTE(x__)
@@ -86,3 +95,53 @@ void exportFileByName(const shared_ptr<const Geometry> &root_geom, FileFormat fo
 		}
 	}
 }
+
+/*!
+	Returns the name of file i of n, made by appending the zero-padded number
+	to the stem of filename, e.g. part-07.svg.
+ */
+std::string numberedFilename(const std::string &filename, unsigned int i, unsigned int n)
+{
+	fs::path path(filename);
+	std::string num = std::to_string(i), last = std::to_string(n - 1);
+	if (num.size() < last.size()) num.insert(0, last.size() - num.size(), '0');
+	return (path.parent_path() / (path.stem().string() + "-" + num + path.extension().string())).string();
+}
+
+/*!
+	Exports n horizontal cross sections of a 3D object, taken at the middle of
+	n equally thick layers. Each slice goes to its own numbered file.
+ */
+bool exportSlices(const shared_ptr<const Geometry> &root_geom, FileFormat format,
+									unsigned int n, const char *filename)
+{
+	shared_ptr<const PolySet> ps = dynamic_pointer_cast<const PolySet>(root_geom);
+#ifdef ENABLE_CGAL
+	if (!ps) {
+		shared_ptr<const CGAL_Nef_polyhedron> N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(root_geom);
+		if (N && N->p3) {
+			PolySet *nefps = new PolySet(3);
+			bool err = CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *nefps);
+			if (err) {
+				PRINT("ERROR: Nef->PolySet failed");
+				delete nefps;
+				return false;
+			}
+			ps.reset(nefps);
+		}
+	}
+#endif
+	if (!ps || n == 0) return false;
+
+	MeshSlicer slicer(*ps);
+	std::vector<double> heights(n);
+	double layer = (slicer.zmax() - slicer.zmin()) / n;
+	for (unsigned int i = 0; i < n; i++) heights[i] = slicer.zmin() + (i + 0.5) * layer;
+	auto slices = slicer.slice(heights);
+
+	for (unsigned int i = 0; i < n; i++) {
+		std::string name = numberedFilename(filename, i, n);
+		exportFileByName(slices[i], format, name.c_str(), name.c_str());
+	}
+	return true;
+}
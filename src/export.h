@@ -17,6 +17,9 @@ enum class FileFormat {
 
 void exportFileByName(const shared_ptr<const class Geometry> &root_geom, FileFormat format,
 											const char *name2open, const char *name2display);
+std::string numberedFilename(const std::string &filename, unsigned int i, unsigned int n);
+bool exportSlices(const shared_ptr<const class Geometry> &root_geom, FileFormat format,
+									unsigned int n, const char *filename);
 
 void export_stl(const shared_ptr<const Geometry> &geom, std::ostream &output);
 void export_off(const shared_ptr<const Geometry> &geom, std::ostream &output);
@@ -28,7 +31,12 @@ void export_nef3(const shared_ptr<const Geometry> &geom, std::ostream &output);
 
 // void exportFile(const class Geometry *root_geom, std::ostream &output, FileFormat format);
 
-bool export_png(const shared_ptr<const class Geometry> &root_geom, Camera &c, std::ostream &output);
-bool export_png(const shared_ptr<const class CGAL_Nef_polyhedron> &root_N, Camera &c, std::ostream &output);
-bool export_png_with_opencsg(Tree &tree, Camera &c, std::ostream &output);
-bool export_png_with_throwntogether(Tree &tree, Camera &c, std::ostream &output);
+// PNG exports write one image per camera and orbit step, to filename itself
+// if that's a single image, otherwise to numbered files
+bool export_png(const shared_ptr<const class Geometry> &root_geom, const std::vector<Camera> &cams,
+								unsigned int orbit, const char *filename);
+bool export_png_with_opencsg(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename);
+bool export_png_with_throwntogether(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename);
+bool export_png_software(const shared_ptr<const class Geometry> &root_geom, const std::vector<Camera> &cams,
+												 unsigned int orbit, const char *filename);
+bool export_png_software_throwntogether(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename);
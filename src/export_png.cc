@@ -5,6 +5,9 @@
 #include <stdio.h>
 #include "polyset.h"
 #include "rendersettings.h"
+#include "SoftwareRasterizer.h"
+#include <fstream>
+#include <set>
 
 #ifdef ENABLE_CGAL
 #include "CGALRenderer.h"
@@ -19,27 +22,105 @@ static void setupCamera(Camera &cam, const BoundingBox &bbox)
 	if (cam.viewall) cam.viewAll(bbox);
 }
 
-bool export_png(const shared_ptr<const Geometry> &root_geom, Camera &cam, std::ostream &output)
+// Turns a camera set up by setupCamera() around the z axis
+static void turnCamera(Camera &cam, double degrees)
 {
-	PRINTD("export_png geom");
-	OffscreenView *glview;
+	if (cam.type == Camera::CameraType::GIMBAL) {
+		cam.object_rot.z() += degrees;
+	}
+	else if (cam.type == Camera::CameraType::VECTOR) {
+		Eigen::AngleAxisd rot(degrees * M_PI / 180, Vector3d::UnitZ());
+		cam.eye = cam.center + rot * (cam.eye - cam.center);
+	}
+}
+
+// Sets up each camera for bbox, and adds orbit views of it in equal steps
+// around the z axis
+static std::vector<Camera> setupViews(const std::vector<Camera> &cams, unsigned int orbit, const BoundingBox &bbox)
+{
+	std::vector<Camera> views;
+	orbit = std::max(orbit, 1u);
+	for (auto cam : cams) {
+		setupCamera(cam, bbox);
+		for (unsigned int i = 0; i < orbit; i++) {
+			views.push_back(cam);
+			turnCamera(views.back(), 360.0 * i / orbit);
+		}
+	}
+	return views;
+}
+
+static bool openOutput(std::ofstream &fstream, const char *filename, size_t i, size_t n)
+{
+	std::string name = n == 1 ? filename : numberedFilename(filename, i, n);
+	fstream.open(name, std::ios::out | std::ios::binary);
+	if (!fstream.is_open()) {
+		PRINTB("Can't open file \"%s\" for export", name);
+		return false;
+	}
+	return true;
+}
+
+/*!
+	Returns an offscreen view of the given size. The view and its context are
+	kept for later exports of the same size, e.g. animation frames.
+*/
+static OffscreenView *getOffscreenView(unsigned int width, unsigned int height)
+{
+	static OffscreenView *glview = nullptr;
+	if (glview && glview->width == width && glview->height == height) return glview;
+	delete glview;
+	glview = nullptr;
 	try {
-		glview = new OffscreenView(cam.pixel_width, cam.pixel_height);
+		glview = new OffscreenView(width, height);
 	} catch (int error) {
 		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
-		return false;
 	}
+	return glview;
+}
+
+// Renders and saves one image per view
+static bool renderViews(OffscreenView *glview, const std::vector<Camera> &views, const char *filename)
+{
+	for (size_t i = 0; i < views.size(); i++) {
+		std::ofstream fstream;
+		if (!openOutput(fstream, filename, i, views.size())) return false;
+		glview->setCamera(views[i]);
+		glview->paintGL();
+		glview->save(fstream);
+	}
+	return true;
+}
+
+static bool renderViews(SoftwareRasterizer &rasterizer, const std::vector<Camera> &views,
+												const Color4f &background, const char *filename)
+{
+	for (size_t i = 0; i < views.size(); i++) {
+		std::ofstream fstream;
+		if (!openOutput(fstream, filename, i, views.size())) return false;
+		rasterizer.setCamera(views[i]);
+		rasterizer.render(background);
+		if (!rasterizer.save(fstream)) return false;
+	}
+	return true;
+}
+
+bool export_png(const shared_ptr<const Geometry> &root_geom, const std::vector<Camera> &cams,
+								unsigned int orbit, const char *filename)
+{
+	PRINTD("export_png geom");
+	if (cams.empty()) return false;
+	auto glview = getOffscreenView(cams[0].pixel_width, cams[0].pixel_height);
+	if (!glview) return false;
 	CGALRenderer cgalRenderer(root_geom);
 
-	BoundingBox bbox = cgalRenderer.getBoundingBox();
-	setupCamera(cam, bbox);
+	auto views = setupViews(cams, orbit, cgalRenderer.getBoundingBox());
 
-	glview->setCamera(cam);
 	glview->setRenderer(&cgalRenderer);
 	glview->setColorScheme(RenderSettings::inst()->colorscheme);
-	glview->paintGL();
-	glview->save(output);
-	return true;
+	bool success = renderViews(glview, views, filename);
+	glview->setRenderer(nullptr);
+	return success;
 }
 
 enum class Previewer { OPENCSG, THROWNTOGETHER } previewer;
@@ -50,19 +131,16 @@ enum class Previewer { OPENCSG, THROWNTOGETHER } previewer;
 #endif
 #include "ThrownTogetherRenderer.h"
 
-bool export_png_preview_common(Tree &tree, Camera &cam, std::ostream &output, Previewer previewer = Previewer::OPENCSG)
+bool export_png_preview_common(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename,
+															 Previewer previewer = Previewer::OPENCSG)
 {
 	PRINTD("export_png_preview_common");
+	if (cams.empty()) return false;
 	CsgInfo csgInfo = CsgInfo();
-	csgInfo.compile_products(tree);
+	csgInfo.compile_products(tree, previewer == Previewer::OPENCSG);
 
-	OffscreenView *glview;
-	try {
-		glview = new OffscreenView(cam.pixel_width, cam.pixel_height);
-	} catch (int error) {
-		fprintf(stderr,"Can't create OpenGL OffscreenView. Code: %i.\n", error);
-		return false;
-	}
+	auto glview = getOffscreenView(cams[0].pixel_width, cams[0].pixel_height);
+	if (!glview) return false;
 
 #ifdef ENABLE_OPENCSG
 	OpenCSGRenderer openCSGRenderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products, glview->shaderinfo);
@@ -75,35 +153,164 @@ bool export_png_preview_common(Tree &tree, Camera &cam, std::ostream &output, Pr
 	else
 #endif
 		glview->setRenderer(&thrownTogetherRenderer);
+	auto views = setupViews(cams, orbit, glview->getRenderer()->getBoundingBox());
 #ifdef ENABLE_OPENCSG
-	BoundingBox bbox = glview->getRenderer()->getBoundingBox();
-	setupCamera(cam, bbox);
-
-	glview->setCamera(cam);
 	OpenCSG::setContext(0);
 	OpenCSG::setOption(OpenCSG::OffscreenSetting, OpenCSG::FrameBufferObject);
 #endif
 	glview->setColorScheme(RenderSettings::inst()->colorscheme);
-	glview->paintGL();
-	glview->save(output);
-	return true;
+	bool success = renderViews(glview, views, filename);
+	glview->setRenderer(nullptr);
+	return success;
 }
 
-bool export_png_with_opencsg(Tree &tree, Camera &cam, std::ostream &output)
+bool export_png_with_opencsg(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename)
 {
 	PRINTD("export_png_w_opencsg");
 #ifdef ENABLE_OPENCSG
-	return export_png_preview_common(tree, cam, output, Previewer::OPENCSG);
+	return export_png_preview_common(tree, cams, orbit, filename, Previewer::OPENCSG);
 #else
 	fprintf(stderr,"This openscad was built without OpenCSG support\n");
 	return false;
 #endif
 }
 
-bool export_png_with_throwntogether(Tree &tree, Camera &cam, std::ostream &output)
+bool export_png_with_throwntogether(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename)
 {
 	PRINTD("export_png_w_thrown");
-	return export_png_preview_common(tree, cam, output, Previewer::THROWNTOGETHER);
+	return export_png_preview_common(tree, cams, orbit, filename, Previewer::THROWNTOGETHER);
+}
+
+/*!
+	Like export_png(), but renders on the CPU. Nef polyhedra are converted
+	to PolySets, with CGAL's face colors.
+*/
+bool export_png_software(const shared_ptr<const Geometry> &root_geom, const std::vector<Camera> &cams,
+												 unsigned int orbit, const char *filename)
+{
+	PRINTD("export_png_software geom");
+	if (cams.empty()) return false;
+	const ColorScheme *cs = ColorMap::inst()->findColorScheme(RenderSettings::inst()->colorscheme);
+	if (!cs) cs = &ColorMap::inst()->defaultColorScheme();
+
+	SoftwareRasterizer rasterizer(cams[0].pixel_width, cams[0].pixel_height);
+	shared_ptr<const PolySet> ps;
+	Color4f front, back;
+	bool lit = true;
+	if (auto poly = dynamic_pointer_cast<const Polygon2d>(root_geom)) {
+		ps.reset(poly->tessellate());
+		front = back = ColorMap::getColor(*cs, RenderColor::CGAL_FACE_2D_COLOR);
+		lit = false;
+	}
+	else if (auto N = dynamic_pointer_cast<const CGAL_Nef_polyhedron>(root_geom)) {
+		auto nps = new PolySet(3);
+		ps.reset(nps);
+		if (!N->isEmpty() && CGALUtils::createPolySetFromNefPolyhedron3(*N->p3, *nps)) {
+			PRINT("WARNING: Unable to convert the Nef polyhedron to a PolySet");
+			return false;
+		}
+		front = ColorMap::getColor(*cs, RenderColor::CGAL_FACE_FRONT_COLOR);
+		back = ColorMap::getColor(*cs, RenderColor::CGAL_FACE_BACK_COLOR);
+	}
+	else {
+		ps = dynamic_pointer_cast<const PolySet>(root_geom);
+		if (!ps) return false;
+		front = back = ColorMap::getColor(*cs, RenderColor::OPENCSG_FACE_FRONT_COLOR);
+	}
+
+	rasterizer.addPolySet(*ps, Transform3d::Identity(), front, back, lit);
+	return renderViews(rasterizer, setupViews(cams, orbit, ps->getBoundingBox()),
+										 ColorMap::getColor(*cs, RenderColor::BACKGROUND_COLOR), filename);
+}
+
+// Turns a 2D PolySet into a prism of the given height, as
+// PolySet::render_surface() draws 2D objects in previews. Walls are added
+// along every polygon edge, the inner ones are hidden anyway.
+static PolySet *thicken(const PolySet &ps, double height)
+{
+	auto prism = new PolySet(3);
+	for (const auto &p : ps.polygons) {
+		prism->append_poly();
+		for (auto it = p.rbegin(); it != p.rend(); ++it) prism->append_vertex((*it)[0], (*it)[1], -height / 2);
+		prism->append_poly();
+		for (const auto &v : p) prism->append_vertex(v[0], v[1], height / 2);
+		for (size_t i = 0; i < p.size(); i++) {
+			const auto &v1 = p[i], &v2 = p[(i + 1) % p.size()];
+			prism->append_poly();
+			prism->append_vertex(v1[0], v1[1], -height / 2);
+			prism->append_vertex(v2[0], v2[1], -height / 2);
+			prism->append_vertex(v2[0], v2[1], height / 2);
+			prism->append_vertex(v1[0], v1[1], height / 2);
+		}
+	}
+	return prism;
+}
+
+/*!
+	Renders a thrown together preview on the CPU, using the colors of
+	ThrownTogetherRenderer. Back faces of the root products show up in
+	magenta, as in the GUI.
+*/
+bool export_png_software_throwntogether(Tree &tree, const std::vector<Camera> &cams, unsigned int orbit, const char *filename)
+{
+	PRINTD("export_png_software_throwntogether");
+	if (cams.empty()) return false;
+	CsgInfo csgInfo = CsgInfo();
+	csgInfo.compile_products(tree, false);
+
+	ThrownTogetherRenderer renderer(csgInfo.root_products, csgInfo.highlights_products, csgInfo.background_products);
+	const ColorScheme *cs = ColorMap::inst()->findColorScheme(RenderSettings::inst()->colorscheme);
+	if (!cs) cs = &ColorMap::inst()->defaultColorScheme();
+	renderer.setColorScheme(*cs);
+
+	// Resolves a leaf color against a color mode, as Renderer::setColor() does
+	auto resolve = [&](Renderer::ColorMode mode, const Color4f &leafcolor) {
+		Color4f col;
+		renderer.getColor(mode, col);
+		if (mode == Renderer::ColorMode::HIGHLIGHT) return col;
+		for (int i = 0; i < 4; i++) {
+			if (leafcolor[i] >= 0) col[i] = leafcolor[i];
+		}
+		return col;
+	};
+
+	SoftwareRasterizer rasterizer(cams[0].pixel_width, cams[0].pixel_height);
+
+	const Color4f fberror(1.0f, 0.0f, 1.0f, 1.0f);
+	auto addProducts = [&](const CSGProducts &products, bool highlight_mode, bool background_mode) {
+		std::set<std::pair<const Geometry *, const Transform3d *>> visited;
+		auto add = [&](const CSGChainObject &csgobj, bool difference) {
+			if (!visited.insert(std::make_pair(csgobj.leaf->geom.get(), &csgobj.leaf->matrix)).second) return;
+			auto ps = dynamic_pointer_cast<const PolySet>(csgobj.leaf->geom);
+			if (!ps) return;
+
+			bool highlight = highlight_mode || (csgobj.flags & CSGNode::FLAG_HIGHLIGHT);
+			auto mode = highlight ? Renderer::ColorMode::HIGHLIGHT :
+				background_mode ? Renderer::ColorMode::BACKGROUND :
+				difference ? Renderer::ColorMode::CUTOUT : Renderer::ColorMode::MATERIAL;
+			Color4f front = resolve(mode, csgobj.leaf->color);
+			Color4f back = (highlight_mode || background_mode) ? front : fberror;
+
+			if (ps->getDimension() == 2) {
+				// Render 2D objects 1mm thick, but differences slightly larger
+				std::unique_ptr<PolySet> prism(thicken(*ps, difference ? 1.1 : 1));
+				rasterizer.addPolySet(*prism, csgobj.leaf->matrix, front, back);
+			}
+			else {
+				rasterizer.addPolySet(*ps, csgobj.leaf->matrix, front, back);
+			}
+		};
+		for (const auto &product : products.products) {
+			for (const auto &csgobj : product.intersections) add(csgobj, false);
+			for (const auto &csgobj : product.subtractions) add(csgobj, true);
+		}
+	};
+	if (csgInfo.root_products) addProducts(*csgInfo.root_products, false, false);
+	if (csgInfo.background_products) addProducts(*csgInfo.background_products, false, true);
+	if (csgInfo.highlights_products) addProducts(*csgInfo.highlights_products, true, false);
+
+	return renderViews(rasterizer, setupViews(cams, orbit, renderer.getBoundingBox()),
+										 ColorMap::getColor(*cs, RenderColor::BACKGROUND_COLOR), filename);
 }
 
 #endif // ENABLE_CGAL
@@ -30,6 +30,7 @@
 #include <assert.h>
 #include <sstream>
 #include <algorithm>
+#include <atomic>
 #include "printutils.h"
 #include "stackcheck.h"
 #include "exceptions.h"
@@ -612,6 +613,7 @@ ValuePtr LcFor::evaluate(const Context *context) const
     ValuePtr it_values = for_context.getArgValue(0, &assign_context);
 
     Context c(context);
+    bind_invariants(this->invariants, c);
 
     if (it_values->type() == Value::ValueType::RANGE) {
         RangeType range = it_values->toRange();
@@ -704,6 +706,64 @@ void LcLet::print(std::ostream &stream) const
     stream << "let(" << this->arguments << ") (" << *this->expr << ")";
 }
 
+FoldedExpression::FoldedExpression(const shared_ptr<Expression> &original, const ValuePtr &value)
+	: Expression(original->location()), original(original), value(value)
+{
+}
+
+void FoldedExpression::print(std::ostream &stream) const
+{
+	stream << *this->original;
+}
+
+HoistedExpression::HoistedExpression(const shared_ptr<Expression> &expr, const std::vector<std::string> &names)
+	: Expression(expr->location()), expr(expr), names(names)
+{
+}
+
+/*!
+	Looks up the binding in the innermost context the loop bound it to, and
+	evaluates it there on first use. The value is only reused if all
+	referenced variables are known, so the "unknown variable" warnings are
+	still issued once per use inside the loop.
+ */
+ValuePtr HoistedExpression::evaluate(const Context *context) const
+{
+	for (const Context *c = context; c; c = c->getParent()) {
+		auto it = c->invariants.find(this);
+		if (it == c->invariants.end()) continue;
+
+		Context::Invariant &invariant = it->second;
+		if (invariant.state == Context::Invariant::State::UNEVALUATED) {
+			invariant.state = Context::Invariant::State::EVALUATED;
+			for (const auto &name : this->names) {
+				const Context *owner = c;
+				while (owner && !owner->has_local_variable(name)) owner = owner->getParent();
+				if (!owner) {
+					invariant.state = Context::Invariant::State::PER_USE;
+					break;
+				}
+			}
+			if (invariant.state == Context::Invariant::State::EVALUATED) {
+				invariant.value = this->expr->evaluate(c);
+			}
+		}
+		if (invariant.state == Context::Invariant::State::EVALUATED) return invariant.value;
+		break;
+	}
+	return this->expr->evaluate(context);
+}
+
+void HoistedExpression::print(std::ostream &stream) const
+{
+	stream << *this->expr;
+}
+
+void bind_invariants(const std::vector<shared_ptr<HoistedExpression>> &invariants, Context &context)
+{
+	for (const auto &invariant : invariants) context.invariants[invariant.get()] = Context::Invariant();
+}
+
 std::ostream &operator<<(std::ostream &stream, const Expression &expr)
 {
 	expr.print(stream);
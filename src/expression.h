@@ -31,8 +31,11 @@ public:
 	UnaryOp(Op op, Expression *expr, const Location &loc);
 	virtual ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	Op getOp() const { return this->op; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 
 private:
+	friend class ASTOptimizer;
 	const char *opString() const;
 
 	Op op;
@@ -61,8 +64,12 @@ public:
 	BinaryOp(Expression *left, Op op, Expression *right, const Location &loc);
 	virtual ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	Op getOp() const { return this->op; }
+	const shared_ptr<Expression> &getLeft() const { return this->left; }
+	const shared_ptr<Expression> &getRight() const { return this->right; }
 
 private:
+	friend class ASTOptimizer;
 	const char *opString() const;
 
 	Op op;
@@ -88,7 +95,10 @@ public:
 	ArrayLookup(Expression *array, Expression *index, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const shared_ptr<Expression> &getArray() const { return this->array; }
+	const shared_ptr<Expression> &getIndex() const { return this->index; }
 private:
+	friend class ASTOptimizer;
 	shared_ptr<Expression> array;
 	shared_ptr<Expression> index;
 };
@@ -100,7 +110,9 @@ public:
 	ValuePtr evaluate(const class Context *) const;
 	virtual void print(std::ostream &stream) const;
     virtual bool isLiteral() const { return true;}
+	const ValuePtr &getValue() const { return this->value; }
 private:
+	friend class ASTOptimizer;
 	ValuePtr value;
 };
 
@@ -112,7 +124,11 @@ public:
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
 	virtual bool isLiteral() const;
+	const shared_ptr<Expression> &getBegin() const { return this->begin; }
+	const shared_ptr<Expression> &getStep() const { return this->step; }
+	const shared_ptr<Expression> &getEnd() const { return this->end; }
 private:
+	friend class ASTOptimizer;
 	shared_ptr<Expression> begin;
 	shared_ptr<Expression> step;
 	shared_ptr<Expression> end;
@@ -126,7 +142,9 @@ public:
 	virtual void print(std::ostream &stream) const;
 	void push_back(Expression *expr);
     virtual bool isLiteral() const ;
+	const std::vector<shared_ptr<Expression>> &getChildren() const { return this->children; }
 private:
+	friend class ASTOptimizer;
 	std::vector<shared_ptr<Expression>> children;
 };
 
@@ -136,7 +154,9 @@ public:
 	Lookup(const std::string &name, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const std::string &getName() const { return this->name; }
 private:
+	friend class ASTOptimizer;
 	std::string name;
 };
 
@@ -146,7 +166,10 @@ public:
 	MemberLookup(Expression *expr, const std::string &member, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
+	const std::string &getMember() const { return this->member; }
 private:
+	friend class ASTOptimizer;
 	shared_ptr<Expression> expr;
 	std::string member;
 };
@@ -169,7 +192,10 @@ public:
 	Assert(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const AssignmentList &getArguments() const { return this->arguments; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -180,7 +206,10 @@ public:
 	Echo(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const AssignmentList &getArguments() const { return this->arguments; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -191,7 +220,10 @@ public:
 	Let(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const AssignmentList &getArguments() const { return this->arguments; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
@@ -209,7 +241,11 @@ public:
 	LcIf(Expression *cond, Expression *ifexpr, Expression *elseexpr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const shared_ptr<Expression> &getCond() const { return this->cond; }
+	const shared_ptr<Expression> &getIfExpr() const { return this->ifexpr; }
+	const shared_ptr<Expression> &getElseExpr() const { return this->elseexpr; }
 private:
+	friend class ASTOptimizer;
 	shared_ptr<Expression> cond;
 	shared_ptr<Expression> ifexpr;
 	shared_ptr<Expression> elseexpr;
@@ -221,9 +257,14 @@ public:
 	LcFor(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const AssignmentList &getArguments() const { return this->arguments; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
+	// Loop invariant subexpressions of expr, see ASTOptimizer
+	std::vector<shared_ptr<class HoistedExpression>> invariants;
 };
 
 class LcForC : public ListComprehension
@@ -232,7 +273,12 @@ public:
 	LcForC(const AssignmentList &args, const AssignmentList &incrargs, Expression *cond, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const AssignmentList &getArguments() const { return this->arguments; }
+	const AssignmentList &getIncrArguments() const { return this->incr_arguments; }
+	const shared_ptr<Expression> &getCond() const { return this->cond; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	AssignmentList arguments;
 	AssignmentList incr_arguments;
 	shared_ptr<Expression> cond;
@@ -245,7 +291,9 @@ public:
 	LcEach(Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	shared_ptr<Expression> expr;
 };
 
@@ -255,9 +303,50 @@ public:
 	LcLet(const AssignmentList &args, Expression *expr, const Location &loc);
 	ValuePtr evaluate(const class Context *context) const;
 	virtual void print(std::ostream &stream) const;
+	const AssignmentList &getArguments() const { return this->arguments; }
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
 private:
+	friend class ASTOptimizer;
 	AssignmentList arguments;
 	shared_ptr<Expression> expr;
 };
 
+/*!
+	Replaces a constant subexpression after constant folding, see ASTOptimizer.
+	Evaluates to the precomputed value, but prints and reports itself like the
+	original expression so AST dumps and the customizer see the source as written.
+*/
+class FoldedExpression : public Expression
+{
+public:
+	FoldedExpression(const shared_ptr<Expression> &original, const ValuePtr &value);
+	ValuePtr evaluate(const class Context *) const { return this->value; }
+	virtual void print(std::ostream &stream) const;
+	virtual bool isLiteral() const { return this->original->isLiteral(); }
+	const shared_ptr<Expression> &getOriginal() const { return this->original; }
+private:
+	shared_ptr<Expression> original;
+	ValuePtr value;
+};
+
+/*!
+	Replaces a loop invariant subexpression of a for loop body, see ASTOptimizer.
+	The loop binds the expression to its context before iterating, and the
+	first use evaluates it in that context; later uses reuse the value. If the
+	loop didn't bind it, the expression is evaluated as usual.
+*/
+class HoistedExpression : public Expression
+{
+public:
+	HoistedExpression(const shared_ptr<Expression> &expr, const std::vector<std::string> &names);
+	ValuePtr evaluate(const class Context *context) const;
+	virtual void print(std::ostream &stream) const;
+	const shared_ptr<Expression> &getExpr() const { return this->expr; }
+private:
+	shared_ptr<Expression> expr;
+	// Variables referenced by expr
+	std::vector<std::string> names;
+};
+
+void bind_invariants(const std::vector<shared_ptr<HoistedExpression>> &invariants, class Context &context);
 void evaluate_assert(const Context &context, const class EvalContext *evalctx, const Location &loc);
\ No newline at end of file
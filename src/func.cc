@@ -35,6 +35,7 @@
 #include "exceptions.h"
 #include "memory.h"
 #include "UserModule.h"
+#include "ValueIndex.h"
 
 #include <cmath>
 #include <sstream>
@@ -529,6 +530,10 @@ ValuePtr builtin_lookup(const Context *, const EvalContext *evalctx)
 
 	if (!vec[0]->getVec2(low_p, low_v) || !vec[0]->getVec2(high_p, high_v))
 		return ValuePtr::undefined;
+	if (vec.size() >= ValueIndex::MIN_INDEXED_SIZE) {
+		double result;
+		if (vec.getIndex().lookup(vec, p, result)) return ValuePtr(result);
+	}
 	for (size_t i = 1; i < vec.size(); i++) {
 		double this_p, this_v;
 		if (vec[i]->getVec2(this_p, this_v)) {
@@ -637,9 +642,11 @@ static Value::VectorType search(const std::string &find, const std::string &tabl
 	return returnvec;
 }
 
-static Value::VectorType search(const std::string &find, const Value::VectorType &table,
+static Value::VectorType search(const std::string &find, const ValuePtr &tableValue,
 																unsigned int num_returns_per_match, unsigned int index_col_num)
 {
+	const Value::VectorType &table = tableValue->toVector();
+	ValueIndex *index = table.size() >= ValueIndex::MIN_INDEXED_SIZE ? &table.getIndex() : nullptr;
 	Value::VectorType returnvec;
 	//Unicode glyph count for the length
 	unsigned int findThisSize =  g_utf8_strlen(find.c_str(), find.size());
@@ -648,7 +655,22 @@ static Value::VectorType search(const std::string &find, const Value::VectorType
 		unsigned int matchCount = 0;
 		Value::VectorType resultvec;
 		const gchar *ptr_ft = g_utf8_offset_to_pointer(find.c_str(), i);
-		for (size_t j = 0; j < searchTableSize; j++) {
+		const ValueIndex::Matches *matches = (index && ptr_ft) ? index->findFirstChar(table, index_col_num, g_utf8_get_char(ptr_ft)) : nullptr;
+		if (matches) {
+			for (auto j : *matches) {
+				matchCount++;
+				if (num_returns_per_match == 1) {
+					returnvec.push_back(ValuePtr(double(j)));
+					break;
+				} else {
+					resultvec.push_back(ValuePtr(double(j)));
+				}
+				if (num_returns_per_match > 1 && matchCount >= num_returns_per_match) {
+					break;
+				}
+			}
+		}
+		else for (size_t j = 0; j < searchTableSize; j++) {
 			const Value::VectorType &entryVec = table[j]->toVector();
 			if (entryVec.size() <= index_col_num) {
 				PRINTB("WARNING: Invalid entry in search vector at index %d, required number of values in the entry: %d. Invalid entry: %s", j % (index_col_num + 1) % table[j]);
@@ -680,6 +702,37 @@ static Value::VectorType search(const std::string &find, const Value::VectorType
 	return returnvec;
 }
 
+/*!
+	Returns the indices of the entries of table matching find_value, at most
+	max_matches of them, or all if max_matches is 0.
+ */
+static std::vector<uint32_t> search_matches(const ValuePtr &find_value, const ValuePtr &table,
+																						unsigned int max_matches, unsigned int index_col_num)
+{
+	std::vector<uint32_t> matches;
+	const Value::VectorType &tableVec = table->toVector();
+
+	if (tableVec.size() >= ValueIndex::MIN_INDEXED_SIZE) {
+		if (auto indexed = tableVec.getIndex().find(tableVec, index_col_num, *find_value)) {
+			size_t count = (max_matches == 0) ? indexed->size() : std::min<size_t>(max_matches, indexed->size());
+			matches.assign(indexed->begin(), indexed->begin() + count);
+			return matches;
+		}
+	}
+
+	for (size_t j = 0; j < tableVec.size(); j++) {
+		const ValuePtr &search_element = tableVec[j];
+
+		if ((index_col_num == 0 && find_value == search_element) ||
+				(index_col_num < search_element->toVector().size() &&
+				 find_value    == search_element->toVector()[index_col_num])) {
+			matches.push_back(j);
+			if (max_matches != 0 && matches.size() >= max_matches) break;
+		}
+	}
+	return matches;
+}
+
 ValuePtr builtin_search(const Context *, const EvalContext *evalctx)
 {
 	if (evalctx->numArgs() < 2) return ValuePtr::undefined;
@@ -692,55 +745,25 @@ ValuePtr builtin_search(const Context *, const EvalContext *evalctx)
 	Value::VectorType returnvec;
 
 	if (findThis->type() == Value::ValueType::NUMBER) {
-		unsigned int matchCount = 0;
-
-		for (size_t j = 0; j < searchTable->toVector().size(); j++) {
-			const ValuePtr &search_element = searchTable->toVector()[j];
-
-			if ((index_col_num == 0 && findThis == search_element) ||
-					(index_col_num < search_element->toVector().size() &&
-					 findThis      == search_element->toVector()[index_col_num])) {
-				returnvec.push_back(ValuePtr(double(j)));
-				matchCount++;
-				if (num_returns_per_match != 0 && matchCount >= num_returns_per_match) break;
-			}
+		for (auto j : search_matches(findThis, searchTable, num_returns_per_match, index_col_num)) {
+			returnvec.push_back(ValuePtr(double(j)));
 		}
 	} else if (findThis->type() == Value::ValueType::STRING) {
 		if (searchTable->type() == Value::ValueType::STRING) {
 			returnvec = search(findThis->toString(), searchTable->toString(), num_returns_per_match);
 		}
 		else {
-			returnvec = search(findThis->toString(), searchTable->toVector(), num_returns_per_match, index_col_num);
+			returnvec = search(findThis->toString(), searchTable, num_returns_per_match, index_col_num);
 		}
 	} else if (findThis->type() == Value::ValueType::VECTOR) {
-		for (size_t i = 0; i < findThis->toVector().size(); i++) {
-		  unsigned int matchCount = 0;
+		for (const auto &find_value : findThis->toVector()) {
 			Value::VectorType resultvec;
-
-			const ValuePtr &find_value = findThis->toVector()[i];
-
-			for (size_t j = 0; j < searchTable->toVector().size(); j++) {
-
-				const ValuePtr &search_element = searchTable->toVector()[j];
-
-				if ((index_col_num == 0 && find_value == search_element) ||
-						(index_col_num < search_element->toVector().size() &&
-						 find_value    == search_element->toVector()[index_col_num])) {
-					ValuePtr resultValue((double(j)));
-		      matchCount++;
-		      if (num_returns_per_match == 1) {
-						returnvec.push_back(resultValue);
-						break;
-		      } else {
-						resultvec.push_back(resultValue);
-		      }
-		      if (num_returns_per_match > 1 && matchCount >= num_returns_per_match) break;
-		    }
-		  }
-		  if (num_returns_per_match == 1 && matchCount == 0) {
-		    returnvec.push_back(ValuePtr(resultvec));
-		  }
-		  if (num_returns_per_match == 0 || num_returns_per_match > 1) {
+			for (auto j : search_matches(find_value, searchTable, num_returns_per_match, index_col_num)) {
+				resultvec.push_back(ValuePtr(double(j)));
+			}
+			if (num_returns_per_match == 1 && !resultvec.empty()) {
+				returnvec.push_back(resultvec[0]);
+			} else {
 				returnvec.push_back(ValuePtr(resultvec));
 			}
 		}
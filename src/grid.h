@@ -83,90 +83,3 @@ public:
 		return align(x, y);
 	}
 };
-
-template <typename T>
-class Grid3d
-{
-public:
-	double res;
-	typedef Vector3l Key;
-	typedef std::unordered_map<Key, T> GridContainer;
-	GridContainer db;
-
-	Grid3d(double resolution) {
-		res = resolution;
-	}
-
-	inline void createGridVertex(const Vector3d &v, Vector3l &i) {
-		i[0] = int64_t(v[0] / this->res);
-		i[1] = int64_t(v[1] / this->res);
-		i[2] = int64_t(v[2] / this->res);
-	}
-
-	// Aligns vertex to the grid. Returns index of the vertex.
-	// Will automatically increase the index as new unique vertices are added.
-	T align(Vector3d &v) {
-		Vector3l key;
-		createGridVertex(v, key);
-		typename GridContainer::iterator iter = db.find(key);
-		if (iter == db.end()) {
-			float dist = 10.0f; // > max possible distance
-			for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++) {
-				for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++) {
-					for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
-						Vector3l k(jx, jy, jz);
-						typename GridContainer::iterator tmpiter = db.find(k);
-						if (tmpiter == db.end()) continue;
-						float d = sqrt((key-k).squaredNorm());
-						if (d < dist) {
-						  dist = d;
-							iter = tmpiter;
-						}
-					}
-				}
-			}
-		}
-
-		T data;
-		if (iter == db.end()) { // Not found: insert using key
-			data = db.size();
-			db[key] = data;
-		}
-		else {
-			// If found return existing data
-			key = iter->first;
-			data = iter->second;
-		}
-
-		// Align vertex
-		v[0] = key[0] * this->res;
-		v[1] = key[1] * this->res;
-		v[2] = key[2] * this->res;
-
-		return data;
-	}
-
-	bool has(const Vector3d &v, T *data = nullptr) {
-		Vector3l key = createGridVertex(v);
-		typename GridContainer::iterator pos = db.find(key);
-		if (pos != db.end()) {
-			if (data) *data = pos->second;
-			return true;
-		}
-		for (int64_t jx = key[0] - 1; jx <= key[0] + 1; jx++)
-			for (int64_t jy = key[1] - 1; jy <= key[1] + 1; jy++)
-				for (int64_t jz = key[2] - 1; jz <= key[2] + 1; jz++) {
-					pos = db.find(Vector3l(jx, jy, jz));
-					if (pos != db.end()) {
-						if (data) *data = pos->second;
-						return true;
-					}
-				}
-		return false;
-	}
-
-	T data(Vector3d v) { 
-		return align(v);
-	}
-
-};
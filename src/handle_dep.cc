@@ -3,17 +3,21 @@
 #include <sstream>
 #include <stdlib.h> // for system()
 #include <unordered_set>
+#include <mutex>
 #include <boost/regex.hpp>
 #include <boost/filesystem.hpp>
 namespace fs = boost::filesystem;
 
 std::unordered_set<std::string> dependencies;
 const char *make_command = nullptr;
+// Libraries may be parsed concurrently, see ModuleCache::prefetch()
+static std::mutex dependencies_mutex;
 
 void handle_dep(const std::string &filename)
 {
 	fs::path filepath(filename);
 	std::string dep = boost::regex_replace(filepath.generic_string(), boost::regex("\\ "), "\\\\ ");
+	std::lock_guard<std::mutex> lock(dependencies_mutex);
 	if (dependencies.find(dep) != dependencies.end()) {
 		return; // included and used files are very likely to be added many times by the parser
 	}
@@ -34,6 +34,8 @@
 #include "CGAL_Nef_polyhedron.h"
 #endif
 #include "Polygon2d.h"
+#include "clipper-utils.h"
+#include "ImportCache.h"
 #include "evalcontext.h"
 #include "builtin.h"
 #include "dxfdata.h"
@@ -152,6 +154,52 @@ AbstractNode *ImportModule::instantiate(const Context *ctx, const ModuleInstanti
 	Will return an empty geometry if the import failed, but not nullptr
 */
 const Geometry *ImportNode::createGeometry() const
+{
+	auto geom = getGeometry();
+	return geom ? geom->copy() : nullptr;
+}
+
+/*!
+	Returns the geometry from the ImportCache if the file was imported before,
+	after printing the messages of that import again.
+*/
+shared_ptr<const Geometry> ImportNode::getGeometry() const
+{
+	// Only DXF parsing depends on parameters other than the file
+	std::ostringstream options;
+	if (this->type == ImportType::DXF) {
+		options << this->layername << '\0' << this->origin_x << ',' << this->origin_y << ',' << this->scale
+						<< '\0' << this->fn << ',' << this->fs << ',' << this->fa;
+	}
+	auto key = ImportCache::key(this->filename, int(this->type), options.str());
+	DeferredMessages messages;
+	shared_ptr<const Geometry> cached;
+	if (!key.empty()) cached = ImportCache::instance()->get(key, messages);
+
+	if (cached) {
+		print_deferred_messages(messages);
+		if (cached->getConvexity() == static_cast<unsigned int>(this->convexity)) return cached;
+		// Convexity doesn't affect parsing, but is part of the geometry
+		Geometry *g = cached->copy();
+		g->setConvexity(this->convexity);
+		return shared_ptr<const Geometry>(g);
+	}
+
+	auto previous = print_messages_defer(&messages);
+	Geometry *g = importGeometry();
+	print_messages_defer(previous);
+	print_deferred_messages(messages);
+	if (!g) return nullptr;
+
+	g->setConvexity(this->convexity);
+	shared_ptr<const Geometry> geom(g);
+	if (!g->isEmpty() && !key.empty() && g->memsize() <= ImportCache::instance()->maxSize()) {
+		ImportCache::instance()->insert(key, geom, messages);
+	}
+	return geom;
+}
+
+Geometry *ImportNode::importGeometry() const
 {
 	Geometry *g = nullptr;
 
@@ -188,7 +236,13 @@ const Geometry *ImportNode::createGeometry() const
 		g = new PolySet(0);
 	}
 
-	if (g) g->setConvexity(this->convexity);
+	// Sanitize once here rather than for every copy taken from the cache
+	if (auto polygon = dynamic_cast<Polygon2d *>(g)) {
+		if (!polygon->isSanitized()) {
+			g = ClipperUtils::sanitize(*polygon);
+			delete polygon;
+		}
+	}
 	return g;
 }
 
@@ -29,4 +29,8 @@ public:
 	double origin_x, origin_y, scale;
 	double width, height;
 	virtual const class Geometry *createGeometry() const;
+	virtual shared_ptr<const class Geometry> getGeometry() const;
+
+private:
+	class Geometry *importGeometry() const;
 };
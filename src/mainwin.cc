@@ -26,7 +26,9 @@
 #include <iostream>
 #include "comment.h"
 #include "openscad.h"
+#include "SourceBuffer.h"
 #include "GeometryCache.h"
+#include "ImportCache.h"
 #include "ModuleCache.h"
 #include "MainWindow.h"
 #include "OpenSCADApp.h"
@@ -1178,10 +1180,13 @@ void MainWindow::compileCSG(bool procevents)
 	if (procevents) QApplication::processEvents();
 
 	size_t normalizelimit = 2 * Preferences::inst()->getValue("advanced/openCSGLimit").toUInt();
-	CSGTreeNormalizer normalizer(normalizelimit);
+	// Kept across compiles, so unchanged subtrees aren't normalized again
+	if (!this->normalizer) this->normalizer.reset(new CSGTreeNormalizer(normalizelimit));
+	else this->normalizer->setLimit(normalizelimit);
+	this->normalizer->setMemoryLimit(GeometryCache::instance()->maxSize());
 	
 	if (this->csgRoot) {
-		this->normalizedRoot = normalizer.normalize(this->csgRoot);
+		this->normalizedRoot = this->normalizer->normalize(this->csgRoot);
 		if (this->normalizedRoot) {
 			this->root_products.reset(new CSGProducts());
 			this->root_products->import(this->normalizedRoot);
@@ -1200,8 +1205,8 @@ void MainWindow::compileCSG(bool procevents)
 		
 		this->highlights_products.reset(new CSGProducts());
 		for (unsigned int i = 0; i < highlight_terms.size(); i++) {
-			auto nterm = normalizer.normalize(highlight_terms[i]);
-			this->highlights_products->import(nterm);
+			auto nterm = this->normalizer->normalize(highlight_terms[i]);
+			if (nterm) this->highlights_products->import(nterm);
 		}
 	}
 	else {
@@ -1215,8 +1220,8 @@ void MainWindow::compileCSG(bool procevents)
 		
 		this->background_products.reset(new CSGProducts());
 		for (unsigned int i = 0; i < background_terms.size(); i++) {
-			auto nterm = normalizer.normalize(background_terms[i]);
-			this->background_products->import(nterm);
+			auto nterm = this->normalizer->normalize(background_terms[i]);
+			if (nterm) this->background_products->import(nterm);
 		}
 	}
 	else {
@@ -1239,9 +1244,28 @@ void MainWindow::compileCSG(bool procevents)
 																								this->qglview->shaderinfo);
 	}
 #endif
-	this->thrownTogetherRenderer = new ThrownTogetherRenderer(this->root_products,
-																														this->highlights_products,
-																														this->background_products);
+
+	// ThrownTogether shows subtracted objects, so its products aren't pruned while normalizing
+	if (!this->thrownTogetherNormalizer) {
+		this->thrownTogetherNormalizer.reset(new CSGTreeNormalizer(normalizelimit, GeometryCache::instance()->maxSize(), false));
+	}
+	else this->thrownTogetherNormalizer->setLimit(normalizelimit);
+	this->thrownTogetherNormalizer->setMemoryLimit(GeometryCache::instance()->maxSize());
+	auto normalizeTerms = [this](const std::vector<shared_ptr<CSGNode> > &terms) {
+		shared_ptr<CSGProducts> products;
+		for (const auto &term : terms) {
+			auto nterm = this->thrownTogetherNormalizer->normalize(term);
+			if (!nterm) continue;
+			if (!products) products.reset(new CSGProducts());
+			products->import(nterm);
+		}
+		return products;
+	};
+	std::vector<shared_ptr<CSGNode> > root_terms;
+	if (this->csgRoot) root_terms.push_back(this->csgRoot);
+	this->thrownTogetherRenderer = new ThrownTogetherRenderer(normalizeTerms(root_terms),
+																														normalizeTerms(highlight_terms),
+																														normalizeTerms(background_terms));
 	PRINT("Compile and preview finished.");
 	int s = this->renderingTime.elapsed() / 1000;
 	PRINTB("Total rendering time: %d hours, %d minutes, %d seconds", (s / (60*60)) % ((s / 60) % 60) % (s % 60));
@@ -1743,18 +1767,20 @@ void MainWindow::compileTopLevelDocument(bool rebuildParameterWidget)
 
 	this->last_compiled_doc = editor->toPlainText();
 
-	auto fulltext =
-		std::string(this->last_compiled_doc.toUtf8().constData()) +
-		"\n" + commandline_commands;
+	auto doc = this->last_compiled_doc.toUtf8();
+	// QByteArray ends with a NUL byte, the lexer needs two
+	doc.append('\0');
+	SourceBuffer source(doc.data(), doc.size() - 1);
 	
 	auto fnameba = this->fileName.toLocal8Bit();
 	const char* fname = this->fileName.isEmpty() ? "" : fnameba;
 	delete this->parsed_module;
-	this->root_module = parse(this->parsed_module, fulltext.c_str(), fs::path(fname), false) ? this->parsed_module : nullptr;
+	this->root_module = parse(this->parsed_module, source, fs::path(fname), false) ? this->parsed_module : nullptr;
 
 	if (Feature::ExperimentalCustomizer.is_enabled()) {
 		if (this->root_module!=nullptr) {
 			//add parameters as annotation in AST
+			auto fulltext = std::string(source.data(), source.size()) + "\n" + commandline_commands;
 			CommentParser::collectParameters(fulltext.c_str(),this->root_module);
 		}
 		this->parameterWidget->setParameters(this->root_module,rebuildParameterWidget);
@@ -2276,12 +2302,15 @@ void MainWindow::actionCopyViewport()
 void MainWindow::actionFlushCaches()
 {
 	GeometryCache::instance()->clear();
+	ImportCache::instance()->clear();
 #ifdef ENABLE_CGAL
 	CGALCache::instance()->clear();
 #endif
 	dxf_dim_cache.clear();
 	dxf_cross_cache.clear();
 	ModuleCache::instance()->clear();
+	this->normalizer.reset();
+	this->thrownTogetherNormalizer.reset();
 }
 
 void MainWindow::viewModeActionsUncheck()
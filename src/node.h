@@ -3,6 +3,7 @@
 #include <vector>
 #include <string>
 #include "BaseVisitable.h"
+#include "memory.h"
 
 extern int progress_report_count;
 extern void (*progress_report_f)(const class AbstractNode*, void*, int);
@@ -111,6 +112,11 @@ public:
 	LeafNode(const ModuleInstantiation *mi) : AbstractPolyNode(mi) { };
 	virtual ~LeafNode() { };
 	virtual const class Geometry *createGeometry() const = 0;
+	// Returns the geometry of the node. Nodes whose geometry can be shared
+	// with other nodes override this to avoid copying it.
+	virtual shared_ptr<const class Geometry> getGeometry() const {
+		return shared_ptr<const class Geometry>(createGeometry());
+	}
 };
 
 std::ostream &operator<<(std::ostream &stream, const AbstractNode &node);
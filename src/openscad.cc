@@ -25,6 +25,7 @@
  */
 
 #include "openscad.h"
+#include "SourceBuffer.h"
 #include "comment.h"
 #include "node.h"
 #include "module.h"
@@ -35,6 +36,7 @@
 #include "builtin.h"
 #include "printutils.h"
 #include "handle_dep.h"
+#include "ASTCache.h"
 #include "feature.h"
 #include "parsersettings.h"
 #include "rendersettings.h"
@@ -55,6 +57,8 @@
 #ifdef ENABLE_CGAL
 #include "CGAL_Nef_polyhedron.h"
 #include "cgalutils.h"
+#include "GmpAllocator.h"
+#include "ShardedRenderer.h"
 #endif
 
 #include "csgnode.h"
@@ -91,6 +95,11 @@ std::string commandline_commands;
 std::string currentdir;
 static bool arg_info = false;
 static std::string arg_colorscheme;
+static unsigned int arg_slices = 0;
+static unsigned int arg_jobs = 1;
+static bool arg_cpu_render = false;
+static unsigned int arg_orbit = 1;
+static unsigned int arg_animate = 0;
 
 #define QUOTE(x__) # x__
 #define QUOTED(x__) QUOTE(x__)
@@ -146,7 +155,8 @@ static void help(const char *progname, bool failure = false)
          "%2%[ --imgsize=width,height ] [ --projection=(o)rtho|(p)ersp] \\\n"
          "%2%[ --render | --preview[=throwntogether] ] \\\n"
          "%2%[ --colorscheme=[Cornfield|Sunset|Metallic|Starnight|BeforeDawn|Nature|DeepOcean] ] \\\n"
-         "%2%[ --csglimit=num ]"
+         "%2%[ --csglimit=num ] [ --ast-cache=directory ] [ --slices=num ] \\\n"
+         "%2%[ --jobs=num ] [ --render-backend=gl|cpu ] [ --orbit=frames ] [ --animate=frames ]"
 #ifdef ENABLE_EXPERIMENTAL
          " [ --enable=<feature> ] \\\n"
          "%2%[ -p <Parameter Filename>] [-P <Parameter Set>] "
@@ -202,53 +212,64 @@ void localization_init() {
 	}
 }
 
-Camera get_camera(po::variables_map vm)
+std::vector<Camera> get_cameras(po::variables_map vm)
 {
-	Camera camera;
+	std::vector<Camera> cameras;
 
 	if (vm.count("camera")) {
-		vector<string> strs;
-		vector<double> cam_parameters;
-		split(strs, vm["camera"].as<string>(), is_any_of(","));
-		if (strs.size() == 6 || strs.size() == 7) {
-			try {
-				for (const auto &s : strs) cam_parameters.push_back(lexical_cast<double>(s));
-				camera.setup(cam_parameters);
+		for (const auto &spec : vm["camera"].as<vector<string>>()) {
+			Camera camera;
+			vector<string> strs;
+			vector<double> cam_parameters;
+			split(strs, spec, is_any_of(","));
+			if (strs.size() == 6 || strs.size() == 7) {
+				try {
+					for (const auto &s : strs) cam_parameters.push_back(lexical_cast<double>(s));
+					camera.setup(cam_parameters);
+				}
+				catch (bad_lexical_cast &) {
+					PRINT("Camera setup requires numbers as parameters");
+				}
+			} else {
+				PRINT("Camera setup requires either 7 numbers for Gimbal Camera");
+				PRINT("or 6 numbers for Vector Camera");
+				exit(1);
 			}
-			catch (bad_lexical_cast &) {
-				PRINT("Camera setup requires numbers as parameters");
+			if (camera.type == Camera::CameraType::GIMBAL) {
+				camera.gimbalDefaultTranslate();
 			}
-		} else {
-			PRINT("Camera setup requires either 7 numbers for Gimbal Camera");
-			PRINT("or 6 numbers for Vector Camera");
-			exit(1);
+			cameras.push_back(camera);
 		}
 	}
-
-	if (camera.type == Camera::CameraType::GIMBAL) {
-		camera.gimbalDefaultTranslate();
+	else {
+		cameras.emplace_back();
 	}
 
-	if (vm.count("viewall")) {
-		camera.viewall = true;
-	}
+	// The remaining settings apply to all cameras
+	for (auto &camera : cameras) {
+		if (vm.count("viewall")) {
+			camera.viewall = true;
+		}
 
-	if (vm.count("autocenter")) {
-		camera.autocenter = true;
+		if (vm.count("autocenter")) {
+			camera.autocenter = true;
+		}
 	}
 
 	if (vm.count("projection")) {
 		auto proj = vm["projection"].as<string>();
+		auto projection = Camera::ProjectionType::PERSPECTIVE;
 		if (proj == "o" || proj == "ortho" || proj == "orthogonal") {
-			camera.projection = Camera::ProjectionType::ORTHOGONAL;
+			projection = Camera::ProjectionType::ORTHOGONAL;
 		}
 		else if (proj=="p" || proj=="perspective") {
-			camera.projection = Camera::ProjectionType::PERSPECTIVE;
+			projection = Camera::ProjectionType::PERSPECTIVE;
 		}
 		else {
 			PRINT("projection needs to be 'o' or 'p' for ortho or perspective\n");
 			exit(1);
 		}
+		for (auto &camera : cameras) camera.projection = projection;
 	}
 
 	auto w = RenderSettings::inst()->img_width;
@@ -269,10 +290,12 @@ Camera get_camera(po::variables_map vm)
 			}
 		}
 	}
-	camera.pixel_width = w;
-	camera.pixel_height = h;
+	for (auto &camera : cameras) {
+		camera.pixel_width = w;
+		camera.pixel_height = h;
+	}
 
-	return camera;
+	return cameras;
 }
 
 #ifndef OPENSCAD_NOGUI
@@ -294,6 +317,57 @@ static bool checkAndExport(shared_ptr<const Geometry> root_geom, unsigned nd,
 	return true;
 }
 
+static bool checkAndExportSlices(shared_ptr<const Geometry> root_geom,
+																 FileFormat format, const char *filename)
+{
+	if (root_geom->getDimension() != 3) {
+		PRINT("Current top level object is not a 3D object.");
+		return false;
+	}
+	if (root_geom->isEmpty()) {
+		PRINT("Current top level object is empty.");
+		return false;
+	}
+	return exportSlices(root_geom, format, arg_slices, filename);
+}
+
+#ifdef ENABLE_CGAL
+static shared_ptr<const Geometry> evaluateRootGeometry(const Tree &tree, GeometryEvaluator &geomevaluator, RenderType renderer)
+{
+	if (arg_jobs > 1) ShardedRenderer::prerender(geomevaluator, *tree.root(), arg_jobs);
+	shared_ptr<const Geometry> root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
+	if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
+	if (renderer == RenderType::CGAL && root_geom->getDimension() == 3) {
+		auto N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
+		if (!N) {
+			N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
+			root_geom.reset(N);
+			PRINT("Converted to Nef polyhedron");
+		}
+	}
+	return root_geom;
+}
+
+static bool exportPng(Tree &tree, const shared_ptr<const Geometry> &root_geom, RenderType renderer,
+											const std::vector<Camera> &cameras, const std::string &filename)
+{
+	if (arg_cpu_render) {
+		// There is no CPU implementation of OpenCSG, previews are thrown together
+		if (renderer == RenderType::CGAL || renderer == RenderType::GEOMETRY) {
+			return export_png_software(root_geom, cameras, arg_orbit, filename.c_str());
+		}
+		return export_png_software_throwntogether(tree, cameras, arg_orbit, filename.c_str());
+	}
+	if (renderer == RenderType::CGAL || renderer == RenderType::GEOMETRY) {
+		return export_png(root_geom, cameras, arg_orbit, filename.c_str());
+	}
+	if (renderer == RenderType::THROWNTOGETHER) {
+		return export_png_with_throwntogether(tree, cameras, arg_orbit, filename.c_str());
+	}
+	return export_png_with_opencsg(tree, cameras, arg_orbit, filename.c_str());
+}
+#endif
+
 void set_render_color_scheme(const std::string color_scheme, const bool exit_if_not_found)
 {
 	if (color_scheme.empty()) {
@@ -318,7 +392,7 @@ void set_render_color_scheme(const std::string color_scheme, const bool exit_if_
 
 #include <QCoreApplication>
 
-int cmdline(const char *deps_output_file, const std::string &filename, Camera &camera, const char *output_file, const fs::path &original_path, RenderType renderer,const std::string &parameterFile,const std::string &setName, int argc, char ** argv )
+int cmdline(const char *deps_output_file, const std::string &filename, const std::vector<Camera> &cameras, const char *output_file, const fs::path &original_path, RenderType renderer,const std::string &parameterFile,const std::string &setName, int argc, char ** argv )
 {
 #ifdef OPENSCAD_QTGUI
 	QCoreApplication app(argc, argv);
@@ -370,6 +444,10 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 		PRINTB("Unknown suffix for output file %s\n", output_file);
 		return 1;
 	}
+	if (arg_slices > 0 && !dxf_output_file && !svg_output_file) {
+		PRINTB("--slices needs a dxf or svg output file, not %s\n", output_file);
+		return 1;
+	}
 
 	set_render_color_scheme(arg_colorscheme, true);
 	
@@ -394,15 +472,13 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 
 	handle_dep(filename);
 
-	std::ifstream ifs(filename.c_str());
-	if (!ifs.is_open()) {
+	SourceBuffer source;
+	if (!source.load(filename)) {
 		PRINTB("Can't open input file '%s'!\n", filename.c_str());
 		return 1;
 	}
-	std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-	text += "\n" + commandline_commands;
 	auto abspath = fs::absolute(filename);
-	if (!parse(root_module, text.c_str(), abspath, false)) {
+	if (!parse(root_module, source, abspath, false)) {
 		delete root_module;  // parse failed
 		root_module = nullptr;
 	}
@@ -413,6 +489,7 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 
 	if (Feature::ExperimentalCustomizer.is_enabled()) {
 		// add parameter to AST
+		std::string text = std::string(source.data(), source.size()) + "\n" + commandline_commands;
 		CommentParser::collectParameters(text.c_str(), root_module);
 		if (!parameterFile.empty() && !setName.empty()) {
 			ParameterSet param;
@@ -490,6 +567,35 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 			fstream.close();
 		}
 	}
+	else if (png_output_file && arg_animate > 0) {
+#ifdef ENABLE_CGAL
+		// The file is parsed once, each frame instantiates it again with its own
+		// $t, as the animation in the GUI does. Unchanged subtrees come from the
+		// geometry caches, and all frames share one offscreen context.
+		auto png_file = fs::absolute(png_output_file, original_path).string();
+		for (unsigned int i = 0; i < arg_animate; i++) {
+			if (i > 0) {
+				delete absolute_root_node;
+				top_ctx.set_variable("$t", ValuePtr(double(i) / arg_animate));
+				AbstractNode::resetIndexCounter();
+				absolute_root_node = root_module->instantiate(&top_ctx, &root_inst, nullptr);
+				if (!(root_node = find_root_tag(absolute_root_node))) {
+					root_node = absolute_root_node;
+				}
+				tree.setRoot(root_node);
+			}
+			if (renderer == RenderType::CGAL || renderer == RenderType::GEOMETRY) {
+				root_geom = evaluateRootGeometry(tree, geomevaluator, renderer);
+			}
+			if (!exportPng(tree, root_geom, renderer, cameras, numberedFilename(png_file, i, arg_animate))) {
+				return 1;
+			}
+		}
+#else
+		PRINT("OpenSCAD has been compiled without CGAL support!\n");
+		return 1;
+#endif
+	}
 	else {
 #ifdef ENABLE_CGAL
 		if ((echo_output_file || png_output_file) &&
@@ -497,16 +603,7 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 			// echo or OpenCSG png -> don't necessarily need geometry evaluation
 		} else {
 			// Force creation of CGAL objects (for testing)
-			root_geom = geomevaluator.evaluateGeometry(*tree.root(), true);
-			if (!root_geom) root_geom.reset(new CGAL_Nef_polyhedron());
-			if (renderer == RenderType::CGAL && root_geom->getDimension() == 3) {
-				auto N = dynamic_cast<const CGAL_Nef_polyhedron*>(root_geom.get());
-				if (!N) {
-					N = CGALUtils::createNefPolyhedronFromGeometry(*root_geom);
-					root_geom.reset(N);
-					PRINT("Converted to Nef polyhedron");
-				}
-			}
+			root_geom = evaluateRootGeometry(tree, geomevaluator, renderer);
 		}
 
 		fs::current_path(original_path);
@@ -530,35 +627,21 @@ int cmdline(const char *deps_output_file, const std::string &filename, Camera &c
 		}
 
 		if (dxf_output_file) {
-			if (!checkAndExport(root_geom, 2, FileFormat::DXF, dxf_output_file)) {
+			if (arg_slices > 0 ? !checkAndExportSlices(root_geom, FileFormat::DXF, dxf_output_file) :
+					!checkAndExport(root_geom, 2, FileFormat::DXF, dxf_output_file)) {
 				return 1;
 			}
 		}
 		
 		if (svg_output_file) {
-			if (!checkAndExport(root_geom, 2, FileFormat::SVG, svg_output_file)) {
+			if (arg_slices > 0 ? !checkAndExportSlices(root_geom, FileFormat::SVG, svg_output_file) :
+					!checkAndExport(root_geom, 2, FileFormat::SVG, svg_output_file)) {
 				return 1;
 			}
 		}
 
 		if (png_output_file) {
-			auto success = true;
-			std::ofstream fstream(png_output_file,std::ios::out|std::ios::binary);
-			if (!fstream.is_open()) {
-				PRINTB("Can't open file \"%s\" for export", png_output_file);
-				success = false;
-			}
-			else {
-				if (renderer == RenderType::CGAL || renderer == RenderType::GEOMETRY) {
-					success = export_png(root_geom, camera, fstream);
-				} else if (renderer == RenderType::THROWNTOGETHER) {
-					success = export_png_with_throwntogether(tree, camera, fstream);
-				} else {
-					success = export_png_with_opencsg(tree, camera, fstream);
-				}
-				fstream.close();
-			}
-			return success ? 0 : 1;
+			return exportPng(tree, root_geom, renderer, cameras, png_output_file) ? 0 : 1;
 		}
 
 		if (nefdbg_output_file) {
@@ -812,6 +895,7 @@ int main(int argc, char **argv)
 	// Causes CGAL errors to abort directly instead of throwing exceptions
 	// (which we don't catch). This gives us stack traces without rerunning in gdb.
 	CGAL::set_error_behaviour(CGAL::ABORT);
+	GmpAllocator::install();
 #endif
 	Builtins::instance()->initialize();
 
@@ -828,7 +912,7 @@ int main(int argc, char **argv)
 		("render", po::value<string>()->implicit_value(""), "if exporting a png image, do a full geometry evaluation")
 		("preview", po::value<string>()->implicit_value(""), "if exporting a png image, do an OpenCSG(default) or ThrownTogether preview")
 		("csglimit", po::value<unsigned int>(), "if exporting a png image, stop rendering at the given number of CSG elements")
-		("camera", po::value<string>(), "parameters for camera when exporting png")
+		("camera", po::value<vector<string>>(), "parameters for camera when exporting png, repeat for several images")
 		("autocenter", "adjust camera to look at object center")
 		("viewall", "adjust camera to fit object")
 		("imgsize", po::value<string>(), "=width,height for exporting png")
@@ -836,6 +920,12 @@ int main(int argc, char **argv)
 		("colorscheme", po::value<string>(), "colorscheme")
 		("debug", po::value<string>(), "special debug info")
 		("quiet,q", "quiet mode (don't print anything *except* errors)")
+		("ast-cache", po::value<string>(), "directory for caching parsed libraries")
+		("jobs", po::value<unsigned int>(), "=num render independent subtrees in num worker processes")
+		("render-backend", po::value<string>(), "=gl (default) or cpu, how to render png images")
+		("orbit", po::value<unsigned int>(), "=frames export png images turning each camera around the z axis in frames steps")
+		("animate", po::value<unsigned int>(), "=frames export png images of frames animation steps")
+		("slices", po::value<unsigned int>(), "=num export evenly spaced slices of a 3D object as numbered dxf or svg files")
 		("o,o", po::value<string>(), "out-file")
 		("p,p", po::value<string>(), "parameter file")
 		("P,P", po::value<string>(), "parameter set")
@@ -893,6 +983,32 @@ int main(int argc, char **argv)
 		else renderer = RenderType::GEOMETRY;
 	}
 
+	if (vm.count("ast-cache")) {
+		ASTCache::setDirectory(vm["ast-cache"].as<string>());
+	}
+
+	if (vm.count("jobs")) {
+		arg_jobs = vm["jobs"].as<unsigned int>();
+	}
+
+	if (vm.count("render-backend")) {
+		const auto &backend = vm["render-backend"].as<string>();
+		if (backend == "cpu") arg_cpu_render = true;
+		else if (backend != "gl") PRINTB("Unknown render backend '%s', using gl.", backend);
+	}
+
+	if (vm.count("orbit")) {
+		arg_orbit = vm["orbit"].as<unsigned int>();
+	}
+
+	if (vm.count("animate")) {
+		arg_animate = vm["animate"].as<unsigned int>();
+	}
+
+	if (vm.count("slices")) {
+		arg_slices = vm["slices"].as<unsigned int>();
+	}
+
 	if (vm.count("csglimit")) {
 		RenderSettings::inst()->openCSGTermLimit = vm["csglimit"].as<unsigned int>();
 	}
@@ -970,7 +1086,7 @@ int main(int argc, char **argv)
 
 	currentdir = fs::current_path().generic_string();
 
-	Camera camera = get_camera(vm);
+	auto cameras = get_cameras(vm);
 
 	// Initialize global visitors
 	NodeCache nodecache;
@@ -984,7 +1100,7 @@ int main(int argc, char **argv)
 
 	if (arg_info || cmdlinemode) {
 		if (inputFiles.size() > 1) help(argv[0], true);
-		rc = cmdline(deps_output_file, inputFiles[0], camera, output_file, original_path, renderer, parameterFile, parameterSet, argc, argv);
+		rc = cmdline(deps_output_file, inputFiles[0], cameras, output_file, original_path, renderer, parameterFile, parameterSet, argc, argv);
 	}
 	else if (QtUseGUI()) {
 		rc = gui(inputFiles, original_path, argc, argv);
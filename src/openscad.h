@@ -28,7 +28,8 @@
 
 #include <boost/filesystem.hpp>
 
-extern bool parse(class FileModule *&module, const char *text, const boost::filesystem::path &filename, int debug);
+// Parses source, followed by commandline_commands. The lexer scans source in place.
+extern bool parse(class FileModule *&module, class SourceBuffer &source, const boost::filesystem::path &filename, int debug);
 
 #include <string>
 extern std::string commandline_commands;
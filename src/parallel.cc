@@ -0,0 +1,96 @@
+#include "parallel.h"
+
+namespace {
+	std::mutex initializers_mutex;
+	std::atomic<size_t> num_initializers(0);
+	thread_local size_t applied_initializers = 0;
+
+	std::vector<void (*)()> &initializers()
+	{
+		static std::vector<void (*)()> list;
+		return list;
+	}
+}
+
+void register_thread_initializer(void (*initializer)())
+{
+	std::lock_guard<std::mutex> lock(initializers_mutex);
+	initializers().push_back(initializer);
+	num_initializers = initializers().size();
+}
+
+void initialize_thread()
+{
+	if (applied_initializers == num_initializers) return;
+	std::lock_guard<std::mutex> lock(initializers_mutex);
+	const auto &list = initializers();
+	for (; applied_initializers < list.size(); applied_initializers++) list[applied_initializers]();
+}
+
+ThreadPool &ThreadPool::instance()
+{
+	static ThreadPool pool;
+	return pool;
+}
+
+ThreadPool::ThreadPool() : stopping(false)
+{
+	unsigned int numthreads = std::max(1u, std::thread::hardware_concurrency());
+	for (unsigned int i = 1; i < numthreads; i++) {
+		this->threads.emplace_back(&ThreadPool::work, this);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->stopping = true;
+	}
+	this->wakeup.notify_all();
+	for (auto &thread : this->threads) thread.join();
+}
+
+void ThreadPool::work()
+{
+	std::unique_lock<std::mutex> lock(this->mutex);
+	while (true) {
+		this->wakeup.wait(lock, [this]() { return this->stopping || !this->jobs.empty(); });
+		if (this->stopping) return;
+
+		Job *job = this->jobs.front();
+		if (--job->pending == 0) this->jobs.pop_front();
+		job->running++;
+		lock.unlock();
+		initialize_thread();
+		(*job->task)();
+		lock.lock();
+		if (--job->running == 0) this->finished.notify_all();
+	}
+}
+
+void ThreadPool::run(size_t n, const std::function<void()> &task)
+{
+	initialize_thread();
+	n = std::min(n, concurrency());
+	if (n <= 1) {
+		task();
+		return;
+	}
+
+	Job job{&task, n - 1, 0};
+	{
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->jobs.push_back(&job);
+	}
+	this->wakeup.notify_all();
+
+	task();
+
+	std::unique_lock<std::mutex> lock(this->mutex);
+	if (job.pending > 0) {
+		this->jobs.erase(std::find(this->jobs.begin(), this->jobs.end(), &job));
+		job.pending = 0;
+	}
+	this->finished.wait(lock, [&job]() { return job.running == 0; });
+}
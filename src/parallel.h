@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "printutils.h"
+
+/*!
+	Per thread settings of libraries, e.g. CGAL's, which have to be applied in
+	every thread doing the work. Registered initializers run once per thread:
+	in pool threads and threads calling ThreadPool::run() before running a
+	task, and in other threads when they call initialize_thread().
+*/
+void register_thread_initializer(void (*initializer)());
+void initialize_thread();
+
+/*!
+	Process wide pool of worker threads, one less than the number of cores,
+	started on first use and reused by all parallel operations.
+
+	run() executes a task on the calling thread and on up to n - 1 idle pool
+	threads at the same time. Pool threads which haven't picked up the task
+	by the time the calling thread is done with it are not waited for, so
+	the calling thread must be able to do all the work by itself. Tasks
+	usually take work items from shared state until there are none left.
+	This also makes it safe to call run() from within a task.
+*/
+class ThreadPool
+{
+public:
+	static ThreadPool &instance();
+
+	// Number of threads which can run a task, including the calling thread
+	size_t concurrency() const { return this->threads.size() + 1; }
+	// Returns once the calling thread and all pool threads which picked up
+	// task are done. task must not throw.
+	void run(size_t n, const std::function<void()> &task);
+
+private:
+	ThreadPool();
+	~ThreadPool();
+
+	struct Job {
+		const std::function<void()> *task;
+		size_t pending; // pool threads which may still pick up the task
+		size_t running;
+	};
+	void work();
+
+	std::vector<std::thread> threads;
+	std::mutex mutex;
+	std::condition_variable wakeup;
+	std::condition_variable finished;
+	std::deque<Job *> jobs;
+	bool stopping;
+};
+
+/*!
+	Calls f(begin, end) for consecutive ranges of at most grainsize indices
+	covering [0, n), spread over the ThreadPool. The calling thread takes part
+	and the call returns once all ranges are done.
+
+	Messages printed by f are collected per range and printed in the order of
+	the ranges afterwards, so the output doesn't depend on the number of
+	threads. If f throws, the first exception is rethrown after all threads
+	are done.
+*/
+template <typename F>
+void parallel_for(size_t n, size_t grainsize, F f)
+{
+	size_t numranges = (n + grainsize - 1) / grainsize;
+	size_t numthreads = std::min(ThreadPool::instance().concurrency(), numranges);
+	if (numthreads <= 1) {
+		if (n > 0) f(0, n);
+		return;
+	}
+
+	std::vector<DeferredMessages> messages(numranges);
+	std::atomic<size_t> next(0);
+	std::atomic<bool> failed(false);
+	std::exception_ptr exception;
+	auto worker = [&]() {
+		size_t i;
+		while (!failed && (i = next++) < numranges) {
+			auto previous = print_messages_defer(&messages[i]);
+			try {
+				f(i * grainsize, std::min(n, (i + 1) * grainsize));
+			}
+			catch (...) {
+				if (!failed.exchange(true)) exception = std::current_exception();
+			}
+			print_messages_defer(previous);
+		}
+	};
+
+	ThreadPool::instance().run(numthreads, worker);
+
+	for (const auto &m : messages) print_deferred_messages(m);
+	if (exception) std::rethrow_exception(exception);
+}
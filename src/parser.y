@@ -26,6 +26,51 @@
 
 %expect 2 /* Expect 2 shift/reduce conflict for ifelse_statement - "dangling else problem" */
 
+%code requires {
+
+#include <stack>
+#include <vector>
+#include <string>
+#include <memory>
+#include <boost/filesystem.hpp>
+#include "SourceBuffer.h"
+
+class FileModule;
+class LocalScope;
+
+/*
+  State of one run of the parser and lexer. Each call to parse() has its own,
+  so several files can be parsed concurrently.
+*/
+struct ParserState {
+  ParserState() : rootmodule(nullptr), source(nullptr), source_pos(nullptr), error_pos(-1), column(1), scanner(nullptr) { }
+
+  // Filename of the source file currently being lexed
+  boost::filesystem::path sourcefile() const;
+
+  FileModule *rootmodule;
+  std::stack<LocalScope *> scope_stack;
+  boost::filesystem::path parser_sourcefile;
+  SourceBuffer *source;
+  // Where the lexer left source for an include file or the command line
+  // assignments, see lexer.l
+  const char *source_pos;
+  int error_pos;
+
+  // Lexer state, see lexer.l
+  int column;
+  std::vector<boost::filesystem::path> filename_stack;
+  std::vector<int> lineno_stack;
+  std::vector<std::unique_ptr<SourceBuffer>> includes;
+  std::vector<std::string> openfilenames;
+  std::string filename;
+  std::string filepath;
+  std::string stringcontents;
+  void *scanner;
+};
+
+}
+
 %{
 
 #include <sys/types.h>
@@ -41,7 +86,9 @@
 #include "expression.h"
 #include "value.h"
 #include "function.h"
+#include "ASTOptimizer.h"
 #include "printutils.h"
+#include "openscad.h"
 #include "memory.h"
 #include <sstream>
 #include <boost/filesystem.hpp>
@@ -51,27 +98,15 @@ namespace fs = boost::filesystem;
 #define YYMAXDEPTH 20000
 #define LOC(loc) Location(loc.first_line, loc.first_column, loc.last_line, loc.last_column)
   
-int parser_error_pos = -1;
-
-int parserlex(void);
-void yyerror(char const *s);
-
-int lexerget_lineno(void);
-fs::path sourcefile(void);
-int lexerlex_destroy(void);
-int lexerlex(void);
-
-std::stack<LocalScope *> scope_stack;
-FileModule *rootmodule;
-
-extern void lexerdestroy();
-extern FILE *lexerin;
-extern const char *parser_input_buffer;
-const char *parser_input_buffer;
-fs::path parser_sourcefile;
+thread_local int parser_error_pos = -1;
 
 %}
 
+%define api.pure
+%locations
+%parse-param { ParserState *state }
+%lex-param { ParserState *state }
+
 %union {
   char *text;
   double number;
@@ -84,6 +119,21 @@ fs::path parser_sourcefile;
   AssignmentList *args;
 }
 
+%code {
+
+int parserlex(YYSTYPE *lval, YYLTYPE *lloc, ParserState *state);
+void yyerror(YYLTYPE *lloc, ParserState *state, char const *s);
+
+// Reentrant lexer interface, see lexer.l
+int lexerlex_init_extra(ParserState *state, void **scanner);
+int lexerlex_destroy(void *scanner);
+int lexerget_lineno(void *scanner);
+int lexerlex(YYSTYPE *lval, YYLTYPE *lloc, void *scanner);
+void push_buffer(SourceBuffer &buffer, void *scanner);
+int lexer_error_pos(void *scanner);
+
+}
+
 %token TOK_ERROR
 
 %token TOK_MODULE
@@ -153,7 +203,7 @@ fs::path parser_sourcefile;
 input:    /* empty */
         | TOK_USE
             {
-              rootmodule->registerUse(std::string($1));
+              state->rootmodule->registerUse(std::string($1));
               free($1);
             }
           input
@@ -165,26 +215,26 @@ statement:
         | '{' inner_input '}'
         | module_instantiation
             {
-              if ($1) scope_stack.top()->addChild($1);
+              if ($1) state->scope_stack.top()->addChild($1);
             }
         | assignment
         | TOK_MODULE TOK_ID '(' arguments_decl optional_commas ')'
             {
               UserModule *newmodule = new UserModule(LOC(@$));
               newmodule->definition_arguments = *$4;
-              scope_stack.top()->addModule($2, newmodule);
-              scope_stack.push(&newmodule->scope);
+              state->scope_stack.top()->addModule($2, newmodule);
+              state->scope_stack.push(&newmodule->scope);
               free($2);
               delete $4;
             }
           statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
             }
         | TOK_FUNCTION TOK_ID '(' arguments_decl optional_commas ')' '=' expr
             {
               UserFunction *func = UserFunction::create($2, *$4, shared_ptr<Expression>($8), LOC(@$));
-              scope_stack.top()->addFunction(func);
+              state->scope_stack.top()->addFunction(func);
               free($2);
               delete $4;
             }
@@ -200,7 +250,7 @@ assignment:
           TOK_ID '=' expr ';'
             {
                 bool found = false;
-                for (auto &assignment : scope_stack.top()->assignments) {
+                for (auto &assignment : state->scope_stack.top()->assignments) {
                     if (assignment.name == $1) {
                         assignment.expr = shared_ptr<Expression>($3);
                         assignment.setLocation(LOC(@$));
@@ -209,7 +259,7 @@ assignment:
                     }
                 }
                 if (!found) {
-                  scope_stack.top()->addAssignment(Assignment($1, shared_ptr<Expression>($3), LOC(@$)));
+                  state->scope_stack.top()->addAssignment(Assignment($1, shared_ptr<Expression>($3), LOC(@$)));
                 }
                 free($1);
             }
@@ -239,11 +289,11 @@ module_instantiation:
         | single_module_instantiation
             {
                 $<inst>$ = $1;
-                scope_stack.push(&$1->scope);
+                state->scope_stack.push(&$1->scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
                 $$ = $<inst>2;
             }
         | ifelse_statement
@@ -259,11 +309,11 @@ ifelse_statement:
             }
         | if_statement TOK_ELSE
             {
-                scope_stack.push(&$1->else_scope);
+                state->scope_stack.push(&$1->else_scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
                 $$ = $1;
             }
         ;
@@ -271,12 +321,12 @@ ifelse_statement:
 if_statement:
           TOK_IF '(' expr ')'
             {
-                $<ifelse>$ = new IfElseModuleInstantiation(shared_ptr<Expression>($3), parser_sourcefile.parent_path().generic_string(), LOC(@$));
-                scope_stack.push(&$<ifelse>$->scope);
+                $<ifelse>$ = new IfElseModuleInstantiation(shared_ptr<Expression>($3), state->parser_sourcefile.parent_path().generic_string(), LOC(@$));
+                state->scope_stack.push(&$<ifelse>$->scope);
             }
           child_statement
             {
-                scope_stack.pop();
+                state->scope_stack.pop();
                 $$ = $<ifelse>5;
             }
         ;
@@ -292,7 +342,7 @@ child_statement:
         | '{' child_statements '}'
         | module_instantiation
             {
-                if ($1) scope_stack.top()->addChild($1);
+                if ($1) state->scope_stack.top()->addChild($1);
             }
         ;
 
@@ -309,7 +359,7 @@ module_id:
 single_module_instantiation:
           module_id '(' arguments_call ')'
             {
-                $$ = new ModuleInstantiation($1, *$3, parser_sourcefile.parent_path().generic_string(), LOC(@$));
+                $$ = new ModuleInstantiation($1, *$3, state->parser_sourcefile.parent_path().generic_string(), LOC(@$));
                 free($1);
                 delete $3;
             }
@@ -616,39 +666,46 @@ argument_call:
 
 %%
 
-int parserlex(void)
+int parserlex(YYSTYPE *lval, YYLTYPE *lloc, ParserState *state)
 {
-  return lexerlex();
+  return lexerlex(lval, lloc, state->scanner);
 }
 
-void yyerror (char const *s)
+void yyerror(YYLTYPE *, ParserState *state, char const *s)
 {
   // FIXME: We leak memory on parser errors...
   PRINTB("ERROR: Parser error in file %s, line %d: %s\n",
-         sourcefile() % lexerget_lineno() % s);
+         state->sourcefile() % lexerget_lineno(state->scanner) % s);
+  state->error_pos = lexer_error_pos(state->scanner);
 }
 
-bool parse(FileModule *&module, const char *text, const fs::path &filename, int debug)
+bool parse(FileModule *&module, SourceBuffer &source, const fs::path &filename, int debug)
 {
-  lexerin = NULL;
-  parser_error_pos = -1;
-  parser_input_buffer = text;
-  parser_sourcefile = fs::absolute(filename);
-
-  rootmodule = new FileModule();
-  rootmodule->setModulePath(filename.parent_path().generic_string());
-  scope_stack.push(&rootmodule->scope);
-  //        PRINTB_NOCACHE("New module: %s %p", "root" % rootmodule);
-
-  parserdebug = debug;
-  int parserretval = parserparse();
-  lexerdestroy();
-  lexerlex_destroy();
-
-  module = rootmodule;
+  ParserState state;
+  state.source = &source;
+  state.parser_sourcefile = fs::absolute(filename);
+
+  state.rootmodule = new FileModule();
+  state.rootmodule->setModulePath(filename.parent_path().generic_string());
+  state.scope_stack.push(&state.rootmodule->scope);
+  //        PRINTB_NOCACHE("New module: %s %p", "root" % state.rootmodule);
+
+  // The command line assignments are scanned after the source, see lexer.l
+  SourceBuffer commands("\n" + commandline_commands);
+
+  // Only written when set, since other threads may be parsing
+  if (debug) parserdebug = debug;
+  lexerlex_init_extra(&state, &state.scanner);
+  push_buffer(commands, state.scanner);
+  push_buffer(source, state.scanner);
+  int parserretval = parserparse(&state);
+  lexerlex_destroy(state.scanner);
+
+  module = state.rootmodule;
+  parser_error_pos = state.error_pos;
   if (parserretval != 0) return false;
 
   parser_error_pos = -1;
-  scope_stack.pop();
+  ASTOptimizer::optimize(*state.rootmodule);
   return true;
 }
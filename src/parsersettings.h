@@ -5,7 +5,8 @@
 
 namespace fs = boost::filesystem;
 
-extern int parser_error_pos;
+// Position of the last parser error in the input, or -1
+extern thread_local int parser_error_pos;
 
 /**
  * Initialize library path.
@@ -46,45 +46,16 @@ static void draw_tri(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
 	if (mirror) glVertex3d(p1[0], p1[1], p1[2] + z); 
 }
 
-#ifndef NULLGL
-static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, bool e0, bool e1, bool e2, double z, bool mirrored)
-{
-	double ax = p1[0] - p0[0], bx = p1[0] - p2[0];
-	double ay = p1[1] - p0[1], by = p1[1] - p2[1];
-	double az = p1[2] - p0[2], bz = p1[2] - p2[2];
-	double nx = ay*bz - az*by;
-	double ny = az*bx - ax*bz;
-	double nz = ax*by - ay*bx;
-	double nl = sqrt(nx*nx + ny*ny + nz*nz);
-	glNormal3d(nx / nl, ny / nl, nz / nl);
-#ifdef ENABLE_OPENCSG
-	if (shaderinfo) {
-		double e0f = e0 ? 2.0 : -1.0;
-		double e1f = e1 ? 2.0 : -1.0;
-		double e2f = e2 ? 2.0 : -1.0;
-		draw_triangle(shaderinfo, p0, p1, p2, e0f, e1f, e2f, z, mirrored);
-	}
-	else
-#endif
-	{
-		draw_tri(p0, p1, p2, z, mirrored);
-	}
-}
-
-void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const
+/*!
+	Calls visit for each triangle of the surface render_surface() draws, with
+	the edge flags used by the OpenCSG edge shader. 2D objects become slabs of
+	1mm, whose top and bottom are offset by z.
+*/
+void PolySet::visit_surface(Renderer::csgmode_e csgmode, const TriangleVisitor &visit) const
 {
-	PRINTD("Polyset render");
-	bool mirrored = m.matrix().determinant() < 0;
-#ifdef ENABLE_OPENCSG
-	if (shaderinfo) {
-		glUniform1f(shaderinfo[7], shaderinfo[9]);
-		glUniform1f(shaderinfo[8], shaderinfo[10]);
-	}
-#endif /* ENABLE_OPENCSG */
 	if (this->dim == 2) {
 		// Render 2D objects 1mm thick, but differences slightly larger
 		double zbase = 1 + ((csgmode & CSGMODE_DIFFERENCE_FLAG) ? 0.1 : 0);
-		glBegin(GL_TRIANGLES);
 
 		// Render top+bottom
 		for (double z = -zbase/2; z < zbase; z += zbase) {
@@ -92,18 +63,18 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 				const Polygon *poly = &polygons[i];
 				if (poly->size() == 3) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(2), poly->at(1), true, true, true, z, mirrored);
+						visit(poly->at(0), poly->at(2), poly->at(1), true, true, true, z);
 					} else {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(2), true, true, true, z, mirrored);
+						visit(poly->at(0), poly->at(1), poly->at(2), true, true, true, z);
 					}
 				}
 				else if (poly->size() == 4) {
 					if (z < 0) {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(3), poly->at(1), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, poly->at(2), poly->at(1), poly->at(3), true, false, true, z, mirrored);
+						visit(poly->at(0), poly->at(3), poly->at(1), true, false, true, z);
+						visit(poly->at(2), poly->at(1), poly->at(3), true, false, true, z);
 					} else {
-						gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(3), true, false, true, z, mirrored);
-						gl_draw_triangle(shaderinfo, poly->at(2), poly->at(3), poly->at(1), true, false, true, z, mirrored);
+						visit(poly->at(0), poly->at(1), poly->at(3), true, false, true, z);
+						visit(poly->at(2), poly->at(3), poly->at(1), true, false, true, z);
 					}
 				}
 				else {
@@ -116,11 +87,9 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					center[1] /= poly->size();
 					for (size_t j = 1; j <= poly->size(); j++) {
 						if (z < 0) {
-							gl_draw_triangle(shaderinfo, center, poly->at(j % poly->size()), poly->at(j - 1),
-									false, true, false, z, mirrored);
+							visit(center, poly->at(j % poly->size()), poly->at(j - 1), false, true, false, z);
 						} else {
-							gl_draw_triangle(shaderinfo, center, poly->at(j - 1), poly->at(j % poly->size()),
-									false, true, false, z, mirrored);
+							visit(center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, z);
 						}
 					}
 				}
@@ -135,8 +104,8 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					Vector3d p2(o.vertices[j-1][0], o.vertices[j-1][1], zbase/2);
 					Vector3d p3(o.vertices[j % o.vertices.size()][0], o.vertices[j % o.vertices.size()][1], -zbase/2);
 					Vector3d p4(o.vertices[j % o.vertices.size()][0], o.vertices[j % o.vertices.size()][1], zbase/2);
-					gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
-					gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
+					visit(p2, p1, p3, true, true, false, 0);
+					visit(p2, p3, p4, false, true, true, 0);
 				}
 			}
 		}
@@ -151,22 +120,20 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 					Vector3d p3 = poly->at(j % poly->size()), p4 = poly->at(j % poly->size());
 					p1[2] -= zbase/2, p2[2] += zbase/2;
 					p3[2] -= zbase/2, p4[2] += zbase/2;
-					gl_draw_triangle(shaderinfo, p2, p1, p3, true, true, false, 0, mirrored);
-					gl_draw_triangle(shaderinfo, p2, p3, p4, false, true, true, 0, mirrored);
+					visit(p2, p1, p3, true, true, false, 0);
+					visit(p2, p3, p4, false, true, true, 0);
 				}
 			}
 		}
-		glEnd();
 	} else if (this->dim == 3) {
 		for (size_t i = 0; i < polygons.size(); i++) {
 			const Polygon *poly = &polygons[i];
-			glBegin(GL_TRIANGLES);
 			if (poly->size() == 3) {
-				gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(2), true, true, true, 0, mirrored);
+				visit(poly->at(0), poly->at(1), poly->at(2), true, true, true, 0);
 			}
 			else if (poly->size() == 4) {
-				gl_draw_triangle(shaderinfo, poly->at(0), poly->at(1), poly->at(3), true, false, true, 0, mirrored);
-				gl_draw_triangle(shaderinfo, poly->at(2), poly->at(3), poly->at(1), true, false, true, 0, mirrored);
+				visit(poly->at(0), poly->at(1), poly->at(3), true, false, true, 0);
+				visit(poly->at(2), poly->at(3), poly->at(1), true, false, true, 0);
 			}
 			else {
 				Vector3d center = Vector3d::Zero();
@@ -179,10 +146,9 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 				center[1] /= poly->size();
 				center[2] /= poly->size();
 				for (size_t j = 1; j <= poly->size(); j++) {
-					gl_draw_triangle(shaderinfo, center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, 0, mirrored);
+					visit(center, poly->at(j - 1), poly->at(j % poly->size()), false, true, false, 0);
 				}
 			}
-			glEnd();
 		}
 	}
 	else {
@@ -190,24 +156,19 @@ void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m,
 	}
 }
 
-/*! This is used in throwntogether and CGAL mode
-
-	csgmode is set to CSGMODE_NONE in CGAL mode. In this mode a pure 2D rendering is performed.
-
-	For some reason, this is not used to render edges in Preview mode
+/*!
+	Calls visit for each line segment render_edges() draws
 */
-void PolySet::render_edges(Renderer::csgmode_e csgmode) const
+void PolySet::visit_edges(Renderer::csgmode_e csgmode, const EdgeVisitor &visit) const
 {
-	glDisable(GL_LIGHTING);
 	if (this->dim == 2) {
 		if (csgmode == Renderer::CSGMODE_NONE) {
 			// Render only outlines
 			for (const Outline2d &o : polygon.outlines()) {
-				glBegin(GL_LINE_LOOP);
-				for (const Vector2d &v : o.vertices) {
-					glVertex3d(v[0], v[1], 0);
+				for (size_t j = 1; j <= o.vertices.size(); j++) {
+					const Vector2d &v1 = o.vertices[j - 1], &v2 = o.vertices[j % o.vertices.size()];
+					visit(Vector3d(v1[0], v1[1], 0), Vector3d(v2[0], v2[1], 0));
 				}
-				glEnd();
 			}
 		}
 		else {
@@ -215,37 +176,88 @@ void PolySet::render_edges(Renderer::csgmode_e csgmode) const
 			double zbase = 1 + ((csgmode & CSGMODE_DIFFERENCE_FLAG) ? 0.1 : 0);
 
 			for (const Outline2d &o : polygon.outlines()) {
-				// Render top+bottom outlines
-				for (double z = -zbase/2; z < zbase; z += zbase) {
-					glBegin(GL_LINE_LOOP);
-					for (const Vector2d &v : o.vertices) {
-						glVertex3d(v[0], v[1], z);
+				for (size_t j = 1; j <= o.vertices.size(); j++) {
+					const Vector2d &v1 = o.vertices[j - 1], &v2 = o.vertices[j % o.vertices.size()];
+					// Render top+bottom outlines
+					for (double z = -zbase/2; z < zbase; z += zbase) {
+						visit(Vector3d(v1[0], v1[1], z), Vector3d(v2[0], v2[1], z));
 					}
-					glEnd();
-				}
-				// Render sides
-				glBegin(GL_LINES);
-				for (const Vector2d &v : o.vertices) {
-					glVertex3d(v[0], v[1], -zbase/2);
-					glVertex3d(v[0], v[1], +zbase/2);
+					// Render sides
+					visit(Vector3d(v1[0], v1[1], -zbase/2), Vector3d(v1[0], v1[1], +zbase/2));
 				}
-				glEnd();
 			}
 		}
 	} else if (dim == 3) {
 		for (size_t i = 0; i < polygons.size(); i++) {
 			const Polygon *poly = &polygons[i];
-			glBegin(GL_LINE_LOOP);
-			for (size_t j = 0; j < poly->size(); j++) {
-				const Vector3d &p = poly->at(j);
-				glVertex3d(p[0], p[1], p[2]);
+			for (size_t j = 1; j <= poly->size(); j++) {
+				visit(poly->at(j - 1), poly->at(j % poly->size()));
 			}
-			glEnd();
 		}
 	}
 	else {
 		assert(false && "Cannot render object with no dimension");
 	}
+}
+
+#ifndef NULLGL
+static void gl_draw_triangle(GLint *shaderinfo, const Vector3d &p0, const Vector3d &p1, const Vector3d &p2, bool e0, bool e1, bool e2, double z, bool mirrored)
+{
+	double ax = p1[0] - p0[0], bx = p1[0] - p2[0];
+	double ay = p1[1] - p0[1], by = p1[1] - p2[1];
+	double az = p1[2] - p0[2], bz = p1[2] - p2[2];
+	double nx = ay*bz - az*by;
+	double ny = az*bx - ax*bz;
+	double nz = ax*by - ay*bx;
+	double nl = sqrt(nx*nx + ny*ny + nz*nz);
+	glNormal3d(nx / nl, ny / nl, nz / nl);
+#ifdef ENABLE_OPENCSG
+	if (shaderinfo) {
+		double e0f = e0 ? 2.0 : -1.0;
+		double e1f = e1 ? 2.0 : -1.0;
+		double e2f = e2 ? 2.0 : -1.0;
+		draw_triangle(shaderinfo, p0, p1, p2, e0f, e1f, e2f, z, mirrored);
+	}
+	else
+#endif
+	{
+		draw_tri(p0, p1, p2, z, mirrored);
+	}
+}
+
+void PolySet::render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo) const
+{
+	PRINTD("Polyset render");
+	bool mirrored = m.matrix().determinant() < 0;
+#ifdef ENABLE_OPENCSG
+	if (shaderinfo) {
+		glUniform1f(shaderinfo[7], shaderinfo[9]);
+		glUniform1f(shaderinfo[8], shaderinfo[10]);
+	}
+#endif /* ENABLE_OPENCSG */
+	glBegin(GL_TRIANGLES);
+	visit_surface(csgmode, [&](const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
+														 bool e0, bool e1, bool e2, double z) {
+		gl_draw_triangle(shaderinfo, p0, p1, p2, e0, e1, e2, z, mirrored);
+	});
+	glEnd();
+}
+
+/*! This is used in throwntogether and CGAL mode
+
+	csgmode is set to CSGMODE_NONE in CGAL mode. In this mode a pure 2D rendering is performed.
+
+	For some reason, this is not used to render edges in Preview mode
+*/
+void PolySet::render_edges(Renderer::csgmode_e csgmode) const
+{
+	glDisable(GL_LIGHTING);
+	glBegin(GL_LINES);
+	visit_edges(csgmode, [](const Vector3d &p0, const Vector3d &p1) {
+		glVertex3d(p0[0], p0[1], p0[2]);
+		glVertex3d(p1[0], p1[1], p1[2]);
+	});
+	glEnd();
 	glEnable(GL_LIGHTING);
 }
 
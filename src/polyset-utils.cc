@@ -80,23 +80,12 @@ namespace PolysetUtils {
 		// Tessellate indexed mesh
 		const auto *verts = allVertices.getArray();
 		std::vector<IndexedTriangle> allTriangles;
-		for (const auto &faces : polygons) {
-			std::vector<IndexedTriangle> triangles;
-			auto err = false;
-			if (faces[0].size() == 3) {
-				triangles.emplace_back(faces[0][0], faces[0][1], faces[0][2]);
-			}
-			else {
-				err = GeometryUtils::tessellatePolygonWithHoles(verts, faces, triangles, nullptr);
-			}
-			if (!err) {
-				for (const auto &t : triangles) {
-					outps.append_poly();
-					outps.append_vertex(verts[t[0]]);
-					outps.append_vertex(verts[t[1]]);
-					outps.append_vertex(verts[t[2]]);
-				}
-			}
+		GeometryUtils::tessellatePolygonsWithHoles(verts, polygons, allTriangles);
+		for (const auto &t : allTriangles) {
+			outps.append_poly();
+			outps.append_vertex(verts[t[0]]);
+			outps.append_vertex(verts[t[1]]);
+			outps.append_vertex(verts[t[2]]);
 		}
 		if (degeneratePolygons > 0) PRINT("WARNING: PolySet has degenerate polygons");
 	}
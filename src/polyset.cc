@@ -29,6 +29,7 @@
 #include "linalg.h"
 #include "printutils.h"
 #include "grid.h"
+#include "VertexWelder.h"
 #include <Eigen/LU>
 
 /*! /class PolySet
@@ -208,13 +209,14 @@ void PolySet::resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &aut
 */
 void PolySet::quantizeVertices()
 {
-	Grid3d<int> grid(GRID_FINE);
+	VertexWelder welder(GRID_FINE, this->polygons.size());
 	std::vector<int> indices; // Vertex indices in one polygon
-	for (std::vector<Polygon>::iterator iter = this->polygons.begin(); iter != this->polygons.end();) {
-		Polygon &p = *iter;
+	// Collapsed polygons are removed by moving the remaining ones forward
+	auto outp = this->polygons.begin();
+	for (auto &p : this->polygons) {
 		indices.resize(p.size());
 		// Quantize all vertices. Build index list
-		for (unsigned int i=0;i<p.size();i++) indices[i] = grid.align(p[i]);
+		for (unsigned int i=0;i<p.size();i++) indices[i] = welder.align(p[i]);
 		// Remove consequtive duplicate vertices
 		Polygon::iterator currp = p.begin();
 		for (unsigned int i=0;i<indices.size();i++) {
@@ -225,11 +227,12 @@ void PolySet::quantizeVertices()
 		p.erase(currp, p.end());
 		if (p.size() < 3) {
 			PRINTD("Removing collapsed polygon due to quantizing");
-			this->polygons.erase(iter);
 		}
 		else {
-			iter++;
+			if (&*outp != &p) *outp = std::move(p);
+			outp++;
 		}
 	}
+	this->polygons.erase(outp, this->polygons.end());
 }
 
@@ -8,6 +8,7 @@
 #include "Polygon2d.h"
 #include <vector>
 #include <string>
+#include <functional>
 
 #include <boost/logic/tribool.hpp>
 BOOST_TRIBOOL_THIRD_STATE(unknown)
@@ -43,6 +44,12 @@ public:
 	void render_surface(Renderer::csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo = nullptr) const;
 	void render_edges(Renderer::csgmode_e csgmode) const;
 
+	typedef std::function<void(const Vector3d &p0, const Vector3d &p1, const Vector3d &p2,
+														 bool e0, bool e1, bool e2, double z)> TriangleVisitor;
+	typedef std::function<void(const Vector3d &p0, const Vector3d &p1)> EdgeVisitor;
+	void visit_surface(Renderer::csgmode_e csgmode, const TriangleVisitor &visit) const;
+	void visit_edges(Renderer::csgmode_e csgmode, const EdgeVisitor &visit) const;
+
 	void transform(const Transform3d &mat);
 	void resize(const Vector3d &newsize, const Eigen::Matrix<bool,3,1> &autosize);
 
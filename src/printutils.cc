@@ -15,6 +15,8 @@ bool OpenSCAD::quiet = false;
 
 boost::circular_buffer<std::string> lastmessages(5);
 
+static thread_local DeferredMessages *deferred_messages = nullptr;
+
 void set_output_handler(OutputHandlerFunc *newhandler, void *userdata)
 {
 	outputhandler = newhandler;
@@ -38,9 +40,28 @@ void print_messages_pop()
 	}
 }
 
+DeferredMessages *print_messages_defer(DeferredMessages *messages)
+{
+	auto previous = deferred_messages;
+	deferred_messages = messages;
+	return previous;
+}
+
+void print_deferred_messages(const DeferredMessages &messages)
+{
+	for (const auto &msg : messages) {
+		if (msg.first) PRINT_NOCACHE(msg.second);
+		else PRINT(msg.second);
+	}
+}
+
 void PRINT(const std::string &msg)
 {
 	if (msg.empty()) return;
+	if (deferred_messages) {
+		deferred_messages->emplace_back(false, msg);
+		return;
+	}
 	if (print_messages_stack.size() > 0) {
 		if (!print_messages_stack.back().empty()) {
 			print_messages_stack.back() += "\n";
@@ -53,6 +74,10 @@ void PRINT(const std::string &msg)
 void PRINT_NOCACHE(const std::string &msg)
 {
 	if (msg.empty()) return;
+	if (deferred_messages) {
+		deferred_messages->emplace_back(true, msg);
+		return;
+	}
 
 	if (boost::starts_with(msg, "WARNING") || boost::starts_with(msg, "ERROR")) {
 		size_t i;
@@ -2,6 +2,8 @@
 
 #include <string>
 #include <list>
+#include <vector>
+#include <utility>
 #include <iostream>
 #include <boost/format.hpp>
 
@@ -22,6 +24,16 @@ void set_output_handler(OutputHandlerFunc *newhandler, void *userdata);
 extern std::list<std::string> print_messages_stack;
 void print_messages_push();
 void print_messages_pop();
+
+/*
+	Messages printed by a worker thread are collected instead of being output,
+	so they can be printed in order by the main thread. The bool is true for
+	messages printed with PRINT_NOCACHE(). print_messages_defer() returns the
+	buffer used before, if any.
+*/
+typedef std::vector<std::pair<bool, std::string>> DeferredMessages;
+DeferredMessages *print_messages_defer(DeferredMessages *messages);
+void print_deferred_messages(const DeferredMessages &messages);
 void printDeprecation(const std::string &str);
 void resetSuppressedMessages();
 
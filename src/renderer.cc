@@ -2,6 +2,7 @@
 #include "rendersettings.h"
 #include "Geometry.h"
 #include "polyset.h"
+#include "VertexBufferCache.h"
 #include "Polygon2d.h"
 #include "colormap.h"
 #include "printutils.h"
@@ -102,12 +103,18 @@ void Renderer::setColorScheme(const ColorScheme &cs) {
 void Renderer::render_surface(shared_ptr<const Geometry> geom, csgmode_e csgmode, const Transform3d &m, GLint *shaderinfo)
 {
 	auto ps = dynamic_pointer_cast<const PolySet>(geom);
-	if (ps) ps->render_surface(csgmode, m, shaderinfo);
+	if (!ps) return;
+	auto cache = VertexBufferCache::current();
+	if (cache && cache->drawSurface(ps, csgmode, m, shaderinfo)) return;
+	ps->render_surface(csgmode, m, shaderinfo);
 }
 
 void Renderer::render_edges(shared_ptr<const Geometry> geom, csgmode_e csgmode)
 {
 	auto ps = dynamic_pointer_cast<const PolySet>(geom);
-	if (ps) ps->render_edges(csgmode);
+	if (!ps) return;
+	auto cache = VertexBufferCache::current();
+	if (cache && cache->drawEdges(ps, csgmode)) return;
+	ps->render_edges(csgmode);
 }
 
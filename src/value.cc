@@ -25,6 +25,7 @@
  */
 
 #include "value.h"
+#include "ValueIndex.h"
 #include "printutils.h"
 #include <cmath>
 #include <assert.h>
@@ -387,6 +388,38 @@ RangeType Value::toRange() const
   else return RangeType(0,0,0);
 }
 
+Value::VectorType::~VectorType()
+{
+  delete this->index;
+}
+
+Value::VectorType &Value::VectorType::operator=(const VectorType &v)
+{
+  if (this != &v) {
+    std::vector<ValuePtr>::operator=(v);
+    delete this->index;
+    this->index = nullptr;
+  }
+  return *this;
+}
+
+Value::VectorType &Value::VectorType::operator=(VectorType &&v)
+{
+  if (this != &v) {
+    std::vector<ValuePtr>::operator=(std::move(v));
+    delete this->index;
+    this->index = v.index;
+    v.index = nullptr;
+  }
+  return *this;
+}
+
+ValueIndex &Value::VectorType::getIndex() const
+{
+  if (!this->index) this->index = new ValueIndex();
+  return *this->index;
+}
+
 Value &Value::operator=(const Value &v)
 {
   if (this != &v) {
@@ -875,7 +908,7 @@ ValuePtr::ValuePtr(const char v)
 	this->reset(new Value(v));
 }
 
-ValuePtr::ValuePtr(const Value::VectorType &v)
+ValuePtr::ValuePtr(const std::vector<ValuePtr> &v)
 {
 	this->reset(new Value(v));
 }
@@ -13,6 +13,8 @@
 #include <cstdint>
 #include "memory.h"
 
+class ValueIndex;
+
 class QuotedString : public std::string
 {
 public:
@@ -136,7 +138,28 @@ private:
 class Value
 {
 public:
-	typedef std::vector<ValuePtr> VectorType;
+	/*!
+		The elements of a vector Value. Carries the search/lookup index over
+		the elements, which is created on first use and only valid as long as
+		the elements don't change. Copies start without an index.
+	*/
+	class VectorType : public std::vector<ValuePtr>
+	{
+	public:
+		using std::vector<ValuePtr>::vector;
+		VectorType() {}
+		VectorType(const std::vector<ValuePtr> &v) : std::vector<ValuePtr>(v) {}
+		VectorType(const VectorType &v) : std::vector<ValuePtr>(v) {}
+		VectorType(VectorType &&v) : std::vector<ValuePtr>(std::move(v)), index(v.index) { v.index = nullptr; }
+		~VectorType();
+		VectorType &operator=(const VectorType &v);
+		VectorType &operator=(VectorType &&v);
+
+		ValueIndex &getIndex() const;
+
+	private:
+		mutable ValueIndex *index = nullptr;
+	};
 
   enum class ValueType {
     UNDEFINED,
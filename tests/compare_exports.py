@@ -0,0 +1,141 @@
+#!/usr/bin/env python
+
+# Equivalence test
+#
+#
+# Usage: <script> <inputfile> --openscad=<executable-path> --format=<format> --reference-args=<args> [--reference-env=<name>=<value>] [--unordered] [--console] [--font-index] [<openscad args>]
+#
+#
+# step 1. Run OpenSCAD on the input file with the given args, export to the given format
+# step 2. Run OpenSCAD again, with the reference args instead
+# step 3. Compare the files exported by both runs. They should be the same!
+#         Options like --slices export several numbered files, which are
+#         compared in the order of their names.
+#
+# This checks that two ways of computing a result, e.g. an optimized and an
+# unoptimized one, agree, without needing expected output files.
+#
+# --reference-env: Set an environment variable for the reference run only.
+# --unordered: Compare the outlines of SVG files, or the facets of ASCII STL
+#              files, regardless of their order and starting vertex.
+# --console: Also compare the console output of both runs, except for timings.
+# --font-index: Run both with the fonts in testdata/ttf and a new font index,
+#               which the first run builds and the second run uses. The
+#               second run must not load the fontconfig configuration.
+#
+# This script should return 0 on success, not-0 on error.
+#
+
+import sys, os, re, subprocess, argparse, shlex, tempfile, shutil
+
+def failquit(*args):
+    if len(args)!=0: print(args)
+    print('compare_exports args:',str(sys.argv))
+    print('exiting compare_exports.py with failure')
+    sys.exit(1)
+
+def run(cmd, env):
+    print('Running OpenSCAD:')
+    print(' '.join(cmd))
+    proc = subprocess.Popen(cmd, env=env, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, universal_newlines=True)
+    output = proc.communicate()[0]
+    sys.stdout.write(output)
+    if proc.returncode != 0:
+        failquit('OpenSCAD failed with return code ' + str(proc.returncode))
+    return output
+
+def read(filename):
+    try:
+        with open(filename, 'rb') as f: return f.read()
+    except:
+        failquit('failure while reading ' + filename + ': ' + str(sys.exc_info()))
+
+# Returns the outlines of an SVG file as a sorted list, each outline rotated
+# to start at its smallest vertex.
+def svg_outlines(text):
+    outlines = []
+    for path in re.findall(r'<path d="([^"]*)"', text.decode('utf-8')):
+        for outline in path.split('z'):
+            points = re.findall(r'(-?[0-9.e+-]+),(-?[0-9.e+-]+)', outline)
+            if not points: continue
+            start = points.index(min(points))
+            outlines.append(points[start:] + points[:start])
+    return sorted(outlines)
+
+# Returns the facets of an ASCII STL file as a sorted list, each facet rotated
+# to start at its smallest vertex.
+def stl_facets(text):
+    facets = []
+    for facet in re.findall(r'facet normal(.*?)endfacet', text.decode('utf-8'), re.S):
+        points = re.findall(r'vertex\s+(\S+)\s+(\S+)\s+(\S+)', facet)
+        start = points.index(min(points))
+        facets.append(points[start:] + points[:start])
+    return sorted(facets)
+
+# Drops the lines which differ between runs anyway, and the font cache debug
+# output of --font-index
+def console_messages(text):
+    return [line for line in text.splitlines() if not re.search(r'time:|^FontCache: ', line)]
+
+#
+# Parse arguments
+#
+parser = argparse.ArgumentParser()
+parser.add_argument('--openscad', required=True, help='Specify OpenSCAD executable')
+parser.add_argument('--format', required=True, help='Specify export format')
+parser.add_argument('--reference-args', dest='referenceargs', required=True, help='Args of the reference run')
+parser.add_argument('--reference-env', dest='referenceenv', action='append', default=[], help='Environment variable of the reference run, as name=value')
+parser.add_argument('--unordered', action='store_true', help='Ignore the order of SVG outlines and STL facets')
+parser.add_argument('--console', action='store_true', help='Also compare console output')
+parser.add_argument('--font-index', dest='fontindex', action='store_true', help='Build a font index in the first run')
+args,remaining_args = parser.parse_known_args()
+
+inputfile = remaining_args[0]
+remaining_args = remaining_args[1:]    # Passed on to the first OpenSCAD run
+
+if not os.path.exists(inputfile):
+    failquit('cant find input file named: ' + inputfile)
+if not os.path.exists(args.openscad):
+    failquit('cant find openscad executable named: ' + args.openscad)
+
+outputdir = tempfile.mkdtemp()
+env = os.environ.copy()
+if args.fontindex:
+    indexdir = tempfile.mkdtemp()
+    env['OPENSCAD_FONT_INDEX'] = os.path.join(indexdir, 'fontindex')
+    env['OPENSCAD_FONT_PATH'] = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'testdata', 'ttf')
+# Both runs export to the same file, so that their console output is alike
+exportfile = os.path.join(outputdir, os.path.splitext(os.path.basename(inputfile))[0] + '.' + args.format)
+
+def export(openscad_args, env):
+    if args.fontindex:
+        openscad_args = openscad_args + ['--debug=FontCache']
+    output = run([args.openscad, inputfile, '-o', exportfile] + openscad_args, env)
+    files = [os.path.join(outputdir, f) for f in sorted(os.listdir(outputdir))]
+    results = [read(f) for f in files]
+    for f in files: os.remove(f)
+    if args.unordered:
+        results = [stl_facets(r) if args.format == 'stl' else svg_outlines(r) for r in results]
+    return output, results
+
+referenceenv = env.copy()
+for var in args.referenceenv:
+    name, value = var.split('=', 1)
+    referenceenv[name] = value
+
+output, results = export(remaining_args, env)
+referenceoutput, references = export(shlex.split(args.referenceargs), referenceenv)
+shutil.rmtree(outputdir, True)
+if args.fontindex:
+    if not os.path.exists(env['OPENSCAD_FONT_INDEX']):
+        failquit('No font index was written')
+    if 'FontCache: Using font index' not in referenceoutput or 'FontCache: Loading fontconfig' in referenceoutput:
+        failquit('The second run did not use the font index')
+    shutil.rmtree(indexdir, True)
+
+if not results:
+    failquit('Nothing was exported')
+if results != references:
+    failquit('Exported files differ')
+if args.console and console_messages(output) != console_messages(referenceoutput):
+    failquit('Console output differs')
@@ -0,0 +1,162 @@
+/*
+ *  OpenSCAD (www.openscad.org)
+ *  Copyright (C) 2009-2011 Clifford Wolf <clifford@clifford.at> and
+ *                          Marius Kintel <marius@kintel.net>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  As a special exception, you have permission to link this program
+ *  with the CGAL library and distribute executables, as long as you
+ *  follow the requirements of the GNU GPL in regard to all of the
+ *  software in the executable aside from CGAL.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ *
+ */
+
+/*
+	Compiles a file into CSG products twice, with $t = 0 and $t = 1, using
+	one normalizer, as the GUI does for consecutive previews. Checks that
+	leaves of the second compile show the labels of their nodes in that
+	compile, and that they keep the geometry of the first compile, which
+	the normalizer needs to reuse their products.
+*/
+
+#include "tests-common.h"
+#include "openscad.h"
+#include "parsersettings.h"
+#include "node.h"
+#include "module.h"
+#include "ModuleInstantiation.h"
+#include "modcontext.h"
+#include "value.h"
+#include "builtin.h"
+#include "Tree.h"
+#include "GeometryEvaluator.h"
+#include "CSGTreeEvaluator.h"
+#include "CSGTreeNormalizer.h"
+#include "csgnode.h"
+#include "rendersettings.h"
+#include "PlatformUtils.h"
+#include "stackcheck.h"
+
+#include <fstream>
+#include <map>
+#include <set>
+
+#include <boost/filesystem.hpp>
+namespace fs = boost::filesystem;
+
+std::string commandline_commands;
+std::string currentdir;
+
+// Collects the label of the leaf of each geometry
+static void collectLabels(const shared_ptr<CSGNode> &node, std::map<const Geometry *, std::string> &labels)
+{
+	if (auto leaf = dynamic_pointer_cast<CSGLeaf>(node)) {
+		labels[leaf->geom.get()] = leaf->label;
+	}
+	else if (auto op = dynamic_pointer_cast<CSGOperation>(node)) {
+		collectLabels(op->left(), labels);
+		collectLabels(op->right(), labels);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s <file.scad> <output.txt>\n", argv[0]);
+		exit(1);
+	}
+
+	const char *filename = argv[1];
+	const char *outfilename = argv[2];
+
+	StackCheck::inst()->init();
+	Builtins::instance()->initialize();
+
+	fs::path original_path = fs::current_path();
+
+	currentdir = fs::current_path().generic_string();
+
+	std::string applicationpath = fs::path(argv[0]).branch_path().generic_string();
+	PlatformUtils::registerApplicationPath(applicationpath);
+	parser_init();
+
+	ModuleContext top_ctx;
+	top_ctx.registerBuiltin();
+
+	FileModule *root_module;
+	ModuleInstantiation root_inst("group");
+
+	root_module = parsefile(filename);
+	if (!root_module) {
+		exit(1);
+	}
+
+	if (fs::path(filename).has_parent_path()) {
+		fs::current_path(fs::path(filename).parent_path());
+	}
+
+	CSGTreeNormalizer normalizer(RenderSettings::inst()->openCSGTermLimit);
+	std::stringstream out;
+	std::set<const Geometry *> firstgeometries;
+	int stale = 0, newgeometries = 0;
+	for (int i = 0; i < 2; i++) {
+		top_ctx.set_variable("$t", ValuePtr(double(i)));
+		AbstractNode::resetIndexCounter();
+		AbstractNode *root_node = root_module->instantiate(&top_ctx, &root_inst);
+
+		Tree tree;
+		tree.setRoot(root_node);
+		GeometryEvaluator geomevaluator(tree);
+		CSGTreeEvaluator evaluator(tree, &geomevaluator);
+		auto csgRoot = evaluator.buildCSGTree(*root_node);
+		auto normalizedRoot = csgRoot ? normalizer.normalize(csgRoot) : csgRoot;
+
+		CSGProducts products;
+		if (normalizedRoot) products.import(normalizedRoot);
+		out << "Compile " << i << ": " << products.products.size() << " products\n";
+
+		std::map<const Geometry *, std::string> labels;
+		if (csgRoot) collectLabels(csgRoot, labels);
+		for (const auto &product : products.products) {
+			for (const auto *objects : {&product.intersections, &product.subtractions}) {
+				for (const auto &csgobj : *objects) {
+					const Geometry *geom = csgobj.leaf->geom.get();
+					if (i == 0) firstgeometries.insert(geom);
+					else {
+						if (labels[geom] != csgobj.leaf->label) stale++;
+						if (!firstgeometries.count(geom)) newgeometries++;
+					}
+				}
+			}
+		}
+
+		delete root_node;
+	}
+	out << "Leaves with stale labels: " << stale << "\n";
+	out << "Leaves with new geometry: " << newgeometries << "\n";
+
+	current_path(original_path);
+	std::ofstream outfile;
+	outfile.open(outfilename);
+	outfile << out.str();
+	outfile.close();
+
+	delete root_module;
+
+	Builtins::instance(true);
+
+	return 0;
+}
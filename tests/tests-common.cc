@@ -1,5 +1,6 @@
 #include "tests-common.h"
 #include "openscad.h"
+#include "SourceBuffer.h"
 #include "FileModule.h"
 #include "handle_dep.h"
 
@@ -20,17 +21,15 @@ FileModule *parsefile(const char *filename, const char *fakepath)
 	FileModule *root_module = NULL;
 
 	handle_dep(filename);
-	std::ifstream ifs(filename);
-	if (!ifs.is_open()) {
+	SourceBuffer source;
+	if (!source.load(filename)) {
 		fprintf(stderr, "Can't open input file `%s'!\n", filename);
 	}
 	else {
-		std::string text((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
-		text += "\n" + commandline_commands;
 		std::string pathname;
 		if (fakepath) pathname = fakepath;
 		else pathname = fs::path(filename).parent_path().generic_string();
-		if(!parse(root_module, text.c_str(), pathname.c_str(), false)) {
+		if(!parse(root_module, source, pathname.c_str(), false)) {
 			delete root_module;             // parse failed
 			root_module = NULL;
 		}